@@ -0,0 +1,119 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include "dict.h"
+using namespace std;
+using namespace StemCell;
+
+// Dict::parseField/parseList必须与原来基于stringstream的解析逐字节一致, 有差异时返回1
+
+static int failures = 0;
+
+template<class T>
+static string show(const vector<T> &values) {
+    ostringstream out;
+    out << "[";
+    for (size_t i = 0; i < values.size(); ++i) {
+        out << (i ? "," : "") << values[i];
+    }
+    out << "]";
+    return out.str();
+}
+
+// the original buildVectorValueTypeMapDict loop
+template<class T>
+static vector<T> referenceList(const string &source) {
+    stringstream s_value(source);
+    T tmp;
+    vector<T> result;
+    while (s_value >> tmp) {
+        result.push_back(tmp);
+        if (s_value.peek() == VEC_DICT_SEP) {
+            s_value.ignore();
+        }
+    }
+    return result;
+}
+
+template<class T>
+static void check(const string &source, const char *type) {
+    vector<T> list;
+    Dict::parseList(VEC_DICT_SEP, source, list);
+    vector<T> expectList = referenceList<T>(source);
+    if (show(list) != show(expectList)) {
+        cout << "parseList<" << type << ">(\"" << source << "\") = " << show(list)
+            << " expected " << show(expectList) << endl;
+        ++failures;
+    }
+    T value = T();
+    Dict::parseField(source, value);
+    stringstream s_field;
+    s_field << source;
+    T expect = T();
+    s_field >> expect;
+    if (show(vector<T>(1, value)) != show(vector<T>(1, expect))) {
+        cout << "parseField<" << type << ">(\"" << source << "\") = " << value
+            << " expected " << expect << endl;
+        ++failures;
+    }
+}
+
+static void checkAll(const string &source) {
+    check<int32_t>(source, "int32_t");
+    check<int64_t>(source, "int64_t");
+    check<uint32_t>(source, "uint32_t");
+    check<uint64_t>(source, "uint64_t");
+    check<double>(source, "double");
+    check<float>(source, "float");
+    check<string>(source, "string");
+}
+
+static void checkFile(Dict::LoadMode mode) {
+    const char *fileName = "dict_parse_regression.txt";
+    {
+        ofstream out(fileName);
+        out << "1\t1 2 3\n2\t4,5,6\n3\t7, 8 ,9\n";
+    }
+    Dict::setLoadMode(mode);
+    map<int64_t, vector<int32_t> > *dict = Dict::buildVectorValueTypeMapDict<int64_t, int32_t>(fileName);
+    map<int64_t, vector<string> > *strings = Dict::buildVectorValueTypeMapDict<int64_t, string>(fileName);
+    remove(fileName);
+    if (dict == nullptr || strings == nullptr || show((*dict)[1]) != "[1,2,3]"
+            || show((*dict)[2]) != "[4,5,6]" || show((*dict)[3]) != "[7,8]"
+            || (*strings)[1].size() != 3 || (*strings)[2].size() != 1) {
+        cout << "buildVectorValueTypeMapDict differs in load mode " << mode << endl;
+        ++failures;
+    }
+    delete dict;
+    delete strings;
+}
+
+int main() {
+    const char *cases[] = {
+        "1 2 3", "1,2,3", "x,y,z", "x y z", " 1, 2 ,3", "1,,2", "+5", "+-5", "-5", "-1",
+        "12abc", "1.5", ".5", "-.5", "1e5", "1e", "1e+", "1.5.3", "inf", "-inf", "nan",
+        "1e400", "-1e400", "1e-400", "99999999999999999999", "4294967296", "-2147483649",
+        "0x10", "", " ", "\t7\t", "007", "1,", ",1",
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        checkAll(cases[i]);
+    }
+    mt19937 rng(20121012);
+    const string alphabet = "0123456789 ,.-+eE\tinfax";
+    for (int i = 0; i < 100000; ++i) {
+        string source;
+        size_t length = rng() % 12;
+        for (size_t j = 0; j < length; ++j) {
+            source += alphabet[rng() % alphabet.size()];
+        }
+        checkAll(source);
+    }
+    checkFile(Dict::LOAD_MODE_STREAM);
+    checkFile(Dict::LOAD_MODE_MMAP);
+    cout << (failures == 0 ? "ok" : "FAILED") << endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "flat_map.hpp"
+#include "flat_hash_map.hpp"
+#include "perfect_hash_dict.hpp"
+using namespace std;
+using namespace StemCell;
+
+// 逐个find与lookupBatch的对比, 词典远大于cache时批量查找的收益最明显
+template<class K, class F>
+int64_t benchmark(const string &name, const vector<K> &keys, size_t batch, F f) {
+    vector<const int32_t*> out(batch);
+    int64_t hits = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t begin = 0; begin + batch <= keys.size(); begin += batch) {
+        f(keys.data() + begin, batch, out.data());
+        for (size_t i = 0; i < batch; ++i) {
+            hits += out[i] != nullptr;
+        }
+    }
+    int64_t ns = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - start).count();
+    cout << name << "\tbatch:" << batch << "\t" << ns / (keys.size() / batch * batch)
+        << " ns/key\thits:" << hits << endl;
+    return ns;
+}
+
+int main() {
+    const size_t dictSize = 4 << 20;
+    const size_t lookups = 1 << 21;
+    mt19937_64 rng(20121012);
+
+    vector<pair<int64_t, int32_t> > entries;
+    for (size_t i = 0; i < dictSize; ++i) {
+        entries.emplace_back(static_cast<int64_t>(rng() >> 1), static_cast<int32_t>(i));
+    }
+    vector<int64_t> intKeys;
+    for (size_t i = 0; i < lookups; ++i) {
+        // about 90% hits
+        intKeys.push_back(i % 10 == 0 ? static_cast<int64_t>(rng() >> 1)
+                : entries[rng() % dictSize].first);
+    }
+    FlatHashMap<int64_t, int32_t> hashMap{vector<pair<int64_t, int32_t> >(entries)};
+    SortedVectorMap<int64_t, int32_t> sortedMap{vector<pair<int64_t, int32_t> >(entries)};
+
+    vector<pair<string, int32_t> > stringEntries;
+    for (size_t i = 0; i < dictSize / 4; ++i) {
+        stringEntries.emplace_back("key_" + to_string(entries[i].first), static_cast<int32_t>(i));
+    }
+    vector<string> stringKeys;
+    for (size_t i = 0; i < lookups; ++i) {
+        stringKeys.push_back(stringEntries[rng() % stringEntries.size()].first);
+    }
+    PerfectHashDict<int32_t> perfectHash{vector<pair<string, int32_t> >(stringEntries)};
+    // 基线: 替换之前的node-based哈希表
+    unordered_map<int64_t, int32_t> stdHashMap(entries.begin(), entries.end());
+    unordered_map<string, int32_t> stdStringMap(stringEntries.begin(), stringEntries.end());
+
+    for (size_t batch = 8; batch <= 1024; batch *= 2) {
+        benchmark("std::unordered_map::find", intKeys, batch,
+                [&](const int64_t *keys, size_t n, const int32_t **out) {
+            for (size_t i = 0; i < n; ++i) {
+                auto it = stdHashMap.find(keys[i]);
+                out[i] = it == stdHashMap.end() ? nullptr : &it->second;
+            }
+        });
+        benchmark("FlatHashMap::find", intKeys, batch,
+                [&](const int64_t *keys, size_t n, const int32_t **out) {
+            for (size_t i = 0; i < n; ++i) {
+                auto it = hashMap.find(keys[i]);
+                out[i] = it == hashMap.end() ? nullptr : &it->second;
+            }
+        });
+        benchmark("FlatHashMap::lookupBatch", intKeys, batch,
+                [&](const int64_t *keys, size_t n, const int32_t **out) {
+            hashMap.lookupBatch(keys, n, out);
+        });
+        benchmark("SortedVectorMap::find", intKeys, batch,
+                [&](const int64_t *keys, size_t n, const int32_t **out) {
+            for (size_t i = 0; i < n; ++i) {
+                auto it = sortedMap.find(keys[i]);
+                out[i] = it == sortedMap.end() ? nullptr : &it->second;
+            }
+        });
+        benchmark("SortedVectorMap::lookupBatch", intKeys, batch,
+                [&](const int64_t *keys, size_t n, const int32_t **out) {
+            sortedMap.lookupBatch(keys, n, out);
+        });
+        benchmark("std::unordered_map<string>::find", stringKeys, batch,
+                [&](const string *keys, size_t n, const int32_t **out) {
+            for (size_t i = 0; i < n; ++i) {
+                auto it = stdStringMap.find(keys[i]);
+                out[i] = it == stdStringMap.end() ? nullptr : &it->second;
+            }
+        });
+        benchmark("PerfectHashDict::find", stringKeys, batch,
+                [&](const string *keys, size_t n, const int32_t **out) {
+            for (size_t i = 0; i < n; ++i) {
+                out[i] = perfectHash.find(keys[i]);
+            }
+        });
+        benchmark("PerfectHashDict::lookupBatch", stringKeys, batch,
+                [&](const string *keys, size_t n, const int32_t **out) {
+            perfectHash.lookupBatch(keys, n, out);
+        });
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <map>
+#include <vector>
+#include "posting_list.h"
+using namespace std;
+using namespace StemCell;
+
+// 压缩列表的解码/遍历与std::vector直接遍历的对比, 以及两者占用的内存
+template<class F>
+int64_t benchmark(const string &name, int64_t entries, F f) {
+    auto start = chrono::steady_clock::now();
+    int64_t sum = f();
+    int64_t ns = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - start).count();
+    cout << name << "\t" << ns / 1000000 << " ms\t" << (entries > 0 ? ns * 1000 / entries : 0)
+        << " ps/entry\tsum:" << sum << endl;
+    return ns;
+}
+
+int main() {
+    // 与线上倒排相近: 有序的id列表, 长度从几个到几千个不等
+    mt19937_64 rng(20121012);
+    map<int64_t, vector<int32_t> > source;
+    size_t rawBytes = 0;
+    for (int64_t key = 0; key < 100000; ++key) {
+        vector<int32_t> &list = source[key];
+        size_t n = 1 + rng() % (key % 100 == 0 ? 5000 : 100);
+        int32_t id = static_cast<int32_t>(rng() % 1000);
+        for (size_t i = 0; i < n; ++i) {
+            id += 1 + static_cast<int32_t>(rng() % 64);
+            list.push_back(id);
+        }
+        rawBytes += sizeof(list) + list.capacity() * sizeof(int32_t);
+    }
+    CompressedVecMapDict<int64_t, int32_t> dict(source);
+    const int rounds = 20;
+    const int64_t entries = static_cast<int64_t>(dict.entryCount()) * rounds;
+    cout << "keys:" << dict.size() << " entries:" << dict.entryCount()
+        << " vector_bytes:" << rawBytes << " compressed_bytes:" << dict.memoryBytes()
+        << " bytes_per_entry:" << dict.bytesPerEntry() << endl;
+
+    benchmark("std::vector scan", entries, [&]() {
+        int64_t sum = 0;
+        for (int r = 0; r < rounds; ++r) {
+            for (auto it = source.begin(); it != source.end(); ++it) {
+                for (size_t i = 0; i < it->second.size(); ++i) {
+                    sum += it->second[i];
+                }
+            }
+        }
+        return sum;
+    });
+    benchmark("decode + scan", entries, [&]() {
+        int64_t sum = 0;
+        vector<int32_t> buffer;
+        for (int r = 0; r < rounds; ++r) {
+            for (size_t k = 0; k < dict.size(); ++k) {
+                dict.list(k).decode(buffer);
+                for (size_t i = 0; i < buffer.size(); ++i) {
+                    sum += buffer[i];
+                }
+            }
+        }
+        return sum;
+    });
+    benchmark("iterator scan", entries, [&]() {
+        int64_t sum = 0;
+        for (int r = 0; r < rounds; ++r) {
+            for (size_t k = 0; k < dict.size(); ++k) {
+                PostingListRef<int32_t> list = dict.list(k);
+                for (auto it = list.begin(); it != list.end(); ++it) {
+                    sum += *it;
+                }
+            }
+        }
+        return sum;
+    });
+
+    // 随机查找一个key再遍历它的列表
+    vector<int64_t> keys;
+    int64_t lookupEntries = 0;
+    for (int i = 0; i < 1000000; ++i) {
+        keys.push_back(static_cast<int64_t>(rng() % source.size()));
+        lookupEntries += source[keys.back()].size();
+    }
+    benchmark("std::map find + scan", lookupEntries, [&]() {
+        int64_t sum = 0;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            const vector<int32_t> &list = source.find(keys[i])->second;
+            for (size_t j = 0; j < list.size(); ++j) {
+                sum += list[j];
+            }
+        }
+        return sum;
+    });
+    benchmark("find + decode + scan", lookupEntries, [&]() {
+        int64_t sum = 0;
+        vector<int32_t> buffer;
+        PostingListRef<int32_t> list;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            dict.find(keys[i], list);
+            list.decode(buffer);
+            for (size_t j = 0; j < buffer.size(); ++j) {
+                sum += buffer[j];
+            }
+        }
+        return sum;
+    });
+    return 0;
+}
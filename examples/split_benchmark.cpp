@@ -0,0 +1,103 @@
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "dict.h"
+#include "simd_tokenizer.h"
+using namespace std;
+using namespace StemCell;
+
+// 改用SimdTokenizer之前Dict::split的实现, 作为对比的基线
+static void legacySplit(char delimiter, const string &source, vector<string> &result) {
+    if (source.empty()) {
+        return;
+    }
+    size_t prev_pos = 0, pos = 0;
+    result.resize(0);
+    pos = source.find(delimiter, pos);
+    while (pos != string::npos) {
+        result.push_back(source.substr(prev_pos, pos - prev_pos));
+        prev_pos = ++pos;
+        pos = source.find(delimiter, pos);
+    }
+    result.push_back(source.substr(prev_pos));
+}
+
+template<class F>
+int64_t benchmark(const string &name, int64_t bytes, F f) {
+    auto start = chrono::steady_clock::now();
+    int64_t fields = f();
+    int64_t us = chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now() - start).count();
+    cout << name << "\t" << us / 1000 << " ms\t"
+        << (us > 0 ? bytes / us : 0) << " MB/s\tfields:" << fields << endl;
+    return us;
+}
+
+int main() {
+    // 与线上词典相近的行: key \t 一串逗号分隔的id
+    vector<string> lines;
+    int64_t bytes = 0;
+    for (int i = 0; i < 200000; ++i) {
+        string line = "key_" + to_string(i * 7919);
+        for (int j = 0; j < 4 + i % 6; ++j) {
+            line += "\t" + to_string(i * 31 + j) + ",0.5," + to_string(j);
+        }
+        bytes += line.size();
+        lines.push_back(line);
+    }
+    const int rounds = 10;
+    bytes *= rounds;
+    cout << "isa:" << SimdTokenizer::isa() << " lines:" << lines.size()
+        << " rounds:" << rounds << endl;
+
+    benchmark("find/substr", bytes, [&]() {
+        int64_t fields = 0;
+        vector<string> result;
+        for (int r = 0; r < rounds; ++r) {
+            for (const string &line : lines) {
+                legacySplit('\t', line, result);
+                fields += result.size();
+            }
+        }
+        return fields;
+    });
+    benchmark("Dict::split", bytes, [&]() {
+        int64_t fields = 0;
+        vector<string> result;
+        for (int r = 0; r < rounds; ++r) {
+            for (const string &line : lines) {
+                result.clear();
+                Dict::split('\t', line, result);
+                fields += result.size();
+            }
+        }
+        return fields;
+    });
+    benchmark("Dict::splitView", bytes, [&]() {
+        int64_t fields = 0;
+        vector<string_view> result;
+        for (int r = 0; r < rounds; ++r) {
+            for (const string &line : lines) {
+                Dict::splitView('\t', line, result);
+                fields += result.size();
+            }
+        }
+        return fields;
+    });
+
+    string buffer;
+    for (const string &line : lines) {
+        buffer += line;
+        buffer += '\n';
+    }
+    benchmark("SimdTokenizer::scan", bytes, [&]() {
+        int64_t fields = 0;
+        vector<uint32_t> offsets;
+        for (int r = 0; r < rounds; ++r) {
+            fields += SimdTokenizer::scan(buffer.data(), buffer.size(), '\t', offsets);
+        }
+        return fields;
+    });
+    return 0;
+}
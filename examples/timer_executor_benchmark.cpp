@@ -0,0 +1,91 @@
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "timer_controller.h"
+#include "sharded_timer_controller.h"
+using namespace std;
+using namespace StemCell;
+
+/*
+ * 每50个回调中有一个耗时20ms. 回调在定时器线程上执行时, 慢回调推迟其后所有到期的定时器;
+ * 交给执行器或分片后, 其他定时器的到期延迟不受影响
+ */
+template<class Controller>
+static void submit(Controller &tc, size_t producers, size_t perThread, atomic<size_t> &fired) {
+    vector<thread> threads;
+    for (size_t t = 0; t < producers; ++t) {
+        threads.emplace_back([&tc, &fired, perThread, t]() {
+            for (size_t i = 0; i < perThread; ++i) {
+                bool slow = (t * perThread + i) % 50 == 0;
+                tc.delayProcess(1 + i * 1000 / perThread, [&fired, slow]() {
+                    if (slow) {
+                        usleep(20000);
+                    }
+                    ++fired;
+                });
+            }
+        });
+    }
+    for (size_t t = 0; t < producers; ++t) {
+        threads[t].join();
+    }
+}
+
+static void wait(atomic<size_t> &fired, size_t total) {
+    while (fired.load() < total) {
+        usleep(1000);
+    }
+}
+
+int main() {
+    const size_t producers = 4;
+    const size_t perThread = 1000;
+    const size_t total = producers * perThread;
+    {
+        atomic<size_t> fired(0);
+        TimerController tc;
+        tc.init();
+        submit(tc, producers, perThread, fired);
+        wait(fired, total);
+        cout << "inline\t\t" << tc.latenessStats().report() << endl;
+        tc.stop();
+    }
+    {
+        atomic<size_t> fired(0);
+        ThreadPool pool(8);
+        TimerController tc;
+        tc.setExecutor(&pool);
+        tc.init();
+        submit(tc, producers, perThread, fired);
+        wait(fired, total);
+        cout << "thread_pool\t" << tc.latenessStats().report() << endl;
+        tc.stop();
+    }
+    {
+        atomic<size_t> fired(0);
+        ThreadPool pool(8);
+        ShardedTimerController tc(producers);
+        tc.setExecutor(&pool);
+        tc.init();
+        submit(tc, producers, perThread, fired);
+        wait(fired, total);
+        cout << "sharded\t\t" << tc.latenessStats().report() << endl << tc.report();
+        tc.stop();
+    }
+    {
+        // 分片数取可用CPU数, 每个分片的定时器线程绑在自己的CPU上
+        atomic<size_t> fired(0);
+        ThreadPool pool(8);
+        ShardedTimerController tc(0, TimerController::TIMER_BACKEND_HEAP, 1000,
+                ShardedTimerController::ROUTE_BY_CPU);
+        tc.setExecutor(&pool);
+        tc.init();
+        submit(tc, producers, perThread, fired);
+        wait(fired, total);
+        cout << "sharded_by_cpu\t" << tc.latenessStats().report() << endl << tc.report();
+        tc.stop();
+    }
+    return 0;
+}
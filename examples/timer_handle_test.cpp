@@ -0,0 +1,31 @@
+#include <iostream>
+#include <atomic>
+#include <unistd.h>
+#include "timer_controller.h"
+using namespace std;
+using namespace StemCell;
+
+// TimerHandle的取消与重新调度: 取消的任务不会执行, 重新调度后按新的间隔执行
+int main() {
+    try {
+        TimerController tc;
+        tc.init();
+        atomic<int> fastCount(0);
+        TimerHandle fast = tc.cycleProcess(100, [&fastCount]() { ++fastCount; });
+        TimerHandle timeout = tc.delayProcess(3000, [=]() { cout << "never printed" << endl; });
+        sleep(2);
+        cout << "cycle 0.1 sec fired:" << fastCount.load() << endl;
+        cout << "cancel timeout:" << timeout.cancel() << endl;
+        cout << "reschedule to 2 sec:" << fast.reschedule(2000) << endl;
+        fastCount = 0;
+        sleep(6);
+        // 6秒内按2秒的间隔执行3次左右
+        cout << "cycle 2 sec fired:" << fastCount.load() << endl;
+        cout << "cancelled:" << tc.cancelledCount() << " avoided:" << tc.avoidedFireCount() << endl;
+        tc.stop();
+        cout << "tc stoped!" << endl;
+    } catch (exception& e) {
+        cout << "error:" << e.what();
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <queue>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include "object_pool.hpp"
+#include "spinlock.h"
+#include "timer_controller.h"
+using namespace std;
+using namespace StemCell;
+
+/*
+ * 改造前的提交路径: ObjectPool(Spinlock + make_shared + std::map)分配TimerTask,
+ * Spinlock保护的std::queue入队, 每个任务写一次eventfd; 消费线程加锁逐个出队放进堆里
+ */
+class LockedSubmitPath {
+public:
+    LockedSubmitPath() : _eventfd(eventfd(0, EFD_NONBLOCK)), _stop(false), _wakeups(0) {
+        _consumer = thread([this]() { consume(); });
+    }
+
+    ~LockedSubmitPath() {
+        _stop = true;
+        eventfd_write(_eventfd, 1);
+        _consumer.join();
+        close(_eventfd);
+    }
+
+    void delayProcess(uint32_t delay_time, function<void()> fun) {
+        TimerTask *task = &_pool.createInstance();
+        task->interval_ns = delay_time * 1000000LL;
+        clock_gettime(CLOCK_MONOTONIC, &task->expect_time);
+        task->fun = std::move(fun);
+        {
+            lock_guard<Spinlock> locker(_lock);
+            _queue.push(task);
+        }
+        _wakeups.fetch_add(1, memory_order_relaxed);
+        eventfd_write(_eventfd, 1);
+    }
+
+    uint64_t wakeupCount() const { return _wakeups.load(memory_order_relaxed); }
+
+private:
+    void consume() {
+        struct pollfd fd = { _eventfd, POLLIN, 0 };
+        while (!_stop) {
+            poll(&fd, 1, 100);
+            eventfd_t value;
+            eventfd_read(_eventfd, &value);
+            for (;;) {
+                TimerTask *task;
+                {
+                    lock_guard<Spinlock> locker(_lock);
+                    if (_queue.empty()) {
+                        break;
+                    }
+                    task = _queue.front();
+                    _queue.pop();
+                }
+                _heap.push_back(task);
+                push_heap(_heap.begin(), _heap.end());
+            }
+        }
+    }
+
+    int _eventfd;
+    atomic<bool> _stop;
+    atomic<uint64_t> _wakeups;
+    ObjectPool<TimerTask> _pool;
+    Spinlock _lock;
+    queue<TimerTask*> _queue;
+    vector<TimerTask*> _heap;
+    thread _consumer;
+};
+
+/*
+ * 多个线程同时delayProcess时的提交吞吐. 任务的延迟足够长, 测试期间不会到期,
+ * wakeups为写eventfd唤醒定时器线程的次数, 远小于任务数说明提交是成批消费的
+ */
+template<class Controller>
+static void benchmark(const string &name, size_t producers, size_t total) {
+    Controller tc;
+    size_t perThread = total / producers;
+    vector<thread> threads;
+    auto start = chrono::steady_clock::now();
+    for (size_t t = 0; t < producers; ++t) {
+        threads.emplace_back([&tc, perThread]() {
+            for (size_t i = 0; i < perThread; ++i) {
+                tc.delayProcess(600000, []() {});
+            }
+        });
+    }
+    for (size_t t = 0; t < producers; ++t) {
+        threads[t].join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    size_t submitted = perThread * producers;
+    cout << name << "\tproducers:" << producers << "\ttimers/s:" << static_cast<int64_t>(submitted / seconds)
+        << "\twakeups:" << tc.wakeupCount() << endl;
+}
+
+// init/stop包在构造和析构里, 与LockedSubmitPath用同一个benchmark
+class StartedTimerController : public TimerController {
+public:
+    StartedTimerController() { init(); }
+    ~StartedTimerController() { stop(); }
+};
+
+int main() {
+    for (size_t producers = 1; producers <= 64; producers *= 2) {
+        benchmark<LockedSubmitPath>("locked queue", producers, 1 << 20);
+        benchmark<StartedTimerController>("TimerController", producers, 1 << 20);
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <iostream>
+#include <atomic>
+#include <random>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include "timer_controller.h"
+using namespace std;
+using namespace StemCell;
+
+static int64_t nowNs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * 二叉堆与时间轮的对比: 提交pending个延迟在[1, maxDelayMs]内均匀分布的任务,
+ * 等待全部到期, 统计提交耗时、全部到期的耗时、平均/最大延迟到期时间和进程CPU时间
+ */
+static void benchmark(TimerController::TimerBackend backend, size_t pending, uint32_t maxDelayMs) {
+    TimerController tc(backend);
+    tc.init();
+    mt19937 rng(20121012);
+    vector<uint32_t> delays(pending);
+    for (size_t i = 0; i < pending; ++i) {
+        delays[i] = 1 + rng() % maxDelayMs;
+    }
+    atomic<size_t> fired(0);
+    atomic<int64_t> totalLateNs(0);
+    atomic<int64_t> maxLateNs(0);
+
+    int64_t cpuStart = nowNs(CLOCK_PROCESS_CPUTIME_ID);
+    int64_t start = nowNs(CLOCK_MONOTONIC);
+    for (size_t i = 0; i < pending; ++i) {
+        int64_t deadline = nowNs(CLOCK_MONOTONIC) + delays[i] * 1000000LL;
+        tc.delayProcess(delays[i], [&, deadline]() {
+            int64_t late = nowNs(CLOCK_MONOTONIC) - deadline;
+            totalLateNs += late;
+            int64_t old = maxLateNs.load();
+            while (late > old && !maxLateNs.compare_exchange_weak(old, late)) {}
+            ++fired;
+        });
+    }
+    int64_t submitted = nowNs(CLOCK_MONOTONIC);
+    while (fired.load() < pending) {
+        usleep(1000);
+    }
+    int64_t end = nowNs(CLOCK_MONOTONIC);
+    int64_t cpu = nowNs(CLOCK_PROCESS_CPUTIME_ID) - cpuStart;
+    tc.stop();
+
+    cout << (backend == TimerController::TIMER_BACKEND_HEAP ? "heap " : "wheel")
+        << "\tpending:" << pending
+        << "\tsubmit:" << (submitted - start) / 1000000 << "ms"
+        << "\tall_fired:" << (end - start) / 1000000 << "ms"
+        << "\tavg_late:" << totalLateNs.load() / static_cast<int64_t>(pending) / 1000 << "us"
+        << "\tmax_late:" << maxLateNs.load() / 1000 << "us"
+        << "\tcpu:" << cpu / 1000000 << "ms" << endl;
+}
+
+int main() {
+    const size_t pendings[] = {1000, 100000, 1000000};
+    for (size_t i = 0; i < sizeof(pendings) / sizeof(pendings[0]); ++i) {
+        benchmark(TimerController::TIMER_BACKEND_HEAP, pendings[i], 2000);
+        benchmark(TimerController::TIMER_BACKEND_WHEEL, pendings[i], 2000);
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef ARRAY_REF_H
+#define ARRAY_REF_H
+
+#include <cstddef>
+
+namespace StemCell {
+
+/**
+ * @brief 指向一段连续只读内存的轻量视图, 不持有内存
+ */
+template<class T>
+struct ArrayRef {
+    typedef T value_type;
+    typedef const T* const_iterator;
+
+    ArrayRef() : _data(nullptr), _size(0) {}
+    ArrayRef(const T* data, size_t size) : _data(data), _size(size) {}
+
+    const T* data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    const T* begin() const { return _data; }
+    const T* end() const { return _data + _size; }
+    const T& operator[](size_t i) const { return _data[i]; }
+
+private:
+    const T* _data;
+    size_t _size;
+};
+
+} // end namespace StemCell
+#endif
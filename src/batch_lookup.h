@@ -0,0 +1,67 @@
+/**
+ * @brief 批量查找的公共部分
+ *
+ * 逐个find()时每个key的cache miss是串行的. 批量查找把key分成LOOKUP_BATCH_BLOCK个一组,
+ * 先为整组计算位置并发出prefetch, 再逐个确认, 让多个miss同时在路上.
+ * 有序数组上的二分查找按无分支的方式同步推进: 每个key每轮的比较次数相同,
+ * 一轮内依次处理组内所有key, 并为下一轮的比较位置发出prefetch.
+ */
+#ifndef BATCH_LOOKUP_H
+#define BATCH_LOOKUP_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace StemCell {
+
+#define LOOKUP_BATCH_BLOCK 32
+
+inline void prefetchRead(const void *addr) {
+    __builtin_prefetch(addr, 0, 3);
+}
+
+/**
+ * @brief 在长度为size的有序序列上为keys[0, n)同步做lower_bound
+ * @param lessAt bool(size_t index, const Key &key), 第index个元素是否小于key
+ * @param prefetchAt void(size_t index), 预取第index个元素
+ * @param pos 输出每个key的lower_bound下标
+ */
+template<class Key, class LessAt, class PrefetchAt>
+inline void batchLowerBound(size_t size, const Key *keys, size_t n, size_t *pos,
+        LessAt lessAt, PrefetchAt prefetchAt) {
+    size_t base[LOOKUP_BATCH_BLOCK];
+    for (size_t begin = 0; begin < n; begin += LOOKUP_BATCH_BLOCK) {
+        const size_t count = n - begin < LOOKUP_BATCH_BLOCK ? n - begin : LOOKUP_BATCH_BLOCK;
+        const Key *block = keys + begin;
+        if (size == 0) {
+            for (size_t j = 0; j < count; ++j) {
+                pos[begin + j] = 0;
+            }
+            continue;
+        }
+        size_t len = size;
+        for (size_t j = 0; j < count; ++j) {
+            base[j] = 0;
+        }
+        if (len > 1) {
+            prefetchAt(len / 2 - 1);
+        }
+        while (len > 1) {
+            const size_t half = len / 2;
+            const size_t nextHalf = (len - half) / 2;
+            for (size_t j = 0; j < count; ++j) {
+                base[j] = lessAt(base[j] + half - 1, block[j]) ? base[j] + half : base[j];
+                if (nextHalf > 0) {
+                    prefetchAt(base[j] + nextHalf - 1);
+                }
+            }
+            len -= half;
+        }
+        for (size_t j = 0; j < count; ++j) {
+            pos[begin + j] = base[j] + (lessAt(base[j], block[j]) ? 1 : 0);
+        }
+    }
+}
+
+} // end namespace StemCell
+#endif
@@ -0,0 +1,491 @@
+/**
+ * @brief 预编译的二进制词典格式
+ *
+ * 离线把TSV词典编译成按key排序的二进制镜像, 在线只读映射后直接查找,
+ * 不需要解析. 同一台机器上的多个进程共享同一份page cache.
+ *
+ * 文件布局, 所有section都按BINARY_DICT_ALIGN对齐:
+ *   BinaryDictHeader
+ *   section 0: 有序的key  (int64_t[count], 或字符串key的uint64_t偏移[count + 1])
+ *   section 1: 字符串key的字节 / vector value的uint64_t偏移[count + 1]
+ *   section 2: value数组
+ */
+#ifndef BINARY_DICT_H
+#define BINARY_DICT_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <algorithm>
+#include <type_traits>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include "mmap_file.h"
+#include "array_ref.h"
+#include "batch_lookup.h"
+#include "dict.h"
+
+namespace StemCell {
+
+#define BINARY_DICT_MAGIC "SCBDICT"
+#define BINARY_DICT_VERSION 1
+#define BINARY_DICT_ALIGN 64
+#define BINARY_DICT_SECTIONS 3
+
+enum BinaryDictShape {
+    BINARY_DICT_INT_MAP = 1,        // int64_t -> V
+    BINARY_DICT_STRING_MAP = 2,     // string -> V
+    BINARY_DICT_INT_VEC_MAP = 3,    // int64_t -> V[]
+};
+
+struct BinaryDictHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t shape;
+    uint32_t valueSize;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t fileSize;
+    uint64_t sectionOffset[BINARY_DICT_SECTIONS];
+    uint64_t sectionSize[BINARY_DICT_SECTIONS];
+};
+
+/**
+ * @brief 二进制词典的写入, 先写临时文件再rename, 避免在线进程读到写了一半的文件
+ */
+class BinaryDictWriter {
+public:
+    template<class V>
+    static bool writeIntMap(const std::string &fileName, const std::map<int64_t, V> &dict) {
+        static_assert(std::is_trivially_copyable<V>::value, "value must be trivially copyable");
+        std::vector<int64_t> keys;
+        std::vector<V> values;
+        keys.reserve(dict.size());
+        values.reserve(dict.size());
+        for (auto it = dict.begin(); it != dict.end(); ++it) {
+            keys.push_back(it->first);
+            values.push_back(it->second);
+        }
+        std::string sections[BINARY_DICT_SECTIONS];
+        appendArray(sections[0], keys);
+        appendArray(sections[2], values);
+        return write(fileName, BINARY_DICT_INT_MAP, sizeof(V), dict.size(), sections);
+    }
+
+    template<class V>
+    static bool writeStringMap(const std::string &fileName, const std::map<std::string, V> &dict) {
+        static_assert(std::is_trivially_copyable<V>::value, "value must be trivially copyable");
+        std::vector<uint64_t> offsets;
+        std::vector<V> values;
+        std::string sections[BINARY_DICT_SECTIONS];
+        offsets.reserve(dict.size() + 1);
+        values.reserve(dict.size());
+        offsets.push_back(0);
+        for (auto it = dict.begin(); it != dict.end(); ++it) {
+            sections[1].append(it->first);
+            offsets.push_back(sections[1].size());
+            values.push_back(it->second);
+        }
+        appendArray(sections[0], offsets);
+        appendArray(sections[2], values);
+        return write(fileName, BINARY_DICT_STRING_MAP, sizeof(V), dict.size(), sections);
+    }
+
+    template<class V>
+    static bool writeIntVecMap(const std::string &fileName,
+            const std::map<int64_t, std::vector<V> > &dict) {
+        static_assert(std::is_trivially_copyable<V>::value, "value must be trivially copyable");
+        std::vector<int64_t> keys;
+        std::vector<uint64_t> offsets;
+        std::string sections[BINARY_DICT_SECTIONS];
+        keys.reserve(dict.size());
+        offsets.reserve(dict.size() + 1);
+        offsets.push_back(0);
+        for (auto it = dict.begin(); it != dict.end(); ++it) {
+            keys.push_back(it->first);
+            appendArray(sections[2], it->second);
+            offsets.push_back(sections[2].size() / sizeof(V));
+        }
+        appendArray(sections[0], keys);
+        appendArray(sections[1], offsets);
+        return write(fileName, BINARY_DICT_INT_VEC_MAP, sizeof(V), dict.size(), sections);
+    }
+
+private:
+    template<class T>
+    static void appendArray(std::string &section, const std::vector<T> &array) {
+        if (!array.empty()) {
+            section.append(reinterpret_cast<const char*>(array.data()), array.size() * sizeof(T));
+        }
+    }
+
+    static uint64_t alignUp(uint64_t offset) {
+        return (offset + BINARY_DICT_ALIGN - 1) / BINARY_DICT_ALIGN * BINARY_DICT_ALIGN;
+    }
+
+    static bool write(const std::string &fileName, BinaryDictShape shape, uint32_t valueSize,
+            uint64_t count, const std::string sections[BINARY_DICT_SECTIONS]) {
+        BinaryDictHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, BINARY_DICT_MAGIC, sizeof(header.magic));
+        header.version = BINARY_DICT_VERSION;
+        header.shape = shape;
+        header.valueSize = valueSize;
+        header.count = count;
+        uint64_t offset = alignUp(sizeof(header));
+        for (int i = 0; i < BINARY_DICT_SECTIONS; ++i) {
+            header.sectionOffset[i] = offset;
+            header.sectionSize[i] = sections[i].size();
+            offset = alignUp(offset + sections[i].size());
+        }
+        header.fileSize = offset;
+
+        std::string tmpName = fileName + ".tmp";
+        std::ofstream fout(tmpName.c_str(), std::ios::binary | std::ios::trunc);
+        if (!fout.is_open()) {
+            return false;
+        }
+        static const char padding[BINARY_DICT_ALIGN] = {0};
+        fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        uint64_t written = sizeof(header);
+        for (int i = 0; i < BINARY_DICT_SECTIONS; ++i) {
+            fout.write(padding, header.sectionOffset[i] - written);
+            fout.write(sections[i].data(), sections[i].size());
+            written = header.sectionOffset[i] + sections[i].size();
+        }
+        fout.write(padding, header.fileSize - written);
+        fout.close();
+        if (!fout) {
+            remove(tmpName.c_str());
+            return false;
+        }
+        return rename(tmpName.c_str(), fileName.c_str()) == 0;
+    }
+};
+
+/**
+ * @brief 离线把TSV词典编译成二进制镜像, 重复key的处理与Dict::build*Dict一致
+ */
+class BinaryDictCompiler {
+public:
+    // SIMapDict: string \t int32
+    static bool compileSIMapDict(const std::string &tsvFile, const std::string &binFile) {
+        return compile(Dict::buildMapDict<std::string, int32_t>(tsvFile), binFile,
+                &BinaryDictWriter::writeStringMap<int32_t>);
+    }
+
+    // LIHashMapDict: int64 \t int32
+    static bool compileLIMapDict(const std::string &tsvFile, const std::string &binFile) {
+        return compile(Dict::buildMapDict<int64_t, int32_t>(tsvFile), binFile,
+                &BinaryDictWriter::writeIntMap<int32_t>);
+    }
+
+    // LIVecMapDict: int64 \t int32,int32,...
+    static bool compileLIVecMapDict(const std::string &tsvFile, const std::string &binFile) {
+        return compile(Dict::buildVectorValueTypeMapDict<int64_t, int32_t>(tsvFile), binFile,
+                &BinaryDictWriter::writeIntVecMap<int32_t>);
+    }
+
+private:
+    template<class DictType>
+    static bool compile(DictType *dict, const std::string &binFile,
+            bool (*writeFunc)(const std::string&, const DictType&)) {
+        if (dict == nullptr) {
+            return false;
+        }
+        bool ret = writeFunc(binFile, *dict);
+        delete dict;
+        return ret;
+    }
+};
+
+/**
+ * @brief 只读映射的二进制词典镜像, 负责格式校验
+ */
+class BinaryDictImage {
+public:
+    BinaryDictImage() : _header(nullptr) {}
+
+    bool open(const std::string &fileName, BinaryDictShape shape, uint32_t valueSize) {
+        _header = nullptr;
+        if (!_file.open(fileName)) {
+            return false;
+        }
+        if (_file.size() < sizeof(BinaryDictHeader)) {
+            return false;
+        }
+        const BinaryDictHeader *header = reinterpret_cast<const BinaryDictHeader*>(_file.data());
+        if (memcmp(header->magic, BINARY_DICT_MAGIC, sizeof(header->magic)) != 0
+                || header->version != BINARY_DICT_VERSION
+                || header->shape != static_cast<uint32_t>(shape)
+                || header->valueSize != valueSize
+                || header->fileSize != _file.size()) {
+            return false;
+        }
+        for (int i = 0; i < BINARY_DICT_SECTIONS; ++i) {
+            if (header->sectionOffset[i] % BINARY_DICT_ALIGN != 0
+                    || header->sectionOffset[i] > header->fileSize
+                    || header->sectionSize[i] > header->fileSize - header->sectionOffset[i]) {
+                return false;
+            }
+        }
+        _header = header;
+        return true;
+    }
+
+    template<class T>
+    ArrayRef<T> section(int index) const {
+        return ArrayRef<T>(reinterpret_cast<const T*>(_file.data() + _header->sectionOffset[index]),
+                _header->sectionSize[index] / sizeof(T));
+    }
+
+    uint64_t count() const { return _header->count; }
+    size_t memoryBytes() const { return _file.size(); }
+
+    /**
+     * @brief 校验偏移数组: count + 1个元素, 从0开始单调不减, 最后一个不超过limit
+     * 加载时全部检查一遍, 之后key(i)/value(i)不会越界
+     */
+    bool validOffsets(ArrayRef<uint64_t> offsets, uint64_t limit) const {
+        if (offsets.size() != count() + 1 || offsets[0] != 0 || offsets[count()] > limit) {
+            return false;
+        }
+        for (uint64_t i = 0; i < count(); ++i) {
+            if (offsets[i] > offsets[i + 1]) {
+                return false;
+            }
+        }
+        return true;
+    }
+    size_t prefault() const { return _file.prefault(); }
+    MmapFile &file() { return _file; }
+
+private:
+    MmapFile _file;
+    const BinaryDictHeader *_header;
+};
+
+/**
+ * @brief int64_t -> V 的二进制词典, 对应LIHashMapDict
+ * 构造失败时抛出int, 可以直接作为HotSwitchDict的DictType使用
+ */
+template<class V>
+class BinaryIntMapDict {
+public:
+    explicit BinaryIntMapDict(const char *fileName) {
+        if (!_image.open(fileName, BINARY_DICT_INT_MAP, sizeof(V))) {
+            throw -1;
+        }
+        _keys = _image.section<int64_t>(0);
+        _values = _image.section<V>(2);
+        if (_keys.size() != _image.count() || _values.size() != _image.count()) {
+            throw -1;
+        }
+    }
+
+    static BinaryIntMapDict *load(const std::string &fileName) {
+        try {
+            return new BinaryIntMapDict(fileName.c_str());
+        } catch (int e) {
+            return nullptr;
+        }
+    }
+
+    // 不存在时返回nullptr
+    const V *find(int64_t key) const {
+        const int64_t *it = std::lower_bound(_keys.begin(), _keys.end(), key);
+        if (it == _keys.end() || *it != key) {
+            return nullptr;
+        }
+        return &_values[it - _keys.begin()];
+    }
+
+    size_t count(int64_t key) const { return find(key) != nullptr ? 1 : 0; }
+
+    // 批量查找, 不存在时out[i]为nullptr
+    void lookupBatch(const int64_t *keys, size_t n, const V **out) const {
+        const int64_t *sorted = _keys.data();
+        size_t pos[LOOKUP_BATCH_BLOCK];
+        for (size_t begin = 0; begin < n; begin += LOOKUP_BATCH_BLOCK) {
+            size_t count = std::min<size_t>(LOOKUP_BATCH_BLOCK, n - begin);
+            batchLowerBound(_keys.size(), keys + begin, count, pos,
+                    [sorted](size_t i, int64_t key) { return sorted[i] < key; },
+                    [sorted](size_t i) { prefetchRead(sorted + i); });
+            for (size_t j = 0; j < count; ++j) {
+                out[begin + j] = pos[j] < _keys.size() && sorted[pos[j]] == keys[begin + j]
+                    ? &_values[pos[j]] : nullptr;
+            }
+        }
+    }
+
+    size_t size() const { return _keys.size(); }
+    int64_t key(size_t i) const { return _keys[i]; }
+    const V &value(size_t i) const { return _values[i]; }
+    size_t memoryBytes() const { return _image.memoryBytes(); }
+    // 切换前预热, 见dict_warm_up.h
+    size_t prefault() const { return _image.prefault(); }
+
+private:
+    BinaryDictImage _image;
+    ArrayRef<int64_t> _keys;
+    ArrayRef<V> _values;
+};
+
+/**
+ * @brief string -> V 的二进制词典, 对应SIMapDict
+ */
+template<class V>
+class BinaryStringMapDict {
+public:
+    explicit BinaryStringMapDict(const char *fileName) {
+        if (!_image.open(fileName, BINARY_DICT_STRING_MAP, sizeof(V))) {
+            throw -1;
+        }
+        _offsets = _image.section<uint64_t>(0);
+        _bytes = _image.section<char>(1);
+        _values = _image.section<V>(2);
+        if (_values.size() != _image.count() || !_image.validOffsets(_offsets, _bytes.size())) {
+            throw -1;
+        }
+    }
+
+    static BinaryStringMapDict *load(const std::string &fileName) {
+        try {
+            return new BinaryStringMapDict(fileName.c_str());
+        } catch (int e) {
+            return nullptr;
+        }
+    }
+
+    const V *find(std::string_view key) const {
+        size_t low = 0;
+        size_t high = size();
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (this->key(mid) < key) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        if (low == size() || this->key(low) != key) {
+            return nullptr;
+        }
+        return &_values[low];
+    }
+
+    size_t count(std::string_view key) const { return find(key) != nullptr ? 1 : 0; }
+
+    // 批量查找, 不存在时out[i]为nullptr
+    template<class KeyType>
+    void lookupBatch(const KeyType *keys, size_t n, const V **out) const {
+        const uint64_t *offsets = _offsets.data();
+        size_t pos[LOOKUP_BATCH_BLOCK];
+        for (size_t begin = 0; begin < n; begin += LOOKUP_BATCH_BLOCK) {
+            size_t count = std::min<size_t>(LOOKUP_BATCH_BLOCK, n - begin);
+            batchLowerBound(size(), keys + begin, count, pos,
+                    [this](size_t i, const KeyType &key) { return this->key(i) < std::string_view(key); },
+                    [offsets](size_t i) { prefetchRead(offsets + i); });
+            for (size_t j = 0; j < count; ++j) {
+                out[begin + j] = pos[j] < size() && key(pos[j]) == std::string_view(keys[begin + j])
+                    ? &_values[pos[j]] : nullptr;
+            }
+        }
+    }
+
+    size_t size() const { return _values.size(); }
+    std::string_view key(size_t i) const {
+        return std::string_view(_bytes.data() + _offsets[i], _offsets[i + 1] - _offsets[i]);
+    }
+    const V &value(size_t i) const { return _values[i]; }
+    size_t memoryBytes() const { return _image.memoryBytes(); }
+    // 切换前预热, 见dict_warm_up.h
+    size_t prefault() const { return _image.prefault(); }
+
+private:
+    BinaryDictImage _image;
+    ArrayRef<uint64_t> _offsets;
+    ArrayRef<char> _bytes;
+    ArrayRef<V> _values;
+};
+
+/**
+ * @brief int64_t -> V[] 的二进制词典, 对应LIVecMapDict
+ */
+template<class V>
+class BinaryIntVecMapDict {
+public:
+    explicit BinaryIntVecMapDict(const char *fileName) {
+        if (!_image.open(fileName, BINARY_DICT_INT_VEC_MAP, sizeof(V))) {
+            throw -1;
+        }
+        _keys = _image.section<int64_t>(0);
+        _offsets = _image.section<uint64_t>(1);
+        _values = _image.section<V>(2);
+        if (_keys.size() != _image.count() || !_image.validOffsets(_offsets, _values.size())) {
+            throw -1;
+        }
+    }
+
+    static BinaryIntVecMapDict *load(const std::string &fileName) {
+        try {
+            return new BinaryIntVecMapDict(fileName.c_str());
+        } catch (int e) {
+            return nullptr;
+        }
+    }
+
+    // 不存在时返回false
+    bool find(int64_t key, ArrayRef<V> &values) const {
+        const int64_t *it = std::lower_bound(_keys.begin(), _keys.end(), key);
+        if (it == _keys.end() || *it != key) {
+            return false;
+        }
+        values = value(it - _keys.begin());
+        return true;
+    }
+
+    size_t count(int64_t key) const {
+        return std::binary_search(_keys.begin(), _keys.end(), key) ? 1 : 0;
+    }
+
+    // 批量查找, 不存在时found[i]为false
+    void lookupBatch(const int64_t *keys, size_t n, ArrayRef<V> *out, bool *found) const {
+        const int64_t *sorted = _keys.data();
+        size_t pos[LOOKUP_BATCH_BLOCK];
+        for (size_t begin = 0; begin < n; begin += LOOKUP_BATCH_BLOCK) {
+            size_t count = std::min<size_t>(LOOKUP_BATCH_BLOCK, n - begin);
+            batchLowerBound(_keys.size(), keys + begin, count, pos,
+                    [sorted](size_t i, int64_t key) { return sorted[i] < key; },
+                    [sorted](size_t i) { prefetchRead(sorted + i); });
+            for (size_t j = 0; j < count; ++j) {
+                found[begin + j] = pos[j] < _keys.size() && sorted[pos[j]] == keys[begin + j];
+                out[begin + j] = found[begin + j] ? value(pos[j]) : ArrayRef<V>();
+            }
+        }
+    }
+    size_t size() const { return _keys.size(); }
+    int64_t key(size_t i) const { return _keys[i]; }
+    ArrayRef<V> value(size_t i) const {
+        return ArrayRef<V>(_values.data() + _offsets[i], _offsets[i + 1] - _offsets[i]);
+    }
+    size_t memoryBytes() const { return _image.memoryBytes(); }
+    // 切换前预热, 见dict_warm_up.h
+    size_t prefault() const { return _image.prefault(); }
+
+private:
+    BinaryDictImage _image;
+    ArrayRef<int64_t> _keys;
+    ArrayRef<uint64_t> _offsets;
+    ArrayRef<V> _values;
+};
+
+typedef BinaryStringMapDict<int32_t> BinarySIMapDict;
+typedef BinaryIntMapDict<int32_t> BinaryLIMapDict;
+typedef BinaryIntVecMapDict<int32_t> BinaryLIVecMapDict;
+
+} // end namespace StemCell
+#endif
@@ -0,0 +1,241 @@
+/**
+ * @brief 挡在词典前面的Bloom filter, 用来快速排除不存在的key
+ *
+ * 黑名单一类的词典绝大部分查询都不命中, 但每次不命中仍然要走完整的树或hash查找.
+ * BlockedBloomFilter按cache line分块: 每个key只落在一个64字节的block里,
+ * block内置k个bit, 所以一次查询最多一个cache miss.
+ * 分块会让误判率比标准Bloom filter略高, 构建时按分块模型估算误判率,
+ * 逐步增加每个key的bit数直到估算值不超过目标值.
+ * FilteredDict在加载完成后用词典的所有key构建filter, find/count先查filter.
+ */
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <functional>
+#include <utility>
+#include <cmath>
+#include <cstdint>
+#include "mmap_file.h"
+#include "dict_warm_up.h"
+
+namespace StemCell {
+
+#define BLOOM_FILTER_DEFAULT_FPP 0.01
+#define BLOOM_FILTER_BLOCK_BITS 512
+#define BLOOM_FILTER_MAX_HASHES 16
+#define BLOOM_FILTER_MAX_BITS_PER_KEY 64.0
+
+class BlockedBloomFilter {
+public:
+    BlockedBloomFilter() : _hashes(0), _keys(0), _bitsPerKey(0), _targetFpp(0), _expectedFpp(0) {}
+
+    /**
+     * @brief 按key个数和目标误判率分配空间, 之前添加的key全部清空
+     * @param fpp 目标误判率, 限制在[1e-6, 0.5]
+     */
+    void init(size_t keyCount, double fpp = BLOOM_FILTER_DEFAULT_FPP) {
+        fpp = std::min(std::max(fpp, 1e-6), 0.5);
+        _keys = keyCount;
+        _targetFpp = fpp;
+        // start from the classic bloom filter size, then grow until the blocked estimate fits
+        double bitsPerKey = -std::log(fpp) / (M_LN2 * M_LN2);
+        while (true) {
+            _hashes = bestHashes(bitsPerKey, &_expectedFpp);
+            if (_expectedFpp <= fpp || bitsPerKey >= BLOOM_FILTER_MAX_BITS_PER_KEY) {
+                break;
+            }
+            bitsPerKey = std::min(bitsPerKey * 1.05, BLOOM_FILTER_MAX_BITS_PER_KEY);
+        }
+        size_t blocks = static_cast<size_t>(std::ceil(keyCount * bitsPerKey / BLOOM_FILTER_BLOCK_BITS));
+        _blocks.assign(std::max<size_t>(blocks, 1), Block());
+        _blocks.shrink_to_fit();
+        _bitsPerKey = keyCount == 0 ? 0 : static_cast<double>(memoryBytes()) * 8 / keyCount;
+        _expectedFpp = keyCount == 0 ? 0 : estimateFpp(_bitsPerKey, _hashes);
+    }
+
+    template<class K>
+    void add(const K &key) { addHash(hashOf(key)); }
+
+    // false表示一定不存在, true表示可能存在; 没有init过时总是返回true
+    template<class K>
+    bool mayContain(const K &key) const { return mayContainHash(hashOf(key)); }
+
+    void addHash(uint64_t hash) {
+        Block &block = _blocks[blockOf(hash)];
+        uint64_t state = hash;
+        for (int i = 0; i < _hashes; ++i) {
+            uint32_t bit = nextBit(state);
+            block.words[bit / 64] |= 1ULL << (bit % 64);
+        }
+    }
+
+    bool mayContainHash(uint64_t hash) const {
+        if (_blocks.empty()) {
+            return true;
+        }
+        const Block &block = _blocks[blockOf(hash)];
+        uint64_t state = hash;
+        for (int i = 0; i < _hashes; ++i) {
+            uint32_t bit = nextBit(state);
+            if ((block.words[bit / 64] & (1ULL << (bit % 64))) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // std::hash of integers is the identity, mix it so both the block and the bits get entropy
+    template<class K>
+    static uint64_t hashOf(const K &key) {
+        uint64_t h = static_cast<uint64_t>(std::hash<K>()(key));
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    /**
+     * @brief 分块Bloom filter的误判率估算
+     * 每个block里的key个数近似服从均值为BLOCK_BITS/bitsPerKey的泊松分布,
+     * 对每种个数按标准Bloom filter的公式计算后加权求和
+     */
+    static double estimateFpp(double bitsPerKey, int hashes) {
+        if (bitsPerKey <= 0) {
+            return 1.0;
+        }
+        const double lambda = BLOOM_FILTER_BLOCK_BITS / bitsPerKey;
+        const size_t maxKeys = static_cast<size_t>(lambda + 10 * std::sqrt(lambda) + 20);
+        double fpp = 0;
+        for (size_t n = 0; n <= maxKeys; ++n) {
+            double logP = -lambda + n * std::log(lambda) - std::lgamma(n + 1.0);
+            double unset = std::pow(1.0 - 1.0 / BLOOM_FILTER_BLOCK_BITS, static_cast<double>(hashes) * n);
+            fpp += std::exp(logP) * std::pow(1.0 - unset, hashes);
+        }
+        return fpp;
+    }
+
+    size_t size() const { return _keys; }
+    size_t blockCount() const { return _blocks.size(); }
+    int hashCount() const { return _hashes; }
+    double bitsPerKey() const { return _bitsPerKey; }
+    double targetFpp() const { return _targetFpp; }
+    double expectedFpp() const { return _expectedFpp; }
+    size_t memoryBytes() const { return _blocks.capacity() * sizeof(Block); }
+
+    // 切换前预热, 返回触碰的页数
+    size_t prefault() const {
+        return prefaultMemory(_blocks.data(), _blocks.size() * sizeof(Block));
+    }
+
+    std::string report() const {
+        std::ostringstream out;
+        out << "keys:" << _keys << " blocks:" << _blocks.size() << " bytes:" << memoryBytes()
+            << " bits_per_key:" << _bitsPerKey << " hashes:" << _hashes
+            << " target_fpp:" << _targetFpp << " expected_fpp:" << _expectedFpp;
+        return out.str();
+    }
+
+private:
+    struct alignas(64) Block {
+        Block() : words() {}
+        uint64_t words[BLOOM_FILTER_BLOCK_BITS / 64];
+    };
+
+    // the high 32 bits pick the block
+    size_t blockOf(uint64_t hash) const {
+        return static_cast<size_t>(((hash >> 32) * _blocks.size()) >> 32);
+    }
+
+    /*
+     * 块内的bit位置取64位LCG的最高9位. a + i * b式的double hashing在512个bit里
+     * 只有2^17种组合, 同一block里的key组合相同的概率在低误判率时不可忽略
+     */
+    static uint32_t nextBit(uint64_t &state) {
+        state = state * 0x5851f42d4c957f2dULL + 0x14057b7ef767814fULL;
+        return static_cast<uint32_t>(state >> 55);
+    }
+
+    static int bestHashes(double bitsPerKey, double *fpp) {
+        int best = 1;
+        *fpp = estimateFpp(bitsPerKey, 1);
+        for (int k = 2; k <= BLOOM_FILTER_MAX_HASHES; ++k) {
+            double estimate = estimateFpp(bitsPerKey, k);
+            if (estimate < *fpp) {
+                best = k;
+                *fpp = estimate;
+            }
+        }
+        return best;
+    }
+
+    std::vector<Block> _blocks;
+    int _hashes;
+    size_t _keys;
+    double _bitsPerKey;
+    double _targetFpp;
+    double _expectedFpp;
+};
+
+/**
+ * @brief 带Bloom filter的只读词典, filter在构造时用词典的所有key一次性构建
+ *
+ * DictType为set或map类的容器(std::set, std::unordered_map, SortedVectorMap等),
+ * 需要key_type/find/count/end. 私有继承DictType, 只公开只读接口,
+ * insert/operator[]/erase等修改接口不可用, 否则新增的key会被filter误拒.
+ */
+template<class DictType>
+class FilteredDict : private DictType {
+public:
+    typedef typename DictType::key_type key_type;
+    typedef typename DictType::value_type value_type;
+    typedef typename DictType::const_iterator const_iterator;
+
+    explicit FilteredDict(DictType &&dict, double fpp = BLOOM_FILTER_DEFAULT_FPP)
+        : DictType(std::move(dict)) {
+        _filter.init(size(), fpp);
+        for (const_iterator it = begin(); it != end(); ++it) {
+            _filter.add(keyOf(*it));
+        }
+    }
+
+    const_iterator find(const key_type &key) const {
+        return _filter.mayContain(key) ? DictType::find(key) : end();
+    }
+
+    size_t count(const key_type &key) const {
+        return _filter.mayContain(key) ? DictType::count(key) : 0;
+    }
+
+    size_t size() const { return DictType::size(); }
+    bool empty() const { return DictType::empty(); }
+    const_iterator begin() const { return DictType::begin(); }
+    const_iterator end() const { return DictType::end(); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+    // 不经过filter的底层词典, 只读
+    const DictType &dict() const { return *this; }
+
+    const BlockedBloomFilter &filter() const { return _filter; }
+    size_t filterBytes() const { return _filter.memoryBytes(); }
+
+    // 先预热filter再预热词典本身, 返回值的含义同prefaultDict
+    size_t prefault() const {
+        return _filter.prefault() + prefaultDict(static_cast<const DictType&>(*this));
+    }
+
+private:
+    static const key_type &keyOf(const key_type &key) { return key; }
+
+    template<class Entry>
+    static const key_type &keyOf(const Entry &entry) { return entry.first; }
+
+    BlockedBloomFilter _filter;
+};
+
+} // end namespace StemCell
+#endif
@@ -0,0 +1,167 @@
+#ifndef CSR_DICT_HPP
+#define CSR_DICT_HPP
+
+#include <vector>
+#include <map>
+#include <tuple>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include "array_ref.h"
+#include "mmap_file.h"
+
+namespace StemCell {
+
+/**
+ * @brief 二维关联词典的CSR(compressed sparse row)存储, 对应std::map<K1, std::map<K2, V> >
+ *
+ * 外层key有序存放在一个数组里, 每个外层key对应的一行在innerKeys/values中连续存放,
+ * 行内按K2有序. 遍历一行就是顺序扫描两段连续内存, 没有每个元素一个树节点的开销.
+ */
+template<class K1, class K2, class V, class Compare1 = std::less<K1>, class Compare2 = std::less<K2> >
+class CsrMapDict {
+public:
+    typedef K1 key_type;
+    typedef std::tuple<K1, K2, V> entry_type;
+
+    // 一行的视图, 只在所属的CsrMapDict存活期间有效
+    class Row {
+    public:
+        Row() {}
+        Row(ArrayRef<K2> keys, ArrayRef<V> values) : _keys(keys), _values(values) {}
+
+        size_t size() const { return _keys.size(); }
+        bool empty() const { return _keys.empty(); }
+        const K2 &key(size_t i) const { return _keys[i]; }
+        const V &value(size_t i) const { return _values[i]; }
+        ArrayRef<K2> keys() const { return _keys; }
+        ArrayRef<V> values() const { return _values; }
+
+        // 行内二分查找, 不存在时返回nullptr
+        const V *find(const K2 &key) const {
+            Compare2 comp;
+            const K2 *it = std::lower_bound(_keys.begin(), _keys.end(), key, comp);
+            if (it == _keys.end() || comp(key, *it)) {
+                return nullptr;
+            }
+            return &_values[it - _keys.begin()];
+        }
+
+    private:
+        ArrayRef<K2> _keys;
+        ArrayRef<V> _values;
+    };
+
+    CsrMapDict() { _offsets.push_back(0); }
+
+    // 从任意顺序的(k1, k2, v)构建, 重复的(k1, k2)以后出现的为准
+    explicit CsrMapDict(std::vector<entry_type> &&entries) {
+        Compare1 comp1;
+        Compare2 comp2;
+        std::stable_sort(entries.begin(), entries.end(),
+                [&comp1, &comp2](const entry_type &a, const entry_type &b) {
+                    if (comp1(std::get<0>(a), std::get<0>(b))) return true;
+                    if (comp1(std::get<0>(b), std::get<0>(a))) return false;
+                    return comp2(std::get<1>(a), std::get<1>(b));
+                });
+        _offsets.push_back(0);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            entry_type &entry = entries[i];
+            if (i + 1 < entries.size()) {
+                const entry_type &next = entries[i + 1];
+                if (!comp1(std::get<0>(entry), std::get<0>(next))
+                        && !comp2(std::get<1>(entry), std::get<1>(next))) {
+                    continue;
+                }
+            }
+            if (_keys.empty() || comp1(_keys.back(), std::get<0>(entry))) {
+                _keys.push_back(std::move(std::get<0>(entry)));
+                _offsets.push_back(_offsets.back());
+            }
+            _innerKeys.push_back(std::move(std::get<1>(entry)));
+            _values.push_back(std::move(std::get<2>(entry)));
+            ++_offsets.back();
+        }
+        entries.clear();
+        entries.shrink_to_fit();
+        shrink();
+    }
+
+    explicit CsrMapDict(const std::map<K1, std::map<K2, V, Compare2>, Compare1> &nested) {
+        _offsets.reserve(nested.size() + 1);
+        _offsets.push_back(0);
+        _keys.reserve(nested.size());
+        for (auto it = nested.begin(); it != nested.end(); ++it) {
+            _keys.push_back(it->first);
+            for (auto inner = it->second.begin(); inner != it->second.end(); ++inner) {
+                _innerKeys.push_back(inner->first);
+                _values.push_back(inner->second);
+            }
+            _offsets.push_back(_innerKeys.size());
+        }
+        shrink();
+    }
+
+    // 不存在时返回false
+    bool find(const K1 &key, Row &row) const {
+        Compare1 comp;
+        auto it = std::lower_bound(_keys.begin(), _keys.end(), key, comp);
+        if (it == _keys.end() || comp(key, *it)) {
+            return false;
+        }
+        row = this->row(it - _keys.begin());
+        return true;
+    }
+
+    // 不存在时返回nullptr
+    const V *find(const K1 &key1, const K2 &key2) const {
+        Row row;
+        return find(key1, row) ? row.find(key2) : nullptr;
+    }
+
+    size_t count(const K1 &key) const {
+        return std::binary_search(_keys.begin(), _keys.end(), key, Compare1()) ? 1 : 0;
+    }
+
+    size_t size() const { return _keys.size(); }
+    bool empty() const { return _keys.empty(); }
+    size_t entryCount() const { return _values.size(); }
+    const K1 &key(size_t i) const { return _keys[i]; }
+    Row row(size_t i) const {
+        size_t begin = _offsets[i];
+        size_t size = _offsets[i + 1] - begin;
+        return Row(ArrayRef<K2>(_innerKeys.data() + begin, size),
+                ArrayRef<V>(_values.data() + begin, size));
+    }
+
+    // 容器自身占用的字节数, 不含key/value内部再分配的内存
+    size_t memoryBytes() const {
+        return _keys.capacity() * sizeof(K1) + _offsets.capacity() * sizeof(uint64_t)
+            + _innerKeys.capacity() * sizeof(K2) + _values.capacity() * sizeof(V);
+    }
+
+    // 切换前预热, 返回触碰的页数
+    size_t prefault() const {
+        return prefaultMemory(_keys.data(), _keys.size() * sizeof(K1))
+            + prefaultMemory(_offsets.data(), _offsets.size() * sizeof(uint64_t))
+            + prefaultMemory(_innerKeys.data(), _innerKeys.size() * sizeof(K2))
+            + prefaultMemory(_values.data(), _values.size() * sizeof(V));
+    }
+
+private:
+    void shrink() {
+        _keys.shrink_to_fit();
+        _offsets.shrink_to_fit();
+        _innerKeys.shrink_to_fit();
+        _values.shrink_to_fit();
+    }
+
+    std::vector<K1> _keys;
+    std::vector<uint64_t> _offsets;     // _keys.size() + 1
+    std::vector<K2> _innerKeys;
+    std::vector<V> _values;
+};
+
+} // end namespace StemCell
+#endif
@@ -0,0 +1,134 @@
+/**
+ * @brief 支持增量更新的只读词典
+ *
+ * 全量数据(base)只加载一次, 之后每个版本共享同一个base, 只在一个小的overlay里
+ * 记录相对base的更新与删除. 应用一个补丁时拷贝当前的overlay再合入补丁,
+ * 得到新版本, 通过HotSwitchDict原有的切换机制发布. overlay超过base的
+ * maxOverlayRatio时拒绝增量, HotSwitchDict退回全量加载.
+ *
+ * 补丁文件每行一条:
+ *   +\tkey\tvalue    插入或更新
+ *   -\tkey           删除
+ */
+#ifndef DELTA_DICT_HPP
+#define DELTA_DICT_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include "dict.h"
+#include "dict_warm_up.h"
+
+namespace StemCell {
+
+#define DELTA_DICT_MAX_OVERLAY_RATIO 0.1
+
+template<class BaseType>
+class DeltaDict {
+public:
+    typedef typename BaseType::key_type key_type;
+    typedef typename BaseType::mapped_type mapped_type;
+    typedef BaseType *(*BuildBaseFunc)(const std::string &fileName);
+
+    // 接管base的所有权
+    explicit DeltaDict(BaseType *base)
+        : _base(base), _overlay(std::make_shared<Overlay>()), _size(base->size()) {}
+
+    /**
+     * @brief 全量加载, 可以作为HotSwitchDict的NewDictFunc:
+     * &DeltaDict<std::map<K, V> >::build<&Dict::buildMapDict<K, V> >
+     */
+    template<BuildBaseFunc buildBase>
+    static DeltaDict *build(const std::string &fileName) {
+        BaseType *base = buildBase(fileName);
+        return base == nullptr ? nullptr : new DeltaDict(base);
+    }
+
+    /**
+     * @brief 在cur的基础上应用补丁, 生成新版本, 可以作为HotSwitchDict的ApplyDeltaFunc
+     * @return 补丁读取失败或overlay过大时返回nullptr, 调用方应退回全量加载
+     */
+    static DeltaDict *applyPatch(const DeltaDict &cur, const std::string &patchFile) {
+        std::shared_ptr<Overlay> overlay = std::make_shared<Overlay>(*cur._overlay);
+        int64_t size = cur._size;
+        std::vector<std::string_view> fields;
+        bool opened = Dict::forEachLine(patchFile, [&](std::string_view line) {
+            Dict::splitView(MAP_DICT_SEP, line, fields);
+            if (fields.size() < 2 || fields[0].size() != 1) {
+                return;
+            }
+            key_type key = key_type();
+            if (!Dict::parseField(fields[1], key)) {
+                return;
+            }
+            bool existed = cur.find(*overlay, key) != nullptr;
+            if (fields[0][0] == '+' && fields.size() >= 3) {
+                Entry &entry = (*overlay)[key];
+                entry.deleted = false;
+                entry.value = mapped_type();
+                Dict::parseField(fields[2], entry.value);
+                size += existed ? 0 : 1;
+            } else if (fields[0][0] == '-' && existed) {
+                Entry &entry = (*overlay)[key];
+                entry.deleted = true;
+                entry.value = mapped_type();
+                --size;
+            }
+        });
+        if (!opened) {
+            return nullptr;
+        }
+        if (overlay->size() > cur._base->size() * maxOverlayRatio() + 1) {
+            return nullptr;
+        }
+        return new DeltaDict(cur._base, overlay, size);
+    }
+
+    // 不存在时返回nullptr
+    const mapped_type *find(const key_type &key) const { return find(*_overlay, key); }
+    size_t count(const key_type &key) const { return find(key) != nullptr ? 1 : 0; }
+    size_t size() const { return _size; }
+    size_t overlaySize() const { return _overlay->size(); }
+    const BaseType &base() const { return *_base; }
+
+    // base通常与上一个版本共享, 已经是热的, 这里只预热overlay
+    size_t prefault() const { return prefaultDict(*_overlay); }
+
+    // overlay相对base的上限, 超过后补丁被拒绝, 触发一次全量加载
+    static double &maxOverlayRatio() {
+        static double ratio = DELTA_DICT_MAX_OVERLAY_RATIO;
+        return ratio;
+    }
+
+private:
+    struct Entry {
+        Entry() : deleted(false), value() {}
+        bool deleted;
+        mapped_type value;
+    };
+    typedef std::unordered_map<key_type, Entry> Overlay;
+
+    DeltaDict(const std::shared_ptr<const BaseType> &base,
+            const std::shared_ptr<Overlay> &overlay, int64_t size)
+        : _base(base), _overlay(overlay), _size(size) {}
+
+    const mapped_type *find(const Overlay &overlay, const key_type &key) const {
+        if (!overlay.empty()) {
+            auto it = overlay.find(key);
+            if (it != overlay.end()) {
+                return it->second.deleted ? nullptr : &it->second.value;
+            }
+        }
+        auto it = _base->find(key);
+        return it == _base->end() ? nullptr : &it->second;
+    }
+
+    std::shared_ptr<const BaseType> _base;
+    std::shared_ptr<const Overlay> _overlay;
+    int64_t _size;
+};
+
+} // end namespace StemCell
+#endif
@@ -9,7 +9,30 @@
 #include <fstream>
 #include <unordered_map>
 #include <sstream>
+#include <string_view>
+#include <charconv>
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <tuple>
+#include <memory>
+#include <chrono>
+#include <mutex>
 #include <butil/logging.h>
+#include "mmap_file.h"
+#include "simd_tokenizer.h"
+#include "flat_map.hpp"
+#include "flat_hash_map.hpp"
+#include "csr_dict.hpp"
+#include "string_arena.h"
+#include "load_throttle.h"
+#include "huge_page_allocator.h"
+#include "bloom_filter.h"
+#include "posting_list.h"
+#include "pipeline_loader.h"
 
 #define MAP_DICT_SEP '\t'
 #define SET_DICT_SEP ','
@@ -19,15 +42,40 @@
 #define MAP_DICT_VALUE_INDEX 1
 #define REVERSE_MAP_DICT_KEY_INDEX 1
 #define REVERSE_MAP_DICT_VALUE_INDEX 0
+// 并行加载时每段的最小字节数, 小文件不值得拆分
+#define PARALLEL_LOAD_MIN_CHUNK_BYTES (4 << 20)
 
 namespace StemCell {
 
+// 可以直接用std::from_chars解析的类型; 单字节整型与bool在stringstream中
+// 不是按数字解析的, 仍然走stringstream以保持原有语义
+template<class T>
+struct IsCharconvType : std::integral_constant<bool,
+    (std::is_integral<T>::value && sizeof(T) > 1 && !std::is_same<T, bool>::value)
+    || std::is_floating_point<T>::value> {};
+
 class Dict {
 public:
     typedef std::map<std::string, std::map<int64_t, double> > SIDMapDict;
     typedef std::map<int64_t,std::vector<int32_t> > LIVecMapDict;
     typedef std::map<std::string, int32_t> SIMapDict;
     typedef std::unordered_map<int64_t, int32_t> LIHashMapDict;
+    // 只读的flat版本, 用buildFlatMapDict/buildFlatVecMapDict加载
+    typedef SortedVectorMap<std::string, int32_t> SIFlatMapDict;
+    typedef SortedVectorMap<int64_t, std::vector<int32_t> > LIVecFlatMapDict;
+    // LIVecMapDict的压缩版本, 用buildCompressedVecMapDict加载
+    typedef CompressedVecMapDict<int64_t, int32_t> LICompressedVecMapDict;
+    typedef FlatHashMap<int64_t, int32_t> LIFlatHashMapDict;
+    // SIDMapDict的CSR版本, 用buildCsrMapDict加载
+    typedef CsrMapDict<std::string, int64_t, double> SIDCsrMapDict;
+    // key驻留在StringInternPool里的版本, 用buildInternedMapDict/buildInternedCsrMapDict加载
+    typedef InternedDict<SortedVectorMap<std::string_view, int32_t> > SIInternedMapDict;
+    typedef InternedDict<CsrMapDict<std::string_view, int64_t, double> > SIDInternedMapDict;
+    // 节点分配在大页上的版本, 用buildHugePageHashMapDict加载
+    typedef HugePageDict<HugePageHashMap<int64_t, int32_t> > LIHugePageHashMapDict;
+    // 前面挡一个Bloom filter的版本, 用buildFilteredSetDict/buildFilteredLineNoHashMapDict加载
+    typedef FilteredDict<std::set<int64_t> > LFilteredSetDict;
+    typedef FilteredDict<std::unordered_map<std::string, int32_t> > SIFilteredHashMapDict;
     //typedef std::map<int64_t, int64_t> LLMapDict;
     //typedef std::map<int64_t, int32_t> LIMapDict;
     //typedef std::unordered_map<int64_t, int64_t> LLHashMapDict;
@@ -43,15 +91,7 @@ public:
     //typedef std::vector<std::pair<uint32_t,uint32_t> > IIVectorDict;
     
     static const std::string strip(std::string &source) {
-        static const std::string trims = " \t\r\n";
-        std::string::size_type pos1, pos2;
-
-        pos1 = source.find_first_not_of(trims);
-        pos2 = source.find_last_not_of(trims);
-
-        if (pos1 != std::string::npos)
-            return source.substr(pos1, pos2 - pos1 + 1);
-        return "";
+        return std::string(stripView(source));
     }
 
     static void split(char delimiter, const std::string &source,
@@ -59,291 +99,751 @@ public:
         if (source.empty()) {
             return;
         }
-        size_t prev_pos = 0, pos = 0;
-
-        result.resize(0);
-        pos = source.find(delimiter, pos);
-        int32_t index  = 0;
-        while (pos != std::string::npos)
-        {
-            result.push_back(source.substr(prev_pos, pos - prev_pos));
-            if( reqSize != 0 && ++index >= reqSize ) {
-                return;
-            }
-            prev_pos = ++ pos;
-            pos = source.find(delimiter, pos);
-        }
-        result.push_back(source.substr(prev_pos));
+        static thread_local std::vector<std::string_view> fields;
+        SimdTokenizer::split(source, delimiter, fields, reqSize);
+        assignFields(fields, result);
     }
 
     static void split(const std::string &delimiters, const std::string &source, std::vector<std::string> &result) {
         if (source.empty()) {
             return;
         }
-        size_t prev_pos = 0, pos = 0;
+        static thread_local std::vector<std::string_view> fields;
+        SimdTokenizer::splitAny(source, delimiters, fields);
+        assignFields(fields, result);
+    }
 
-        result.resize(0);
-        pos = source.find_first_of(delimiters, pos);
-        while (pos != std::string::npos) {
-            result.push_back(source.substr(prev_pos, pos - prev_pos));
-            prev_pos = ++ pos;
-            pos = source.find_first_of(delimiters, pos);
+    // assign() reuses the buffers of the strings result already holds
+    static void assignFields(const std::vector<std::string_view> &fields,
+            std::vector<std::string> &result) {
+        result.resize(fields.size());
+        for (size_t i = 0; i < fields.size(); ++i) {
+            result[i].assign(fields[i].data(), fields[i].size());
         }
-        result.push_back(source.substr(prev_pos));
     }
 
-// set类型的dict加载
-template<class T>
-inline std::set<T>* buildSetDict(const std::string& fileName) {
-    std::ifstream fin(fileName.c_str());
-    if(!fin.is_open()) {
-        return nullptr;
+    /**
+     * @brief 词典文件的读取方式
+     * LOAD_MODE_STREAM: ifstream + getline 逐行读取
+     * LOAD_MODE_MMAP: 整个文件只读映射, 在映射内存上原地切分, 不拷贝行数据
+     * LOAD_MODE_PIPELINE: 读取、解析、插入三级流水线, 见pipeline_loader.h
+     */
+    enum LoadMode {
+        LOAD_MODE_STREAM = 0,
+        LOAD_MODE_MMAP = 1,
+        LOAD_MODE_PIPELINE = 2
+    };
+
+    // 进程级别的加载方式, 对所有build*Dict生效
+    static void setLoadMode(LoadMode mode) { loadMode().store(mode); }
+    static LoadMode getLoadMode() { return static_cast<LoadMode>(loadMode().load()); }
+
+    /**
+     * @brief 进程级别的加载线程数, 在LOAD_MODE_MMAP和LOAD_MODE_PIPELINE下生效
+     * 默认为1, 即在调用线程上顺序加载; 在线服务里按可以让出的核数设置.
+     * LOAD_MODE_PIPELINE下为解析线程数, 另外总有一个读取线程
+     */
+    static void setLoadThreads(int32_t threads) { loadThreads().store(std::max(1, threads)); }
+    static int32_t getLoadThreads() { return loadThreads().load(); }
+
+    static std::string_view stripView(std::string_view source) {
+        static const char* trims = " \t\r\n";
+        std::string_view::size_type pos1 = source.find_first_not_of(trims);
+        if (pos1 == std::string_view::npos) {
+            return std::string_view();
+        }
+        std::string_view::size_type pos2 = source.find_last_not_of(trims);
+        return source.substr(pos1, pos2 - pos1 + 1);
+    }
+
+    // 与split相同的切分规则, 结果指向source的内存, 不做拷贝
+    static void splitView(char delimiter, std::string_view source,
+            std::vector<std::string_view> &result, int32_t reqSize = 0) {
+        SimdTokenizer::split(source, delimiter, result, reqSize);
+    }
+
+    /**
+     * @brief 解析单个字段, 结果与 stringstream >> value 完全一致:
+     * 跳过前导空白, 数值读到第一个非法字符为止, 字符串读到第一个空白为止
+     * @return 没有解析出任何内容时返回false, 数值此时被置为0(同stringstream)
+     */
+    template<class T>
+    static bool parseField(std::string_view field, T &value) {
+        size_t consumed;
+        return parsePrefix(field, value, consumed);
     }
-    std::set<T>* _s_set = new std::set<T>();
-    std::string line;
-    while (getline(fin, line)) {
-        line = strip(line);
-        if(line.empty()) {
-            continue;
+
+    // 字段中第一个以空白分隔的token, 即 stringstream >> std::string 读到的内容
+    static std::string_view parseToken(std::string_view field) {
+        field = skipSpace(field);
+        size_t len = 0;
+        while (len < field.size() && !isSpace(field[len])) {
+            ++len;
         }
-        std::stringstream s_key;
-        T key;
-        s_key << line;
-        s_key >> key;
-        _s_set->insert(key);
+        return field.substr(0, len);
     }
-    return _s_set;
-}
 
-// HashMap类型的dict加载,  T -> line number 
-template<class T>
-static inline std::unordered_map<T, int32_t>* buildLineNoHashMapDict(const std::string& fileName) {
-    std::ifstream fin(fileName.c_str());
-    if(!fin.is_open()) {
-        return nullptr;
+    /**
+     * @brief 从field开头解析一个值, consumed为用掉的字符数(含前导空白)
+     * 常见的十进制数直接用std::from_chars; from_chars与stringstream结果可能不同的输入
+     * (inf/nan、溢出、无符号数前的负号、悬空的指数等)交给stringstream处理
+     */
+    template<class T>
+    static typename std::enable_if<IsCharconvType<T>::value, bool>::type
+    parsePrefix(std::string_view field, T &value, size_t &consumed) {
+        size_t skipped = field.size() - skipSpace(field).size();
+        std::string_view rest = field.substr(skipped);
+        // from_chars does not accept an explicit plus sign
+        size_t plus = (!rest.empty() && rest.front() == '+') ? 1 : 0;
+        rest.remove_prefix(plus);
+        size_t digit = (!plus && !rest.empty() && rest.front() == '-') ? 1 : 0;
+        if (digit < rest.size() && (isDigit(rest[digit])
+                    || (std::is_floating_point<T>::value && rest[digit] == '.'))) {
+            const char *begin = rest.data();
+            const char *end = begin + rest.size();
+            std::from_chars_result parsed = std::from_chars(begin, end, value);
+            bool dangling = std::is_floating_point<T>::value && parsed.ptr != end
+                && (*parsed.ptr == 'e' || *parsed.ptr == 'E');
+            if (parsed.ec == std::errc() && !dangling) {
+                consumed = skipped + plus + (parsed.ptr - begin);
+                return true;
+            }
+        }
+        return parseStream(field, value, consumed);
     }
-    std::unordered_map<T, int32_t>* _s_map = new std::unordered_map<T, int32_t>();
-    std::string line;
-    int index = 0;
-    while (getline(fin, line)) {
-        line = strip(line);
-        if(line.empty()) {
-            continue;
-        }
-        std::stringstream s_key;
-        T key;
-        s_key << line;
-        s_key >> key;
-        (*_s_map)[key] = index;
-        ++index;
+
+    static bool parsePrefix(std::string_view field, std::string &value, size_t &consumed) {
+        std::string_view token = parseToken(field);
+        if (token.empty()) {
+            return false;
+        }
+        value.assign(token.data(), token.size());
+        consumed = token.data() + token.size() - field.data();
+        return true;
     }
-    return _s_map;
-}
 
-//所有map类型的dict加载
-template<class T1,class T2>
-static inline std::map<T1,T2> *buildMapDict(const std::string &fileName) {
-    std::ifstream fin(fileName.c_str());
-    if( !fin.is_open() ) {
-        return nullptr;
+    template<class T>
+    static typename std::enable_if<!IsCharconvType<T>::value, bool>::type
+    parsePrefix(std::string_view field, T &value, size_t &consumed) {
+        return parseStream(field, value, consumed);
     }
 
-    std::map<T1, T2> * _s_map = new std::map<T1,T2>();
-    std::string line;
-    while( getline(fin, line) ) {
-        line = strip(line);
-        if( line.empty() ) continue;
-        std::vector<std::string> fields;
-        split(MAP_DICT_SEP, line, fields);
-        if( fields.size() < MAP_DICT_FIELD_COUNT ) {
-            continue;
+    template<class T>
+    static bool parseStream(std::string_view field, T &value, size_t &consumed) {
+        std::istringstream s_field(std::string(field.data(), field.size()));
+        if (!(s_field >> value)) {
+            return false;
         }
-        std::stringstream s_key;
-        std::stringstream s_value;
-        T1 key;
-        T2 value;
+        consumed = s_field.eof() ? field.size() : static_cast<size_t>(s_field.tellg());
+        return true;
+    }
 
-        s_key<<fields[MAP_DICT_KEY_INDEX];
-        s_value<<fields[MAP_DICT_VALUE_INDEX];
+    // 整个字段作为值, 用于value中含有空格的情况
+    template<class T>
+    static bool parseWholeField(std::string_view field, T &value) {
+        return parseField(field, value);
+    }
 
-        s_key>>key;
-        s_value>>value;
+    static bool parseWholeField(std::string_view field, std::string &value) {
+        value.assign(field.data(), field.size());
+        return true;
+    }
 
-        (*_s_map)[key] = value;
+    /**
+     * @brief 解析值列表, 与原来的 while (s >> v) { ...; if (s.peek() == delimiter) s.ignore(); } 一致:
+     * 值之间可以用空白或一个delimiter分隔, 遇到第一个非法值时停止;
+     * std::string值读到空白为止, 其中的delimiter不切分
+     */
+    template<class T>
+    static void parseList(char delimiter, std::string_view source, std::vector<T> &result) {
+        size_t pos = 0;
+        while (pos < source.size()) {
+            T value = T();
+            size_t consumed;
+            if (!parsePrefix(source.substr(pos), value, consumed)) {
+                return;
+            }
+            result.push_back(value);
+            pos += consumed;
+            if (pos < source.size() && source[pos] == delimiter) {
+                ++pos;
+            }
+        }
     }
-    return _s_map;
-}
 
-//所有map类型的dict加载，buildMapDict不支持value含有空格的情况
-template<class T1,class T2>
-inline std::map<T1,T2> *buildMapDictSpaceSupport(const std::string &fileName) {
-    std::ifstream fin(fileName.c_str());
-    if( !fin.is_open() )
-    {
-        return nullptr;
+    /**
+     * @brief 逐行读取词典文件, 每个去掉首尾空白后的非空行回调一次onLine(std::string_view)
+     * @return 文件打开失败时返回false
+     */
+    template<class LineFunc>
+    static bool forEachLine(const std::string &fileName, LineFunc &&onLine) {
+        if (getLoadMode() == LOAD_MODE_MMAP) {
+            MmapFile file;
+            if (!file.open(fileName)) {
+                return false;
+            }
+            file.advise(MADV_SEQUENTIAL);
+            forEachLineInBuffer(file.data(), file.size(), onLine);
+            return true;
+        }
+        std::ifstream fin(fileName.c_str());
+        if (!fin.is_open()) {
+            return false;
+        }
+        std::string line;
+        while (getline(fin, line)) {
+            LoadThrottle::onBytes(line.size() + 1);
+            std::string_view view = stripView(line);
+            if (view.empty()) {
+                continue;
+            }
+            onLine(view);
+        }
+        return true;
     }
 
-    std::map<T1, T2> * _s_map = new std::map<T1,T2>();
-    std::string line;
-    while( getline(fin, line) )
-    {
-        line = strip(line);
-        if( line.empty() ) continue;
-        std::vector<std::string> fields;
-        split(MAP_DICT_SEP, line, fields);
-        if( fields.size() < MAP_DICT_FIELD_COUNT )
-        {
-            continue;
+    template<class LineFunc>
+    static void forEachLineInBuffer(const char *data, size_t size, LineFunc &onLine) {
+        const char *end = data + size;
+        const char *p = data;
+        while (p < end) {
+            const char *newline = static_cast<const char*>(memchr(p, '\n', end - p));
+            const char *lineEnd = (newline != nullptr) ? newline : end;
+            LoadThrottle::onBytes(lineEnd - p + 1);
+            std::string_view view = stripView(std::string_view(p, lineEnd - p));
+            if (!view.empty()) {
+                onLine(view);
+            }
+            p = lineEnd + 1;
         }
-        std::stringstream s_key;
-        std::stringstream s_value;
-        T1 key;
-        T2 value;
+    }
 
-        s_key<<fields[MAP_DICT_KEY_INDEX];
-        s_value<<fields[MAP_DICT_VALUE_INDEX];
+    static bool isDigit(char c) { return c >= '0' && c <= '9'; }
 
-        std::getline(s_key, key);
-        std::getline(s_value, value);
+    static bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+    }
 
-        (*_s_map)[key] = value;
+    static std::string_view skipSpace(std::string_view field) {
+        size_t pos = 0;
+        while (pos < field.size() && isSpace(field[pos])) {
+            ++pos;
+        }
+        return field.substr(pos);
     }
-    //MV_DEBUG((L_INFO, "===print m_ctripGoodsDict==="));
-    //printMapDict(_s_map);
-    return _s_map;
-}
 
-//二维关联map类型的dict加载
-template<class T1, class T2, class T3>
-static std::map<T1, std::map<T2, T3> > *buildMapDict(const std::string &fileName) {
-    std::ifstream fin(fileName.c_str());
-    if( !fin.is_open() ) {
-        return nullptr;
+    // 每个加载线程私有的行处理上下文
+    struct LineContext {
+        LineContext() : lineNo(0) {}
+        int32_t lineNo;                         // 非空行在文件中的序号
+        std::vector<std::string_view> fields;   // splitView的复用缓冲
+    };
+
+    /**
+     * @brief 通用的词典构建流程
+     * @param onLine void(DictType&, std::string_view line, LineContext&), 处理一行
+     * @param merge void(DictType& result, DictType& later, int32_t resultLines),
+     *  把后面一段的结果合并进前面一段, 需要保证与顺序加载的结果一致
+     * LOAD_MODE_MMAP且加载线程数大于1时, 文件按行边界切成多段并行解析, 再两两归并;
+     * LOAD_MODE_PIPELINE时按块流水线加载, 每块解析出的小词典按顺序合并
+     * @return 文件打开失败返回nullptr
+     */
+    template<class DictType, class LineFunc, class MergeFunc>
+    static DictType *buildDict(const std::string &fileName, LineFunc onLine, MergeFunc merge) {
+        if (getLoadMode() == LOAD_MODE_PIPELINE) {
+            return buildDictPipelined<DictType>(fileName, onLine, merge);
+        }
+        if (getLoadMode() == LOAD_MODE_MMAP && getLoadThreads() > 1) {
+            MmapFile file;
+            if (!file.open(fileName)) {
+                return nullptr;
+            }
+            file.advise(MADV_WILLNEED);
+            return buildDictParallel<DictType>(file.data(), file.size(), onLine, merge);
+        }
+        DictType *dict = new DictType();
+        LineContext ctx;
+        bool opened = forEachLine(fileName, [dict, &ctx, &onLine](std::string_view line) {
+            onLine(*dict, line, ctx);
+            ++ctx.lineNo;
+        });
+        if (!opened) {
+            delete dict;
+            return nullptr;
+        }
+        return dict;
     }
-    std::map<T1, std::map<T2, T3> > * _s_map = new std::map<T1, std::map<T2, T3> >();
-    std::string line;
-    while( getline(fin, line) ) {
-        line = strip(line);
-        if ( line.empty() ) {
-            continue;
-        }
-        std::vector<std::string> fields;
-        split(MAP_DICT_SEP, line, fields);
-        if( fields.size() < 3 ) {
-            continue;
-        }
-        std::stringstream s_key1;
-        std::stringstream s_key2;
-        std::stringstream s_value;
-        T1 key1;
-        T2 key2;
-        T3 value;
-
-        s_key1 << fields[0];
-        s_key2 << fields[1];
-        s_value << fields[2];
-        
-        s_key1 >> key1;
-        s_key2 >> key2;
-        s_value >> value;
-        
-        (*_s_map)[key1][key2] = value;
-    }
-    LOG(INFO) << "new_dict_ size:" << _s_map->size(); 
-    /*
-    auto& dict = *_s_map;
-    for (auto& v : dict) {
-        for (auto& m : v.second) {
-            LOG(INFO) << v.first << "\t" << m.first << "\t" << m.second;
-        }
-
-    }
-    */
-    return _s_map;
-}
 
-template<class T1,class T2>
-inline std::map<T1,std::set<T2> > *buildMapSetDict(const std::string &fileName) {
-    std::ifstream fin(fileName.c_str());
-    if( !fin.is_open() )
-    {
-        return nullptr;
+    template<class DictType, class LineFunc, class MergeFunc>
+    static DictType *buildDictParallel(const char *data, size_t size,
+            LineFunc &onLine, MergeFunc &merge) {
+        // 切分成若干段, 每段的起点都在行首
+        size_t chunkCount = std::max<size_t>(1, std::min<size_t>(getLoadThreads(),
+                    size / PARALLEL_LOAD_MIN_CHUNK_BYTES));
+        std::vector<const char*> bounds(1, data);
+        for (size_t i = 1; i < chunkCount; ++i) {
+            const char *p = std::max(bounds.back(), data + size / chunkCount * i);
+            const char *newline = static_cast<const char*>(memchr(p, '\n', data + size - p));
+            if (newline == nullptr) {
+                break;
+            }
+            bounds.push_back(newline + 1);
+        }
+        bounds.push_back(data + size);
+        chunkCount = bounds.size() - 1;
+
+        std::vector<DictType*> dicts(chunkCount, nullptr);
+        std::vector<int32_t> lines(chunkCount, 0);
+        std::vector<std::thread> workers;
+        // worker threads are throttled and allocate like the calling thread
+        LoadThrottle *throttle = LoadThrottle::currentThrottle();
+        HugePageArena *arena = HugePageArena::current();
+        for (size_t i = 0; i < chunkCount; ++i) {
+            workers.emplace_back([&, i]() {
+                LoadThrottle::Scope scope(throttle);
+                HugePageArena::Scope arenaScope(arena);
+                DictType *dict = new DictType();
+                LineContext ctx;
+                auto lineFunc = [dict, &ctx, &onLine](std::string_view line) {
+                    onLine(*dict, line, ctx);
+                    ++ctx.lineNo;
+                };
+                forEachLineInBuffer(bounds[i], bounds[i + 1] - bounds[i], lineFunc);
+                dicts[i] = dict;
+                lines[i] = ctx.lineNo;
+            });
+        }
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+
+        // 相邻两段两两归并, 每一轮内的归并互不相关, 可以并行
+        for (size_t step = 1; step < chunkCount; step *= 2) {
+            workers.clear();
+            for (size_t i = 0; i + step < chunkCount; i += 2 * step) {
+                workers.emplace_back([&, i, step]() {
+                    LoadThrottle::Scope scope(throttle);
+                    HugePageArena::Scope arenaScope(arena);
+                    merge(*dicts[i], *dicts[i + step], lines[i]);
+                    lines[i] += lines[i + step];
+                    delete dicts[i + step];
+                    dicts[i + step] = nullptr;
+                });
+            }
+            for (std::thread &worker : workers) {
+                worker.join();
+            }
+        }
+        return dicts[0];
     }
 
-    std::map<T1, std::set<T2> > * _s_map = new std::map<T1,std::set<T2> >();
-    std::string line;
-    while( getline(fin, line) )
-    {
-        line = strip(line);
-        if( line.empty() ) continue;
-        std::vector<std::string> fields;
-        split(MAP_DICT_SEP, line, fields);
-        if( fields.size() < MAP_DICT_FIELD_COUNT )
+    /**
+     * @brief 流水线加载, 读取线程和getLoadThreads()个解析线程, 调用线程按块的顺序合并
+     * 在途的块数不超过2 * PIPELINE_LOAD_QUEUE_DEPTH + 解析线程数
+     */
+    template<class DictType, class LineFunc, class MergeFunc>
+    static DictType *buildDictPipelined(const std::string &fileName,
+            LineFunc &onLine, MergeFunc &merge) {
+        typedef std::chrono::steady_clock Clock;
+        struct Block {
+            size_t seq;
+            std::vector<char> data;
+            size_t size;
+        };
+        struct Parsed {
+            size_t seq;
+            DictType *dict;
+            int32_t lines;
+        };
+        auto elapsedMs = [](Clock::time_point start) {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+        };
+
+        Clock::time_point loadStart = Clock::now();
+        BlockReader reader;
+        if (!reader.open(fileName)) {
+            return nullptr;
+        }
+        const size_t parsers = static_cast<size_t>(getLoadThreads());
+        const size_t window = 2 * PIPELINE_LOAD_QUEUE_DEPTH + parsers;
+        BoundedBlockingQueue<Block> blocks(PIPELINE_LOAD_QUEUE_DEPTH);
+        BoundedBlockingQueue<Parsed> parsed(PIPELINE_LOAD_QUEUE_DEPTH + parsers);
+        BoundedBlockingQueue<std::vector<char> > buffers(window);
+        // one token per block in flight, given back once the block is merged
+        BoundedBlockingQueue<char> tokens(window);
+        for (size_t i = 0; i < window; ++i) {
+            tokens.tryPush(0);
+        }
+        PipelineLoadStats &stats = lastPipelineStats();
+        stats = PipelineLoadStats();
+        stats.parsers = parsers;
+        std::mutex statsLock;
+        std::atomic<size_t> activeParsers(parsers);
+
+        LoadThrottle *throttle = LoadThrottle::currentThrottle();
+        HugePageArena *arena = HugePageArena::current();
+        std::thread readThread([&]() {
+            LoadThrottle::Scope scope(throttle);
+            int64_t readMs = 0;
+            int64_t stallMs = 0;
+            for (size_t seq = 0; ; ++seq) {
+                Clock::time_point start = Clock::now();
+                char token;
+                tokens.pop(token);
+                Block block;
+                block.seq = seq;
+                buffers.tryPop(block.data);
+                stallMs += elapsedMs(start);
+                start = Clock::now();
+                bool more = reader.next(block.data, block.size);
+                readMs += elapsedMs(start);
+                if (!more) {
+                    break;
+                }
+                stats.bytes += block.size;
+                ++stats.blocks;
+                start = Clock::now();
+                blocks.push(std::move(block));
+                stallMs += elapsedMs(start);
+            }
+            blocks.close();
+            stats.readMs = readMs;
+            stats.readStallMs = stallMs;
+        });
+
+        std::vector<std::thread> parseThreads;
+        for (size_t i = 0; i < parsers; ++i) {
+            parseThreads.emplace_back([&]() {
+                LoadThrottle::Scope scope(throttle);
+                HugePageArena::Scope arenaScope(arena);
+                int64_t parseMs = 0;
+                int64_t stallMs = 0;
+                while (true) {
+                    Clock::time_point start = Clock::now();
+                    Block block;
+                    bool got = blocks.pop(block);
+                    stallMs += elapsedMs(start);
+                    if (!got) {
+                        break;
+                    }
+                    start = Clock::now();
+                    Parsed result;
+                    result.seq = block.seq;
+                    result.dict = new DictType();
+                    LineContext ctx;
+                    DictType *dict = result.dict;
+                    auto lineFunc = [dict, &ctx, &onLine](std::string_view line) {
+                        onLine(*dict, line, ctx);
+                        ++ctx.lineNo;
+                    };
+                    forEachLineInBuffer(block.data.data(), block.size, lineFunc);
+                    result.lines = ctx.lineNo;
+                    buffers.tryPush(std::move(block.data));
+                    parseMs += elapsedMs(start);
+                    start = Clock::now();
+                    parsed.push(std::move(result));
+                    stallMs += elapsedMs(start);
+                }
+                {
+                    std::lock_guard<std::mutex> locker(statsLock);
+                    stats.parseMs += parseMs;
+                    stats.parseStallMs += stallMs;
+                }
+                if (--activeParsers == 0) {
+                    parsed.close();
+                }
+            });
+        }
+
+        // 插入: 按seq的顺序合并, 先到的后续块暂存在pending里
+        DictType *dict = nullptr;
+        int32_t lines = 0;
+        size_t nextSeq = 0;
+        std::map<size_t, Parsed> pending;
+        int64_t insertMs = 0;
+        int64_t stallMs = 0;
         {
-            continue;
+            HugePageArena::Scope arenaScope(arena);
+            while (true) {
+                Clock::time_point start = Clock::now();
+                Parsed result;
+                bool got = parsed.pop(result);
+                stallMs += elapsedMs(start);
+                if (!got) {
+                    break;
+                }
+                start = Clock::now();
+                pending[result.seq] = result;
+                for (auto it = pending.begin(); it != pending.end() && it->first == nextSeq;
+                        it = pending.erase(it), ++nextSeq) {
+                    if (dict == nullptr) {
+                        dict = it->second.dict;
+                    } else {
+                        merge(*dict, *it->second.dict, lines);
+                        delete it->second.dict;
+                    }
+                    lines += it->second.lines;
+                    tokens.tryPush(0);
+                }
+                insertMs += elapsedMs(start);
+            }
+        }
+        readThread.join();
+        for (std::thread &parseThread : parseThreads) {
+            parseThread.join();
         }
+        stats.lines = lines;
+        stats.insertMs = insertMs;
+        stats.insertStallMs = stallMs;
+        stats.totalMs = elapsedMs(loadStart);
+        if (reader.failed()) {
+            LOG(WARNING) << "read dict file failed:" << fileName;
+            delete dict;
+            return nullptr;
+        }
+        LOG(INFO) << "pipeline load " << fileName << " " << stats.report();
+        return dict != nullptr ? dict : new DictType();
+    }
 
+    // 调用线程上最近一次LOAD_MODE_PIPELINE加载的统计
+    static PipelineLoadStats &lastPipelineStats() {
+        static thread_local PipelineLoadStats stats;
+        return stats;
+    }
 
-        std::stringstream s_key;
-        std::stringstream s_value;
-        T1 key;
-        T2 value;
+    /**
+     * @brief 重复的key以后出现的为准
+     * later较小时把later的节点逐个移进result, 否则把result的节点移进later再交换,
+     * 代价与较小的一方成正比, 流水线加载时每块的小词典合并进大词典不会越来越慢
+     */
+    template<class DictType>
+    static void mergeOverwrite(DictType &result, DictType &later, int32_t) {
+        if (later.size() < result.size()) {
+            for (auto it = later.begin(); it != later.end(); ) {
+                auto inserted = result.insert(later.extract(it++));
+                if (!inserted.inserted) {
+                    inserted.position->second = std::move(inserted.node.mapped());
+                }
+            }
+            return;
+        }
+        later.merge(result);
+        result.swap(later);
+    }
 
-        s_key<<fields[MAP_DICT_KEY_INDEX];
-        s_value<<fields[MAP_DICT_VALUE_INDEX];
+    template<class DictType>
+    static void mergeLineNo(DictType &result, DictType &later, int32_t resultLines) {
+        for (auto it = later.begin(); it != later.end(); ++it) {
+            it->second += resultLines;
+        }
+        mergeOverwrite(result, later, resultLines);
+    }
 
-        s_key>>key;
-        s_value>>value;
+    template<class DictType>
+    static void mergeUnion(DictType &result, DictType &later, int32_t) {
+        result.merge(later);
+    }
 
-        std::set<T2> valuelist;
-        if(_s_map->find(key) != _s_map->end())
-        {
-            valuelist = (*_s_map)[key];
+    // value本身是map或set, 相同外层key的value再按以后出现的为准合并
+    template<class DictType>
+    static void mergeNested(DictType &result, DictType &later, int32_t) {
+        if (later.size() < result.size()) {
+            for (auto it = later.begin(); it != later.end(); ) {
+                auto inserted = result.insert(later.extract(it++));
+                if (!inserted.inserted) {
+                    inserted.node.mapped().merge(inserted.position->second);
+                    inserted.position->second.swap(inserted.node.mapped());
+                }
+            }
+            return;
+        }
+        later.merge(result);
+        for (auto it = result.begin(); it != result.end(); ++it) {
+            later.find(it->first)->second.merge(it->second);
         }
+        result.swap(later);
+    }
+
+    template<class DictType>
+    static void mergeAppend(DictType &result, DictType &later, int32_t) {
+        result.insert(result.end(), std::make_move_iterator(later.begin()),
+                std::make_move_iterator(later.end()));
+    }
 
-        valuelist.insert(value);
+private:
+    static std::atomic<int> &loadMode() {
+        static std::atomic<int> mode(LOAD_MODE_STREAM);
+        return mode;
+    }
 
-        (*_s_map)[key] = valuelist;
+    static std::atomic<int32_t> &loadThreads() {
+        static std::atomic<int32_t> threads(1);
+        return threads;
     }
-    LOG(INFO) << "new_dict_ size:" << _s_map->size(); 
-    return _s_map;
+
+public:
+
+// set类型的dict加载
+template<class T>
+static inline std::set<T>* buildSetDict(const std::string& fileName) {
+    typedef std::set<T> DictType;
+    return buildDict<DictType>(fileName, [](DictType &dict, std::string_view line, LineContext &) {
+        T key = T();
+        parseField(line, key);
+        dict.insert(key);
+    }, mergeUnion<DictType>);
 }
 
-template<class T1,class T2>
-static inline std::vector<std::pair<T1,T2> > *buildVectorDict(const std::string &fileName) {
-    std::ifstream fin(fileName.c_str());
-    if( !fin.is_open() )
-    {
+// HashMap类型的dict加载,  T -> line number 
+template<class T>
+static inline std::unordered_map<T, int32_t>* buildLineNoHashMapDict(const std::string& fileName) {
+    typedef std::unordered_map<T, int32_t> DictType;
+    return buildDict<DictType>(fileName, [](DictType &dict, std::string_view line, LineContext &ctx) {
+        T key = T();
+        parseField(line, key);
+        dict[key] = ctx.lineNo;
+    }, mergeLineNo<DictType>);
+}
+
+/*
+ * 带Bloom filter的set/行号词典, 大部分查询不命中时先查filter, 省掉树或hash的查找.
+ * fpp为filter的目标误判率; 需要单参数的NewDictFunc时可以用不带lambda捕获的函数包一层
+ */
+template<class T>
+static inline FilteredDict<std::set<T> > *buildFilteredSetDict(const std::string &fileName) {
+    return buildFilteredSetDict<T>(fileName, BLOOM_FILTER_DEFAULT_FPP);
+}
+
+template<class T>
+static inline FilteredDict<std::set<T> > *buildFilteredSetDict(const std::string &fileName,
+        double fpp) {
+    return withBloomFilter(buildSetDict<T>(fileName), fpp);
+}
+
+template<class T>
+static inline FilteredDict<std::unordered_map<T, int32_t> > *buildFilteredLineNoHashMapDict(
+        const std::string &fileName) {
+    return buildFilteredLineNoHashMapDict<T>(fileName, BLOOM_FILTER_DEFAULT_FPP);
+}
+
+template<class T>
+static inline FilteredDict<std::unordered_map<T, int32_t> > *buildFilteredLineNoHashMapDict(
+        const std::string &fileName, double fpp) {
+    return withBloomFilter(buildLineNoHashMapDict<T>(fileName), fpp);
+}
+
+// 给已加载的词典加上Bloom filter, 转换后释放source
+template<class DictType>
+static inline FilteredDict<DictType> *withBloomFilter(DictType *source, double fpp) {
+    if( source == nullptr ) {
         return nullptr;
     }
+    FilteredDict<DictType> *dict = new FilteredDict<DictType>(std::move(*source), fpp);
+    delete source;
+    LOG(INFO) << "new_dict_ bloom filter " << dict->filter().report();
+    return dict;
+}
 
-    std::vector<std::pair<T1,T2> > *s_vec = new std::vector<std::pair<T1,T2> >();
-    std::string line;
-    while( getline(fin, line) )
-    {
-        line = strip(line);
-        if( line.empty() ) continue;
-        std::vector<std::string> fields;
-        split(MAP_DICT_SEP, line, fields);
-        if( fields.size() < MAP_DICT_FIELD_COUNT )
-        {
-            continue;
-        }
+//所有map类型的dict加载
+template<class T1,class T2>
+static inline std::map<T1,T2> *buildMapDict(const std::string &fileName) {
+    return buildKeyValueDict<std::map<T1, T2> >(fileName);
+}
 
+// 与buildMapDict格式相同, DictType为任意支持operator[]和merge的关联容器
+template<class DictType>
+static inline DictType *buildKeyValueDict(const std::string &fileName) {
+    typedef typename DictType::key_type T1;
+    typedef typename DictType::mapped_type T2;
+    return buildDict<DictType>(fileName, [](DictType &dict, std::string_view line, LineContext &ctx) {
+        splitView(MAP_DICT_SEP, line, ctx.fields);
+        if( ctx.fields.size() < MAP_DICT_FIELD_COUNT ) {
+            return;
+        }
+        T1 key = T1();
+        T2 value = T2();
+        parseField(ctx.fields[MAP_DICT_KEY_INDEX], key);
+        parseField(ctx.fields[MAP_DICT_VALUE_INDEX], value);
+        dict[key] = value;
+    }, mergeOverwrite<DictType>);
+}
 
-        std::stringstream s_key;
-        std::stringstream s_value;
-        T1 key;
-        T2 value;
+//所有map类型的dict加载，buildMapDict不支持value含有空格的情况
+template<class T1,class T2>
+inline std::map<T1,T2> *buildMapDictSpaceSupport(const std::string &fileName) {
+    typedef std::map<T1, T2> DictType;
+    return buildDict<DictType>(fileName, [](DictType &dict, std::string_view line, LineContext &ctx) {
+        splitView(MAP_DICT_SEP, line, ctx.fields);
+        if( ctx.fields.size() < MAP_DICT_FIELD_COUNT ) {
+            return;
+        }
+        T1 key = T1();
+        T2 value = T2();
+        parseWholeField(ctx.fields[MAP_DICT_KEY_INDEX], key);
+        parseWholeField(ctx.fields[MAP_DICT_VALUE_INDEX], value);
+        dict[key] = value;
+    }, mergeOverwrite<DictType>);
+}
 
-        s_key<<fields[MAP_DICT_KEY_INDEX];
-        s_value<<fields[MAP_DICT_VALUE_INDEX];
+//二维关联map类型的dict加载
+template<class T1, class T2, class T3>
+static std::map<T1, std::map<T2, T3> > *buildMapDict(const std::string &fileName) {
+    typedef std::map<T1, std::map<T2, T3> > DictType;
+    DictType *_s_map = buildDict<DictType>(fileName, 
+            [](DictType &dict, std::string_view line, LineContext &ctx) {
+        splitView(MAP_DICT_SEP, line, ctx.fields);
+        if( ctx.fields.size() < 3 ) {
+            return;
+        }
+        T1 key1 = T1();
+        T2 key2 = T2();
+        T3 value = T3();
+        parseField(ctx.fields[0], key1);
+        parseField(ctx.fields[1], key2);
+        parseField(ctx.fields[2], value);
+        dict[key1][key2] = value;
+    }, mergeNested<DictType>);
+    if( _s_map != nullptr ) {
+        LOG(INFO) << "new_dict_ size:" << _s_map->size(); 
+    }
+    return _s_map;
+}
 
-        s_key>>key;
-        s_value>>value;
-        s_vec->push_back(make_pair(key,value));
+template<class T1,class T2>
+inline std::map<T1,std::set<T2> > *buildMapSetDict(const std::string &fileName) {
+    typedef std::map<T1, std::set<T2> > DictType;
+    DictType *_s_map = buildDict<DictType>(fileName, 
+            [](DictType &dict, std::string_view line, LineContext &ctx) {
+        splitView(MAP_DICT_SEP, line, ctx.fields);
+        if( ctx.fields.size() < MAP_DICT_FIELD_COUNT ) {
+            return;
+        }
+        T1 key = T1();
+        T2 value = T2();
+        parseField(ctx.fields[MAP_DICT_KEY_INDEX], key);
+        parseField(ctx.fields[MAP_DICT_VALUE_INDEX], value);
+        dict[key].insert(value);
+    }, mergeNested<DictType>);
+    if( _s_map != nullptr ) {
+        LOG(INFO) << "new_dict_ size:" << _s_map->size(); 
     }
-    return s_vec;
+    return _s_map;
+}
+
+template<class T1,class T2>
+static inline std::vector<std::pair<T1,T2> > *buildVectorDict(const std::string &fileName) {
+    typedef std::vector<std::pair<T1, T2> > DictType;
+    return buildDict<DictType>(fileName, [](DictType &dict, std::string_view line, LineContext &ctx) {
+        splitView(MAP_DICT_SEP, line, ctx.fields);
+        if( ctx.fields.size() < MAP_DICT_FIELD_COUNT ) {
+            return;
+        }
+        T1 key = T1();
+        T2 value = T2();
+        parseField(ctx.fields[MAP_DICT_KEY_INDEX], key);
+        parseField(ctx.fields[MAP_DICT_VALUE_INDEX], value);
+        dict.push_back(std::make_pair(key, value));
+    }, mergeAppend<DictType>);
 }
 
 /*
@@ -356,87 +856,251 @@ static inline std::vector<std::pair<T1,T2> > *buildVectorDict(const std::string
  */
 template<class T1,class T2>
 static inline std::map<T1,T2> *buildReverseMapDict(const std::string &fileName) {
-    std::ifstream fin(fileName.c_str());
-    if( !fin.is_open() ) 
-    {
-        return nullptr;
-    }
-
-    std::map<T1, T2> * _s_map = new std::map<T1,T2>();
-    std::string line;
-    while( getline(fin, line) ) 
-    {
-        line = strip(line);
-        if( line.empty() ) continue;
-        std::vector<std::string> fields;
-        split(MAP_DICT_SEP, line, fields);
-        if( fields.size() < MAP_DICT_FIELD_COUNT ) 
-        {
-            continue;
+    typedef std::map<T1, T2> DictType;
+    return buildDict<DictType>(fileName, [](DictType &dict, std::string_view line, LineContext &ctx) {
+        splitView(MAP_DICT_SEP, line, ctx.fields);
+        if( ctx.fields.size() < MAP_DICT_FIELD_COUNT ) {
+            return;
         }
+        T1 key = T1();
+        T2 value = T2();
+        parseField(ctx.fields[REVERSE_MAP_DICT_KEY_INDEX], key);
+        parseField(ctx.fields[REVERSE_MAP_DICT_VALUE_INDEX], value);
+        dict[key] = value;
+    }, mergeOverwrite<DictType>);
+}
 
-
-        std::stringstream s_key;
-        std::stringstream s_value;
-        T1 key;
-        T2 value;
-
-        s_key<<fields[REVERSE_MAP_DICT_KEY_INDEX];
-        s_value<<fields[REVERSE_MAP_DICT_VALUE_INDEX];
-
-        s_key>>key;
-        s_value>>value;
-
-        (*_s_map)[key] = value;
+template<class T1,class T2>
+static inline std::map<T1,std::vector<T2> > *buildVectorValueTypeMapDict(const std::string &fileName) {
+    typedef std::map<T1, std::vector<T2> > DictType;
+    DictType *_s_map = buildDict<DictType>(fileName, 
+            [](DictType &dict, std::string_view line, LineContext &ctx) {
+        splitView(MAP_DICT_SEP, line, ctx.fields);
+        if( ctx.fields.size() < MAP_DICT_FIELD_COUNT ) {
+            return;
+        }
+        T1 key = T1();
+        parseField(ctx.fields[MAP_DICT_KEY_INDEX], key);
+        std::vector<T2> valueVec;
+        parseList(VEC_DICT_SEP, ctx.fields[MAP_DICT_VALUE_INDEX], valueVec);
+        dict[key].swap(valueVec);
+    }, mergeOverwrite<DictType>);
+    if( _s_map != nullptr ) {
+        LOG(INFO) << "new_dict_ size:" << _s_map->size(); 
     }
     return _s_map;
+}
+/*
+ * 只读flat容器类型的dict加载, MapType为SortedVectorMap或FlatHashMap,
+ * 文件格式和重复key的处理与buildMapDict相同
+ */
+template<class MapType>
+static inline MapType *buildFlatMapDict(const std::string &fileName) {
+    typedef typename MapType::key_type T1;
+    typedef typename MapType::mapped_type T2;
+    std::vector<std::pair<T1, T2> > *entries = buildVectorDict<T1, T2>(fileName);
+    if( entries == nullptr ) {
+        return nullptr;
+    }
+    MapType *dict = new MapType(std::move(*entries));
+    delete entries;
+    return dict;
+}
 
+// 与buildVectorValueTypeMapDict格式相同, MapType的mapped_type为std::vector<T2>
+template<class MapType>
+static inline MapType *buildFlatVecMapDict(const std::string &fileName) {
+    typedef typename MapType::key_type T1;
+    typedef typename MapType::mapped_type::value_type T2;
+    return toFlatDict<MapType>(buildVectorValueTypeMapDict<T1, T2>(fileName));
 }
 
-template<class T1,class T2>
-static inline std::map<T1,std::vector<T2> > *buildVectorValueTypeMapDict(const std::string &fileName) {
-    std::ifstream fin(fileName.c_str());
-    if( !fin.is_open() )
-    {
+// 与buildVectorValueTypeMapDict格式相同, 整数列表按差值+varint压缩后连续存放.
+// 每行解析完马上编码, 加载过程中不保留未压缩的列表
+template<class T1, class T2>
+static inline CompressedVecMapDict<T1, T2> *buildCompressedVecMapDict(const std::string &fileName) {
+    typedef PostingListBuilder<T1, T2> DictType;
+    DictType *builder = buildDict<DictType>(fileName, 
+            [](DictType &dict, std::string_view line, LineContext &ctx) {
+        splitView(MAP_DICT_SEP, line, ctx.fields);
+        if( ctx.fields.size() < MAP_DICT_FIELD_COUNT ) {
+            return;
+        }
+        T1 key = T1();
+        parseField(ctx.fields[MAP_DICT_KEY_INDEX], key);
+        static thread_local std::vector<T2> valueVec;
+        valueVec.clear();
+        parseList(VEC_DICT_SEP, ctx.fields[MAP_DICT_VALUE_INDEX], valueVec);
+        dict.append(key, valueVec.data(), valueVec.size());
+    }, [](DictType &result, DictType &later, int32_t) { result.append(std::move(later)); });
+    if( builder == nullptr ) {
         return nullptr;
     }
+    CompressedVecMapDict<T1, T2> *dict = new CompressedVecMapDict<T1, T2>(std::move(*builder));
+    delete builder;
+    LOG(INFO) << "new_dict_ size:" << dict->size() << " entries:" << dict->entryCount()
+        << " bytes_per_entry:" << dict->bytesPerEntry();
+    return dict;
+}
 
-    std::map<T1, std::vector<T2> > * _s_map = new std::map<T1,std::vector<T2> >();
-    std::string line;
-    while( getline(fin, line) )
-    {
-        line = strip(line);
-        if( line.empty() ) continue;
-        std::vector<std::string> fields;
-        split(MAP_DICT_SEP, line, fields);
-        if( fields.size() < MAP_DICT_FIELD_COUNT )
-        {
-            continue;
+// 把node-based的词典转换为flat容器, 转换后释放source
+template<class MapType, class SourceType>
+static inline MapType *toFlatDict(SourceType *source) {
+    if( source == nullptr ) {
+        return nullptr;
+    }
+    std::vector<typename MapType::value_type> entries;
+    entries.reserve(source->size());
+    for (auto it = source->begin(); it != source->end(); ++it) {
+        entries.emplace_back(it->first, std::move(it->second));
+    }
+    delete source;
+    return new MapType(std::move(entries));
+}
+// 二维关联map类型的dict加载, 格式与buildMapDict<T1, T2, T3>相同, 存储为CSR
+template<class T1, class T2, class T3>
+static inline CsrMapDict<T1, T2, T3> *buildCsrMapDict(const std::string &fileName) {
+    typedef std::vector<std::tuple<T1, T2, T3> > EntryList;
+    EntryList *entries = buildDict<EntryList>(fileName, 
+            [](EntryList &dict, std::string_view line, LineContext &ctx) {
+        splitView(MAP_DICT_SEP, line, ctx.fields);
+        if( ctx.fields.size() < 3 ) {
+            return;
         }
+        T1 key1 = T1();
+        T2 key2 = T2();
+        T3 value = T3();
+        parseField(ctx.fields[0], key1);
+        parseField(ctx.fields[1], key2);
+        parseField(ctx.fields[2], value);
+        dict.emplace_back(std::move(key1), std::move(key2), std::move(value));
+    }, mergeAppend<EntryList>);
+    if( entries == nullptr ) {
+        return nullptr;
+    }
+    CsrMapDict<T1, T2, T3> *dict = new CsrMapDict<T1, T2, T3>(std::move(*entries));
+    delete entries;
+    LOG(INFO) << "new_dict_ size:" << dict->size() << " entries:" << dict->entryCount(); 
+    return dict;
+}
+/*
+ * string -> T2 的dict加载, key驻留在pool中, 词典本身是只读的SortedVectorMap,
+ * 析构时只释放几块大内存. 格式和重复key的处理与buildMapDict相同
+ */
+template<class T2>
+static inline InternedDict<SortedVectorMap<std::string_view, T2> > *buildInternedMapDict(
+        const std::string &fileName) {
+    return buildInternedMapDict<T2>(fileName, std::make_shared<StringInternPool>());
+}
 
+// 多个词典传入同一个pool时, 重复出现的key只保存一份.
+// pool只增不减, 只在同一批加载的词典之间共享, 作为HotSwitchDict的NewDictFunc时每次加载用新的pool
+template<class T2>
+static inline InternedDict<SortedVectorMap<std::string_view, T2> > *buildInternedMapDict(
+        const std::string &fileName, const std::shared_ptr<StringInternPool> &pool) {
+    typedef std::vector<std::pair<std::string_view, T2> > EntryList;
+    typedef SortedVectorMap<std::string_view, T2> MapType;
+    EntryList *entries = buildDict<EntryList>(fileName, 
+            [&pool](EntryList &dict, std::string_view line, LineContext &ctx) {
+        splitView(MAP_DICT_SEP, line, ctx.fields);
+        if( ctx.fields.size() < MAP_DICT_FIELD_COUNT ) {
+            return;
+        }
+        T2 value = T2();
+        parseField(ctx.fields[MAP_DICT_VALUE_INDEX], value);
+        dict.emplace_back(pool->intern(parseToken(ctx.fields[MAP_DICT_KEY_INDEX])), value);
+    }, mergeAppend<EntryList>);
+    if( entries == nullptr ) {
+        return nullptr;
+    }
+    InternedDict<MapType> *dict = new InternedDict<MapType>(MapType(std::move(*entries)), pool);
+    delete entries;
+    return dict;
+}
 
-        std::stringstream s_key;
-        T1 key;
-        s_key << fields[MAP_DICT_KEY_INDEX];
-        s_key >> key;
-
-        std::string valueListWithComma = fields[MAP_DICT_VALUE_INDEX];
-        std::stringstream s_value(valueListWithComma);
+// 二维关联map类型的dict加载, 外层key驻留在pool中, 存储为CSR
+template<class T2, class T3>
+static inline InternedDict<CsrMapDict<std::string_view, T2, T3> > *buildInternedCsrMapDict(
+        const std::string &fileName) {
+    return buildInternedCsrMapDict<T2, T3>(fileName, std::make_shared<StringInternPool>());
+}
 
-        std::string::iterator itr = valueListWithComma.begin();
-        T2 tmp;
-        std::vector<T2> valueVec;
-        while (s_value >> tmp)
-        {
-            valueVec.push_back(tmp);
-            if (s_value.peek() == VEC_DICT_SEP)
-                s_value.ignore();
+template<class T2, class T3>
+static inline InternedDict<CsrMapDict<std::string_view, T2, T3> > *buildInternedCsrMapDict(
+        const std::string &fileName, const std::shared_ptr<StringInternPool> &pool) {
+    typedef std::vector<std::tuple<std::string_view, T2, T3> > EntryList;
+    typedef CsrMapDict<std::string_view, T2, T3> MapType;
+    EntryList *entries = buildDict<EntryList>(fileName, 
+            [&pool](EntryList &dict, std::string_view line, LineContext &ctx) {
+        splitView(MAP_DICT_SEP, line, ctx.fields);
+        if( ctx.fields.size() < 3 ) {
+            return;
         }
+        T2 key2 = T2();
+        T3 value = T3();
+        parseField(ctx.fields[1], key2);
+        parseField(ctx.fields[2], value);
+        dict.emplace_back(pool->intern(parseToken(ctx.fields[0])), key2, value);
+    }, mergeAppend<EntryList>);
+    if( entries == nullptr ) {
+        return nullptr;
+    }
+    InternedDict<MapType> *dict = new InternedDict<MapType>(MapType(std::move(*entries)), pool);
+    delete entries;
+    LOG(INFO) << "new_dict_ size:" << dict->size() << " entries:" << dict->entryCount(); 
+    return dict;
+}
+/*
+ * 容器节点分配在HugePageArena上的dict加载, build为DictType的加载函数,
+ * 加载过程中DictType的HugePageAllocator都从新建的arena分配.
+ * key/value自身再分配的内存(例如std::string的内容)仍在普通堆上
+ */
+template<class DictType>
+static inline HugePageDict<DictType> *buildHugePageDict(const std::string &fileName,
+        DictType *(*build)(const std::string &)) {
+    std::shared_ptr<HugePageArena> arena = std::make_shared<HugePageArena>();
+    DictType *source = nullptr;
+    {
+        HugePageArena::Scope scope(arena.get());
+        source = build(fileName);
+    }
+    if( source == nullptr ) {
+        return nullptr;
+    }
+    HugePageDict<DictType> *dict = new HugePageDict<DictType>(std::move(*source), arena);
+    delete source;
+    LOG(INFO) << "new_dict_ size:" << dict->size() << " huge page " << arena->report(); 
+    return dict;
+}
 
-        (*_s_map)[key] = valueVec;
+// 格式与buildMapDict相同, 可以作为HotSwitchDict<HugePageDict<HugePageMap<T1, T2> > >的NewDictFunc
+template<class T1, class T2>
+static inline HugePageDict<HugePageMap<T1, T2> > *buildHugePageMapDict(const std::string &fileName) {
+    return buildHugePageDict<HugePageMap<T1, T2> >(fileName, &buildKeyValueDict<HugePageMap<T1, T2> >);
+}
+
+/*
+ * arena不回收释放的内存, 直接在arena上加载时每次rehash换下的桶数组和并行加载的分段词典都会留在arena里.
+ * 所以先加载到普通堆上的unordered_map, 再在arena上reserve到最终大小后一次插入
+ */
+template<class T1, class T2>
+static inline HugePageDict<HugePageHashMap<T1, T2> > *buildHugePageHashMapDict(
+        const std::string &fileName) {
+    typedef HugePageHashMap<T1, T2> MapType;
+    std::unordered_map<T1, T2> *source = buildKeyValueDict<std::unordered_map<T1, T2> >(fileName);
+    if( source == nullptr ) {
+        return nullptr;
     }
-    LOG(INFO) << "new_dict_ size:" << _s_map->size(); 
-    return _s_map;
+    std::shared_ptr<HugePageArena> arena = std::make_shared<HugePageArena>();
+    MapType map(0, std::hash<T1>(), std::equal_to<T1>(), typename MapType::allocator_type(arena.get()));
+    map.reserve(source->size());
+    for( typename std::unordered_map<T1, T2>::iterator it = source->begin(); it != source->end(); ++it ) {
+        map.emplace(it->first, std::move(it->second));
+    }
+    delete source;
+    HugePageDict<MapType> *dict = new HugePageDict<MapType>(std::move(map), arena);
+    LOG(INFO) << "new_dict_ size:" << dict->size() << " huge page " << arena->report(); 
+    return dict;
 }
 }; // class Dict
 } // end namespace StemCell
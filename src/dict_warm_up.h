@@ -0,0 +1,134 @@
+/**
+ * @brief 新词典发布前的预热
+ *
+ * 新加载的词典第一次被访问时会触发缺页和cache miss, 直接切换会在切换瞬间造成p99抖动.
+ * HotSwitchDict在加载完成、切换指针之前调用这里的函数:
+ *   prefaultDict: 映射格式MADV_WILLNEED并逐页触碰, 连续内存的容器逐页触碰,
+ *                 node容器(std::map/std::unordered_map)遍历一遍所有节点
+ *   LookupSampler: 在线上读路径里抽样记录最近查询的key, 切换前在新词典上重放
+ */
+#ifndef DICT_WARM_UP_H
+#define DICT_WARM_UP_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+#include "mmap_file.h"
+#include "spinlock.h"
+
+namespace StemCell {
+
+template<class T, class = void>
+struct HasPrefault : std::false_type {};
+
+template<class T>
+struct HasPrefault<T, decltype(std::declval<const T&>().prefault(), void())> : std::true_type {};
+
+template<class T, class = void>
+struct IsIterableDict : std::false_type {};
+
+template<class T>
+struct IsIterableDict<T, decltype(std::declval<const T&>().begin(),
+        std::declval<const T&>().end(), void())> : std::true_type {};
+
+template<class DictType>
+inline size_t prefaultNodes(const DictType &dict, std::true_type /* iterable */) {
+    size_t count = 0;
+    volatile char sink = 0;
+    for (auto it = dict.begin(); it != dict.end(); ++it) {
+        sink = sink + *reinterpret_cast<const volatile char*>(&*it);
+        ++count;
+    }
+    (void)sink;
+    return count;
+}
+
+template<class DictType>
+inline size_t prefaultNodes(const DictType &, std::false_type) {
+    return 0;
+}
+
+template<class DictType>
+inline size_t prefaultDict(const DictType &dict, std::true_type /* has prefault */) {
+    return dict.prefault();
+}
+
+template<class DictType>
+inline size_t prefaultDict(const DictType &dict, std::false_type) {
+    return prefaultNodes(dict, IsIterableDict<DictType>());
+}
+
+/**
+ * @brief 预热整个词典
+ * @return 有prefault()的词典返回触碰的页数, 可遍历的容器返回遍历的元素个数, 其他返回0
+ */
+template<class DictType>
+inline size_t prefaultDict(const DictType &dict) {
+    return prefaultDict(dict, HasPrefault<DictType>());
+}
+
+/**
+ * @brief 抽样记录最近查询的key, 保存在固定大小的环形缓冲区里
+ * 每sampleRate次查询记录一次, 计数用线程局部变量, 未命中抽样时读路径没有共享写
+ */
+template<class KeyType>
+class LookupSampler {
+public:
+    explicit LookupSampler(size_t capacity = 4096, uint32_t sampleRate = 64)
+        : _keys(capacity == 0 ? 1 : capacity), _next(0), _filled(0),
+          _sampleRate(sampleRate == 0 ? 1 : sampleRate) {}
+
+    LookupSampler(const LookupSampler&) = delete;
+    LookupSampler& operator=(const LookupSampler&) = delete;
+
+    void record(const KeyType &key) {
+        static thread_local uint32_t counter = 0;
+        if (++counter < _sampleRate) {
+            return;
+        }
+        counter = 0;
+        std::lock_guard<Spinlock> locker(_lock);
+        _keys[_next] = key;
+        _next = (_next + 1) % _keys.size();
+        if (_filled < _keys.size()) {
+            ++_filled;
+        }
+    }
+
+    std::vector<KeyType> snapshot() const {
+        std::lock_guard<Spinlock> locker(_lock);
+        return std::vector<KeyType>(_keys.begin(), _keys.begin() + _filled);
+    }
+
+    /**
+     * @brief 在dict上重放抽样的key
+     * @return 命中的个数
+     */
+    template<class DictType>
+    size_t replay(const DictType &dict) const {
+        std::vector<KeyType> keys = snapshot();
+        size_t hits = 0;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            hits += dict.count(keys[i]);
+        }
+        return hits;
+    }
+
+    size_t size() const {
+        std::lock_guard<Spinlock> locker(_lock);
+        return _filled;
+    }
+
+private:
+    std::vector<KeyType> _keys;
+    size_t _next;
+    size_t _filled;
+    uint32_t _sampleRate;
+    mutable Spinlock _lock;
+};
+
+} // end namespace StemCell
+#endif
@@ -0,0 +1,262 @@
+/**
+ * @brief 基于epoch的延迟回收(EBR)
+ *
+ * 读者pin时把全局epoch写入自己独占cache line的slot, unpin时清零, 读路径上没有共享写.
+ * 写者替换指针后retire旧对象并推进全局epoch; 只有当所有正在pin的读者的epoch
+ * 都大于旧对象retire时的epoch, 也就是所有可能看到旧指针的读者都已离开后, 旧对象才被释放.
+ * 前EPOCH_MAX_THREADS个线程用预先分配的slot, 更多的线程用按需分配、只增不减的溢出slot,
+ * 线程退出时slot归还, 读路径不会因为线程太多而失败.
+ * retire时可以带一个owner, 用synchronize(owner)只等待某个owner的对象, 例如一个词典自己的旧版本.
+ */
+#ifndef EPOCH_RECLAIMER_H
+#define EPOCH_RECLAIMER_H
+
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <stdexcept>
+#include <cstdint>
+#include <unistd.h>
+
+namespace StemCell {
+
+#define EPOCH_MAX_THREADS 1024
+
+class EpochDomain {
+public:
+    // 进程内共享的默认domain
+    static EpochDomain &instance() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    EpochDomain() : _globalEpoch(1), _overflow(nullptr) {}
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    ~EpochDomain() {
+        // nobody can be pinned any more, run the pending deleters
+        for (size_t i = 0; i < _retired.size(); ++i) {
+            _retired[i].deleter();
+        }
+        Slot *slot = _overflow.load();
+        while (slot != nullptr) {
+            Slot *next = slot->next;
+            delete slot;
+            slot = next;
+        }
+    }
+
+    // 可以嵌套, 只有最外层的pin/unpin会修改slot
+    void pin() {
+        Slot *slot = threadSlot();
+        if (slot->depth++ == 0) {
+            slot->epoch.store(_globalEpoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        }
+    }
+
+    void unpin() {
+        Slot *slot = threadSlot();
+        if (--slot->depth == 0) {
+            slot->epoch.store(0, std::memory_order_release);
+        }
+    }
+
+    // 调用线程是否正pin着这个domain
+    bool pinned() const {
+        const SlotHolder &holder = threadHolder();
+        return holder.domain == this && holder.slot->depth > 0;
+    }
+
+    /**
+     * @brief 登记一个已经从共享指针上摘下的对象, 等所有读者离开后调用deleter
+     * @param owner 用于synchronize(owner)只等待自己的对象, 不会被解引用
+     */
+    void retire(std::function<void()> deleter, const void *owner = nullptr) {
+        uint64_t epoch = _globalEpoch.fetch_add(1, std::memory_order_seq_cst);
+        std::lock_guard<std::mutex> locker(_lock);
+        _retired.push_back(Retired(epoch, owner, std::move(deleter)));
+    }
+
+    template<class T>
+    void retire(T *ptr, const void *owner = nullptr) {
+        if (ptr != nullptr) {
+            retire([ptr]() { delete ptr; }, owner);
+        }
+    }
+
+    /**
+     * @brief 释放所有已经没有读者的对象
+     * @return 释放的个数
+     */
+    size_t tryReclaim() {
+        std::vector<Retired> ready;
+        {
+            std::lock_guard<std::mutex> locker(_lock);
+            if (_retired.empty()) {
+                return 0;
+            }
+            uint64_t minEpoch = minActiveEpoch();
+            size_t kept = 0;
+            for (size_t i = 0; i < _retired.size(); ++i) {
+                if (_retired[i].epoch < minEpoch) {
+                    ready.push_back(std::move(_retired[i]));
+                } else {
+                    _retired[kept++] = std::move(_retired[i]);
+                }
+            }
+            _retired.resize(kept);
+        }
+        // deleters run outside the lock, destroying a big dict takes a while
+        for (size_t i = 0; i < ready.size(); ++i) {
+            ready[i].deleter();
+        }
+        return ready.size();
+    }
+
+    /**
+     * @brief 阻塞直到owner的所有已retire对象都被释放, owner为nullptr时等待所有对象
+     * 调用线程自己pin着时, 它pin之后retire的对象要等它unpin才能释放, 等下去会死锁,
+     * 这时只回收一次就返回, 剩下的对象留给之后的tryReclaim或domain析构
+     * @return 对象都已释放返回true
+     */
+    bool synchronize(const void *owner = nullptr) {
+        bool self = pinned();
+        while (pendingCount(owner) > 0) {
+            if (tryReclaim() == 0) {
+                if (self) {
+                    return pendingCount(owner) == 0;
+                }
+                usleep(1000);
+            }
+        }
+        return true;
+    }
+
+    // owner为nullptr时为所有待释放对象的个数
+    size_t pendingCount(const void *owner = nullptr) {
+        std::lock_guard<std::mutex> locker(_lock);
+        if (owner == nullptr) {
+            return _retired.size();
+        }
+        size_t count = 0;
+        for (size_t i = 0; i < _retired.size(); ++i) {
+            count += _retired[i].owner == owner;
+        }
+        return count;
+    }
+
+private:
+    struct alignas(64) Slot {
+        Slot() : epoch(0), used(false), depth(0), next(nullptr) {}
+        std::atomic<uint64_t> epoch;    // 0 means not pinned
+        std::atomic<bool> used;
+        uint32_t depth;                 // only touched by the owner thread
+        Slot *next;                     // overflow list link, immutable once published
+    };
+
+    struct Retired {
+        Retired() : epoch(0), owner(nullptr) {}
+        Retired(uint64_t epoch, const void *owner, std::function<void()> &&deleter)
+            : epoch(epoch), owner(owner), deleter(std::move(deleter)) {}
+        uint64_t epoch;
+        const void *owner;
+        std::function<void()> deleter;
+    };
+
+    // releases the slot when the owner thread exits
+    struct SlotHolder {
+        SlotHolder() : domain(nullptr), slot(nullptr) {}
+        ~SlotHolder() {
+            if (slot != nullptr) {
+                slot->epoch.store(0, std::memory_order_release);
+                slot->used.store(false, std::memory_order_release);
+            }
+        }
+        EpochDomain *domain;
+        Slot *slot;
+    };
+
+    static SlotHolder &threadHolder() {
+        static thread_local SlotHolder holder;
+        return holder;
+    }
+
+    static bool claim(Slot *slot) {
+        bool expected = false;
+        return !slot->used.load(std::memory_order_relaxed)
+            && slot->used.compare_exchange_strong(expected, true);
+    }
+
+    Slot *threadSlot() {
+        SlotHolder &holder = threadHolder();
+        if (holder.domain == this) {
+            return holder.slot;
+        }
+        if (holder.slot != nullptr) {
+            throw std::runtime_error("a thread can only use one EpochDomain");
+        }
+        Slot *slot = nullptr;
+        for (int i = 0; i < EPOCH_MAX_THREADS && slot == nullptr; ++i) {
+            if (claim(&_slots[i])) {
+                slot = &_slots[i];
+            }
+        }
+        // all fixed slots are taken, reuse a free overflow slot or add one
+        for (Slot *s = _overflow.load(std::memory_order_acquire); s != nullptr && slot == nullptr; s = s->next) {
+            if (claim(s)) {
+                slot = s;
+            }
+        }
+        if (slot == nullptr) {
+            slot = new Slot();
+            slot->used.store(true, std::memory_order_relaxed);
+            slot->next = _overflow.load(std::memory_order_relaxed);
+            while (!_overflow.compare_exchange_weak(slot->next, slot,
+                        std::memory_order_seq_cst, std::memory_order_relaxed)) {}
+        }
+        slot->depth = 0;
+        holder.domain = this;
+        holder.slot = slot;
+        return slot;
+    }
+
+    uint64_t minActiveEpoch() {
+        uint64_t minEpoch = UINT64_MAX;
+        for (int i = 0; i < EPOCH_MAX_THREADS; ++i) {
+            uint64_t epoch = _slots[i].epoch.load(std::memory_order_seq_cst);
+            if (epoch != 0 && epoch < minEpoch) {
+                minEpoch = epoch;
+            }
+        }
+        for (Slot *s = _overflow.load(std::memory_order_seq_cst); s != nullptr; s = s->next) {
+            uint64_t epoch = s->epoch.load(std::memory_order_seq_cst);
+            if (epoch != 0 && epoch < minEpoch) {
+                minEpoch = epoch;
+            }
+        }
+        return minEpoch;
+    }
+
+    std::atomic<uint64_t> _globalEpoch;
+    Slot _slots[EPOCH_MAX_THREADS];
+    std::atomic<Slot*> _overflow;
+    std::mutex _lock;
+    std::vector<Retired> _retired;
+};
+
+/**
+ * @brief RAII方式pin住默认domain
+ */
+class EpochGuard {
+public:
+    EpochGuard() { EpochDomain::instance().pin(); }
+    ~EpochGuard() { EpochDomain::instance().unpin(); }
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+} // end namespace StemCell
+#endif
@@ -0,0 +1,228 @@
+#ifndef FLAT_HASH_MAP_HPP
+#define FLAT_HASH_MAP_HPP
+
+#include <vector>
+#include <utility>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include "mmap_file.h"
+#include "batch_lookup.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace StemCell {
+
+/**
+ * @brief 只读的开放寻址hash map, 加载时一次性构建, 之后只做查找
+ *
+ * 与SwissTable相同的思路: 每个slot对应一个控制字节, 空slot为CTRL_EMPTY,
+ * 否则保存hash的低7位. 16个控制字节为一组, 查找时用SSE2一次比较一整组,
+ * 只有控制字节匹配的slot才去比较key. 没有SSE2时退化为逐字节比较.
+ * 接口与std::unordered_map的只读部分保持一致(find/count/at/begin/end/size).
+ */
+template<class K, class V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K> >
+class FlatHashMap {
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<K, V> value_type;
+
+    enum { GROUP_SIZE = 16 };
+    static constexpr int8_t CTRL_EMPTY = -128;
+
+    class const_iterator {
+    public:
+        const_iterator() : _map(nullptr), _index(0) {}
+        const_iterator(const FlatHashMap *map, size_t index) : _map(map), _index(index) {
+            skipEmpty();
+        }
+        const value_type &operator*() const { return _map->_slots[_index]; }
+        const value_type *operator->() const { return &_map->_slots[_index]; }
+        const_iterator &operator++() {
+            ++_index;
+            skipEmpty();
+            return *this;
+        }
+        bool operator==(const const_iterator &other) const { return _index == other._index; }
+        bool operator!=(const const_iterator &other) const { return _index != other._index; }
+
+    private:
+        void skipEmpty() {
+            while (_index < _map->_ctrl.size() && _map->_ctrl[_index] == CTRL_EMPTY) {
+                ++_index;
+            }
+        }
+        const FlatHashMap *_map;
+        size_t _index;
+    };
+    typedef const_iterator iterator;
+
+    FlatHashMap() : _groupMask(0), _size(0) {}
+
+    // 重复的key以后出现的为准
+    explicit FlatHashMap(std::vector<value_type> &&entries) : _groupMask(0), _size(0) {
+        build(std::move(entries));
+    }
+
+    void build(std::vector<value_type> &&entries) {
+        // keep the load factor at or below 7/8
+        size_t capacity = GROUP_SIZE;
+        while (capacity * 7 / 8 < entries.size()) {
+            capacity *= 2;
+        }
+        _ctrl.assign(capacity, CTRL_EMPTY);
+        _slots.clear();
+        _slots.resize(capacity);
+        _groupMask = capacity / GROUP_SIZE - 1;
+        _size = 0;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            insert(std::move(entries[i]));
+        }
+        entries.clear();
+        entries.shrink_to_fit();
+    }
+
+    const_iterator find(const K &key) const {
+        size_t index = findIndex(key, hashOf(key));
+        return index == NPOS ? end() : const_iterator(this, index);
+    }
+
+    size_t count(const K &key) const { return findIndex(key, hashOf(key)) == NPOS ? 0 : 1; }
+
+    /**
+     * @brief 批量查找, out[i]为keys[i]对应的value, 不存在时为nullptr
+     * 先为一组key计算hash并预取第一个控制字节组和对应的slot, 再逐个探测
+     */
+    void lookupBatch(const K *keys, size_t n, const V **out) const {
+        if (_size == 0) {
+            for (size_t i = 0; i < n; ++i) {
+                out[i] = nullptr;
+            }
+            return;
+        }
+        uint64_t hashes[LOOKUP_BATCH_BLOCK];
+        for (size_t begin = 0; begin < n; begin += LOOKUP_BATCH_BLOCK) {
+            size_t count = std::min<size_t>(LOOKUP_BATCH_BLOCK, n - begin);
+            for (size_t j = 0; j < count; ++j) {
+                hashes[j] = hashOf(keys[begin + j]);
+                size_t group = firstGroup(hashes[j]);
+                prefetchRead(_ctrl.data() + group * GROUP_SIZE);
+                prefetchRead(_slots.data() + group * GROUP_SIZE);
+            }
+            for (size_t j = 0; j < count; ++j) {
+                size_t index = findIndex(keys[begin + j], hashes[j]);
+                out[begin + j] = index == NPOS ? nullptr : &_slots[index].second;
+            }
+        }
+    }
+
+    const V &at(const K &key) const {
+        size_t index = findIndex(key, hashOf(key));
+        if (index == NPOS) {
+            throw std::out_of_range("FlatHashMap::at");
+        }
+        return _slots[index].second;
+    }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, _ctrl.size()); }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    // 容器自身占用的字节数, 不含key/value内部再分配的内存
+    size_t memoryBytes() const {
+        return _ctrl.capacity() + _slots.capacity() * sizeof(value_type);
+    }
+
+    // 切换前预热, 返回触碰的页数
+    size_t prefault() const {
+        return prefaultMemory(_ctrl.data(), _ctrl.size())
+            + prefaultMemory(_slots.data(), _slots.size() * sizeof(value_type));
+    }
+
+private:
+    static constexpr size_t NPOS = static_cast<size_t>(-1);
+
+    // std::hash of integers is the identity, mix it so both h1 and h2 get entropy
+    static uint64_t hashOf(const K &key) {
+        uint64_t h = static_cast<uint64_t>(Hash()(key));
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static int8_t h2(uint64_t hash) { return static_cast<int8_t>(hash & 0x7f); }
+    size_t firstGroup(uint64_t hash) const { return (hash >> 7) & _groupMask; }
+
+    static uint32_t matchMask(const int8_t *group, int8_t value) {
+#if defined(__SSE2__)
+        __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(value), ctrl)));
+#else
+        uint32_t mask = 0;
+        for (int i = 0; i < GROUP_SIZE; ++i) {
+            mask |= static_cast<uint32_t>(group[i] == value) << i;
+        }
+        return mask;
+#endif
+    }
+
+    size_t findIndex(const K &key, uint64_t hash) const {
+        if (_size == 0) {
+            return NPOS;
+        }
+        KeyEqual equal;
+        const int8_t tag = h2(hash);
+        size_t group = firstGroup(hash);
+        // triangular probing visits every group once for power-of-two group counts
+        for (size_t step = 1; step <= _groupMask + 1; ++step) {
+            const int8_t *ctrl = _ctrl.data() + group * GROUP_SIZE;
+            for (uint32_t mask = matchMask(ctrl, tag); mask != 0; mask &= mask - 1) {
+                size_t index = group * GROUP_SIZE + __builtin_ctz(mask);
+                if (equal(_slots[index].first, key)) {
+                    return index;
+                }
+            }
+            if (matchMask(ctrl, CTRL_EMPTY) != 0) {
+                return NPOS;
+            }
+            group = (group + step) & _groupMask;
+        }
+        return NPOS;
+    }
+
+    void insert(value_type &&entry) {
+        uint64_t hash = hashOf(entry.first);
+        size_t index = findIndex(entry.first, hash);
+        if (index != NPOS) {
+            _slots[index].second = std::move(entry.second);
+            return;
+        }
+        size_t group = firstGroup(hash);
+        for (size_t step = 1; ; ++step) {
+            uint32_t mask = matchMask(_ctrl.data() + group * GROUP_SIZE, CTRL_EMPTY);
+            if (mask != 0) {
+                index = group * GROUP_SIZE + __builtin_ctz(mask);
+                break;
+            }
+            group = (group + step) & _groupMask;
+        }
+        _ctrl[index] = h2(hash);
+        _slots[index] = std::move(entry);
+        ++_size;
+    }
+
+    std::vector<int8_t> _ctrl;
+    std::vector<value_type> _slots;
+    size_t _groupMask;
+    size_t _size;
+};
+
+} // end namespace StemCell
+#endif
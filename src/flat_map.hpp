@@ -0,0 +1,195 @@
+#ifndef FLAT_MAP_HPP
+#define FLAT_MAP_HPP
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <cstdint>
+#include "mmap_file.h"
+#include "batch_lookup.h"
+
+namespace StemCell {
+
+/**
+ * @brief 只读的有序vector map, 加载时一次性构建, 之后只做查找
+ *
+ * 数据连续存放在一个vector里, 没有红黑树节点的指针开销. 查找默认用无分支的
+ * 二分查找; 构建时打开eytzinger后, 额外保存一份按Eytzinger(BFS)顺序排列的key,
+ * 查找时前几层总在同一批cache line上, 并且可以提前prefetch后面的层.
+ * 接口与std::map的只读部分保持一致(find/count/at/begin/end/size).
+ */
+template<class K, class V, class Compare = std::less<K> >
+class SortedVectorMap {
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<K, V> value_type;
+    typedef const value_type* const_iterator;
+    typedef const_iterator iterator;
+
+    SortedVectorMap() : _eytzinger(false) {}
+
+    /**
+     * @brief 从任意顺序的entries构建, 重复的key以后出现的为准
+     * @param eytzinger 是否额外构建Eytzinger布局
+     */
+    explicit SortedVectorMap(std::vector<value_type> &&entries, bool eytzinger = false)
+        : _eytzinger(false) {
+        build(std::move(entries), eytzinger);
+    }
+
+    void build(std::vector<value_type> &&entries, bool eytzinger = false) {
+        Compare comp;
+        std::stable_sort(entries.begin(), entries.end(),
+                [&comp](const value_type &a, const value_type &b) {
+                    return comp(a.first, b.first);
+                });
+        // stable_sort keeps duplicated keys in input order, keep the last one
+        _entries.clear();
+        _entries.reserve(entries.size());
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (i + 1 < entries.size() && !comp(entries[i].first, entries[i + 1].first)) {
+                continue;
+            }
+            _entries.push_back(std::move(entries[i]));
+        }
+        entries.clear();
+        entries.shrink_to_fit();
+        _entries.shrink_to_fit();
+        _eytzinger = eytzinger;
+        _eytzingerKeys.clear();
+        _eytzingerRank.clear();
+        if (_eytzinger) {
+            buildEytzinger();
+        }
+    }
+
+    const_iterator find(const K &key) const {
+        const_iterator it = lower_bound(key);
+        if (it == end() || Compare()(key, it->first)) {
+            return end();
+        }
+        return it;
+    }
+
+    const_iterator lower_bound(const K &key) const {
+        if (_entries.empty()) {
+            return end();
+        }
+        if (_eytzinger) {
+            return begin() + eytzingerLowerBound(key);
+        }
+        // branchless binary search, the loop count only depends on size()
+        Compare comp;
+        const value_type *base = _entries.data();
+        size_t n = _entries.size();
+        while (n > 1) {
+            size_t half = n / 2;
+            base = comp(base[half - 1].first, key) ? base + half : base;
+            n -= half;
+        }
+        return base + (comp(base->first, key) ? 1 : 0);
+    }
+
+    size_t count(const K &key) const { return find(key) != end() ? 1 : 0; }
+
+    /**
+     * @brief 批量查找, out[i]为keys[i]对应的value, 不存在时为nullptr
+     * 组内的二分查找同步推进并预取下一轮的比较位置
+     */
+    void lookupBatch(const K *keys, size_t n, const V **out) const {
+        if (_eytzinger) {
+            // the eytzinger search already prefetches its own descendants
+            for (size_t i = 0; i < n; ++i) {
+                const_iterator it = find(keys[i]);
+                out[i] = it == end() ? nullptr : &it->second;
+            }
+            return;
+        }
+        Compare comp;
+        const value_type *entries = _entries.data();
+        size_t pos[LOOKUP_BATCH_BLOCK];
+        for (size_t begin = 0; begin < n; begin += LOOKUP_BATCH_BLOCK) {
+            size_t count = std::min<size_t>(LOOKUP_BATCH_BLOCK, n - begin);
+            batchLowerBound(_entries.size(), keys + begin, count, pos,
+                    [entries, &comp](size_t i, const K &key) { return comp(entries[i].first, key); },
+                    [entries](size_t i) { prefetchRead(entries + i); });
+            for (size_t j = 0; j < count; ++j) {
+                out[begin + j] = pos[j] == _entries.size() || comp(keys[begin + j], entries[pos[j]].first)
+                    ? nullptr : &entries[pos[j]].second;
+            }
+        }
+    }
+
+    const V &at(const K &key) const {
+        const_iterator it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("SortedVectorMap::at");
+        }
+        return it->second;
+    }
+
+    const_iterator begin() const { return _entries.data(); }
+    const_iterator end() const { return _entries.data() + _entries.size(); }
+    size_t size() const { return _entries.size(); }
+    bool empty() const { return _entries.empty(); }
+
+    // 容器自身占用的字节数, 不含key/value内部再分配的内存
+    size_t memoryBytes() const {
+        return _entries.capacity() * sizeof(value_type)
+            + _eytzingerKeys.capacity() * sizeof(K)
+            + _eytzingerRank.capacity() * sizeof(uint32_t);
+    }
+
+    // 切换前预热, 返回触碰的页数
+    size_t prefault() const {
+        return prefaultMemory(_entries.data(), _entries.size() * sizeof(value_type))
+            + prefaultMemory(_eytzingerKeys.data(), _eytzingerKeys.size() * sizeof(K))
+            + prefaultMemory(_eytzingerRank.data(), _eytzingerRank.size() * sizeof(uint32_t));
+    }
+
+private:
+    void buildEytzinger() {
+        _eytzingerKeys.resize(_entries.size() + 1);
+        _eytzingerRank.resize(_entries.size() + 1);
+        size_t i = 0;
+        fillEytzinger(i, 1);
+    }
+
+    // in-order traversal of the implicit tree assigns sorted entries to BFS slots
+    void fillEytzinger(size_t &i, size_t k) {
+        if (k > _entries.size()) {
+            return;
+        }
+        fillEytzinger(i, 2 * k);
+        _eytzingerKeys[k] = _entries[i].first;
+        _eytzingerRank[k] = static_cast<uint32_t>(i);
+        ++i;
+        fillEytzinger(i, 2 * k + 1);
+    }
+
+    size_t eytzingerLowerBound(const K &key) const {
+        Compare comp;
+        const size_t n = _entries.size();
+        const K *keys = _eytzingerKeys.data();
+        size_t k = 1;
+        while (k <= n) {
+            // the descendants four levels down share one or two cache lines
+            __builtin_prefetch(keys + std::min(16 * k, n));
+            k = 2 * k + (comp(keys[k], key) ? 1 : 0);
+        }
+        // drop the trailing right turns plus the last left turn
+        k >>= __builtin_ffsll(~static_cast<long long>(k));
+        return k == 0 ? n : _eytzingerRank[k];
+    }
+
+    std::vector<value_type> _entries;
+    bool _eytzinger;
+    std::vector<K> _eytzingerKeys;      // 1-based, slot 0 unused
+    std::vector<uint32_t> _eytzingerRank;
+};
+
+} // end namespace StemCell
+#endif
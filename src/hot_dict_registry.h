@@ -0,0 +1,339 @@
+/**
+ * @brief 所有热加载词典共享的监控线程
+ *
+ * 一个线程用inotify监听所有flag文件所在的目录, flag文件被写完(IN_CLOSE_WRITE)
+ * 或被rename进目录(IN_MOVED_TO)时, 把对应词典的检查任务交给有界的加载线程池.
+ * inotify可能丢事件(队列溢出、网络文件系统), 所以每隔fallbackSeconds还会把所有词典检查一遍.
+ * 同一个词典的检查任务串行执行, 检查过程中再来的事件会在本次结束后补一次检查.
+ * 有旧词典等待释放时监控线程每秒回收一次, 读者离开后旧词典很快就会释放.
+ * 监控线程在第一次watch时启动, 也可以提前调用start.
+ */
+#ifndef HOT_DICT_REGISTRY_H
+#define HOT_DICT_REGISTRY_H
+
+#include <string>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <utils/vlog/loghelper.h>
+#include "ThreadPool.h"
+#include "epoch_reclaimer.h"
+
+namespace StemCell {
+
+#define HOT_DICT_REGISTRY_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB)
+
+class HotDictRegistry {
+public:
+    typedef std::function<void()> CheckFunc;
+
+    /**
+     * @param loaderThreads 同时加载词典的线程数
+     * @param fallbackSeconds 不依赖inotify的全量检查间隔
+     */
+    explicit HotDictRegistry(size_t loaderThreads = 2, uint32_t fallbackSeconds = 60)
+        : _fallbackSeconds(fallbackSeconds == 0 ? 1 : fallbackSeconds),
+          _inotifyFd(-1), _wakeFd(-1), _started(false), _stop(false), _nextId(0),
+          _loaders(loaderThreads == 0 ? 1 : loaderThreads) {}
+
+    HotDictRegistry(const HotDictRegistry&) = delete;
+    HotDictRegistry& operator=(const HotDictRegistry&) = delete;
+
+    // 所有词典需要在registry析构之前unwatch
+    ~HotDictRegistry() {
+        stop();
+    }
+
+    bool start() {
+        std::lock_guard<std::mutex> locker(_lock);
+        if (_started) {
+            return true;
+        }
+        _inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (_inotifyFd < 0 || _wakeFd < 0) {
+            VLOG_APP(ERROR) << "HotDictRegistry init inotify failed: " << strerror(errno);
+            closeFds();
+            return false;
+        }
+        // watches registered before start
+        for (auto it = _watches.begin(); it != _watches.end(); ++it) {
+            addDirWatch(*it->second);
+        }
+        _stop = false;
+        _thread = std::thread(&HotDictRegistry::run, this);
+        _started = true;
+        return true;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> locker(_lock);
+            if (!_started) {
+                return;
+            }
+            _stop = true;
+        }
+        wake();
+        _thread.join();
+        std::lock_guard<std::mutex> locker(_lock);
+        closeFds();
+        _dirs.clear();
+        _started = false;
+    }
+
+    /**
+     * @brief 注册一个flag文件, 注册后立即检查一次
+     * 监控线程还没有启动时在这里启动, 调用方不需要先调用start
+     * @return watch id, 用于unwatch
+     */
+    int64_t watch(const std::string &flagFile, const CheckFunc &check) {
+        if (!start()) {
+            VLOG_APP(ERROR) << "HotDictRegistry not started, " << flagFile << " will only be checked once";
+        }
+        std::shared_ptr<Watch> w = std::make_shared<Watch>();
+        w->flagFile = flagFile;
+        size_t slash = flagFile.rfind('/');
+        w->dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : flagFile.substr(0, slash));
+        w->name = slash == std::string::npos ? flagFile : flagFile.substr(slash + 1);
+        w->check = check;
+        std::lock_guard<std::mutex> locker(_lock);
+        w->id = _nextId++;
+        _watches[w->id] = w;
+        if (_started) {
+            addDirWatch(*w);
+        }
+        schedule(w);
+        return w->id;
+    }
+
+    /**
+     * @brief 取消注册, 等待正在执行的检查结束后返回
+     * 不能在检查函数里调用
+     */
+    void unwatch(int64_t id) {
+        std::unique_lock<std::mutex> locker(_lock);
+        auto it = _watches.find(id);
+        if (it == _watches.end()) {
+            return;
+        }
+        std::shared_ptr<Watch> w = it->second;
+        _watches.erase(it);
+        w->removed = true;
+        removeDirWatch(*w);
+        _idle.wait(locker, [&w]() { return !w->running && !w->queued; });
+    }
+
+    size_t watchCount() {
+        std::lock_guard<std::mutex> locker(_lock);
+        return _watches.size();
+    }
+
+private:
+    struct Watch {
+        Watch() : id(-1), queued(false), running(false), dirty(false), removed(false) {}
+        int64_t id;
+        std::string flagFile;
+        std::string dir;
+        std::string name;
+        CheckFunc check;
+        bool queued;    // a check task is waiting in the loader pool
+        bool running;
+        bool dirty;     // triggered again while running
+        bool removed;
+    };
+
+    struct DirWatch {
+        DirWatch() : wd(-1), refs(0) {}
+        int wd;
+        int refs;
+    };
+
+    // 调用方持有_lock
+    void schedule(const std::shared_ptr<Watch> &w) {
+        if (w->removed) {
+            return;
+        }
+        if (w->running) {
+            w->dirty = true;
+            return;
+        }
+        if (w->queued) {
+            return;
+        }
+        w->queued = true;
+        _loaders.enqueue([this, w]() { runCheck(w); });
+    }
+
+    void runCheck(const std::shared_ptr<Watch> &w) {
+        {
+            std::lock_guard<std::mutex> locker(_lock);
+            w->queued = false;
+            if (w->removed) {
+                _idle.notify_all();
+                return;
+            }
+            w->running = true;
+        }
+        w->check();
+        bool retired = EpochDomain::instance().pendingCount() > 0;
+        std::lock_guard<std::mutex> locker(_lock);
+        w->running = false;
+        if (retired) {
+            // wake the monitor thread to start the 1s reclaim polling
+            wake();
+        }
+        if (w->dirty) {
+            w->dirty = false;
+            schedule(w);
+        }
+        _idle.notify_all();
+    }
+
+    // 调用方持有_lock
+    void addDirWatch(const Watch &w) {
+        DirWatch &dir = _dirs[w.dir];
+        if (dir.refs++ > 0) {
+            return;
+        }
+        dir.wd = inotify_add_watch(_inotifyFd, w.dir.c_str(), HOT_DICT_REGISTRY_EVENTS);
+        if (dir.wd < 0) {
+            VLOG_APP(WARNING) << "HotDictRegistry can not watch " << w.dir << ": "
+                << strerror(errno) << ", rely on periodic check";
+        }
+    }
+
+    // 调用方持有_lock
+    void removeDirWatch(const Watch &w) {
+        auto it = _dirs.find(w.dir);
+        if (it == _dirs.end()) {
+            return;
+        }
+        if (--it->second.refs == 0) {
+            if (it->second.wd >= 0 && _inotifyFd >= 0) {
+                inotify_rm_watch(_inotifyFd, it->second.wd);
+            }
+            _dirs.erase(it);
+        }
+    }
+
+    // 调用方持有_lock
+    void wake() {
+        if (_wakeFd < 0) {
+            return;
+        }
+        uint64_t one = 1;
+        ssize_t ret = write(_wakeFd, &one, sizeof(one));
+        (void)ret;
+    }
+
+    void run() {
+        alignas(struct inotify_event) char buf[4096];
+        struct pollfd fds[2];
+        fds[0].fd = _inotifyFd;
+        fds[0].events = POLLIN;
+        fds[1].fd = _wakeFd;
+        fds[1].events = POLLIN;
+        std::chrono::steady_clock::time_point nextScan =
+            std::chrono::steady_clock::now() + std::chrono::seconds(_fallbackSeconds);
+        for (;;) {
+            int64_t timeoutMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    nextScan - std::chrono::steady_clock::now()).count();
+            if (EpochDomain::instance().pendingCount() > 0) {
+                // poll every second until the readers of the retired dicts leave
+                timeoutMs = std::min<int64_t>(timeoutMs, 1000);
+            }
+            int ready = poll(fds, 2, static_cast<int>(std::max<int64_t>(timeoutMs, 0)));
+            if (ready > 0 && (fds[1].revents & POLLIN)) {
+                uint64_t count;
+                ssize_t ret = read(_wakeFd, &count, sizeof(count));
+                (void)ret;
+            }
+            // old dicts retired by the checks are freed outside of _lock
+            EpochDomain::instance().tryReclaim();
+            std::lock_guard<std::mutex> locker(_lock);
+            if (_stop) {
+                return;
+            }
+            if (std::chrono::steady_clock::now() >= nextScan) {
+                // check everything in case an event was lost
+                nextScan = std::chrono::steady_clock::now() + std::chrono::seconds(_fallbackSeconds);
+                for (auto it = _watches.begin(); it != _watches.end(); ++it) {
+                    schedule(it->second);
+                }
+                continue;
+            }
+            if (ready <= 0 || !(fds[0].revents & POLLIN)) {
+                continue;
+            }
+            ssize_t len;
+            while ((len = read(_inotifyFd, buf, sizeof(buf))) > 0) {
+                for (char *p = buf; p < buf + len; ) {
+                    const struct inotify_event *event = reinterpret_cast<const struct inotify_event*>(p);
+                    dispatch(*event);
+                    p += sizeof(struct inotify_event) + event->len;
+                }
+            }
+        }
+    }
+
+    // 调用方持有_lock
+    void dispatch(const struct inotify_event &event) {
+        if (event.mask & IN_Q_OVERFLOW) {
+            for (auto it = _watches.begin(); it != _watches.end(); ++it) {
+                schedule(it->second);
+            }
+            return;
+        }
+        if (event.len == 0) {
+            return;
+        }
+        for (auto it = _watches.begin(); it != _watches.end(); ++it) {
+            const Watch &w = *it->second;
+            auto dir = _dirs.find(w.dir);
+            if (dir != _dirs.end() && dir->second.wd == event.wd && w.name == event.name) {
+                VLOG(1) << "HotDictRegistry flag file changed: " << w.flagFile;
+                schedule(it->second);
+            }
+        }
+    }
+
+    void closeFds() {
+        if (_inotifyFd >= 0) {
+            close(_inotifyFd);
+            _inotifyFd = -1;
+        }
+        if (_wakeFd >= 0) {
+            close(_wakeFd);
+            _wakeFd = -1;
+        }
+    }
+
+    uint32_t _fallbackSeconds;
+    int _inotifyFd;
+    int _wakeFd;
+    bool _started;
+    bool _stop;
+    int64_t _nextId;
+    std::thread _thread;
+    std::mutex _lock;
+    std::condition_variable _idle;
+    std::map<int64_t, std::shared_ptr<Watch> > _watches;
+    std::map<std::string, DirWatch> _dirs;
+    // declared last so pending checks finish before the other members go away
+    ThreadPool _loaders;
+};
+
+} // end namespace StemCell
+#endif
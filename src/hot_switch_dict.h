@@ -10,7 +10,19 @@
 #include <sys/stat.h>
 #include <iostream>
 #include <time.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include <algorithm>
 #include <utils/vlog/loghelper.h>
+#include "epoch_reclaimer.h"
+#include "hot_dict_registry.h"
+#include "dict_warm_up.h"
+#include "load_throttle.h"
+#include "numa_replica.h"
+#include "batch_lookup.h"
 
 
 namespace StemCell {
@@ -43,6 +55,8 @@ void* monitorThread(void *arg) {
         if( needSleep ) {
             VLOG(1) << "if need sleep " << curSleepTime << " " << pHotDict->m_sleepTime ;
             if( curSleepTime++ < pHotDict->m_sleepTime ) {
+                // 旧词典的读者离开后一秒内释放, 不必等到下一次检查
+                EpochDomain::instance().tryReclaim();
                 sleep(1);
                 continue;
             }
@@ -51,43 +65,8 @@ void* monitorThread(void *arg) {
                 curSleepTime = 0;
             }
         }
-        // 检测pHotDict->m_pSwitchDict是否不为空 2012-08-12
-        // 不为空，判断是否到底备用词典的延迟生命周期
-        if( pHotDict->m_pSwitchDict != NULL ) {
-            delete pHotDict->m_pSwitchDict;
-            pHotDict->m_pSwitchDict = NULL;
-        }
-        // 检测新文件是否到来
-        if(pHotDict->isNewDictArrived())
-        {
-            // 构造新的DictType类型指针
-            pHotDict->m_pSwitchDict = 
-                pHotDict->newDictFunc(pHotDict->getNewDictFileName());
-            // 判断词典是否加载成功
-            if(pHotDict->m_pSwitchDict == NULL) {
-                VLOG_APP(WARNING) << "[" << _getCurrentTime() << 
-                    "] Error when load new Dictionary!";
-            }
-            else {
-                // 加读锁后，交换m_pCurDict和m_pSwitchDict指针
-                DictType * pDictTemp = pHotDict->m_pCurDict;
-                pthread_rwlock_wrlock(&pHotDict->m_rwLock);
-                pHotDict->m_pCurDict = pHotDict->m_pSwitchDict;
-                // 不在删除，直接将m_pSwitchDict指向原来的内存空间
-                // 保证指针不删除原来m_pCurDict的指针
-                pHotDict->m_pSwitchDict = pDictTemp;
-                pthread_rwlock_unlock(&pHotDict->m_rwLock);
-                //  delete pDictTemp;
-                // 修改当前内存中的词典名字
-                pHotDict->switchFileName();
-                VLOG_APP(INFO) << "[" << _getCurrentTime() 
-                    << "] New Dictionary Switched!";
-            }
-            needSleep = true;
-        }
-        else { // 继续监控
-            needSleep = true;
-        }
+        pHotDict->checkAndSwitch();
+        needSleep = true;
     }
     return NULL;
 }
@@ -108,8 +87,36 @@ template <class DictType>
 class HotSwitchDict {
     public:
         typedef DictType* (*NewDictFunc)(const std::string & fileName);
+        // 在当前词典上应用补丁生成新词典, 失败返回NULL
+        typedef DictType* (*ApplyDeltaFunc)(const DictType & curDict, 
+                const std::string & patchFile);
+        // 切换前对新词典做的预热, 例如用LookupSampler重放最近的查询
+        typedef std::function<void(const DictType &)> WarmUpFunc;
         // 友元函数，需要操作HotSwitchDict的private变量
         friend void * monitorThread<DictType>(void * arg);
+        /**
+         * @brief 读者pin住的词典版本, 生命周期内词典不会被释放
+         * 读路径只写本线程的epoch slot, 不需要加读写锁
+         */
+        class ReadGuard {
+            public:
+                explicit ReadGuard(const HotSwitchDict & hotDict) {
+                    EpochDomain::instance().pin();
+                    // 开启NUMA复制时取本节点的副本
+                    NumaReplicaSet<DictType> * pReplicas = 
+                        hotDict.m_pReplicas.load(std::memory_order_seq_cst);
+                    m_pDict = pReplicas != NULL ? pReplicas->local()
+                        : hotDict.m_pCurDict.load(std::memory_order_seq_cst);
+                }
+                ~ReadGuard() { EpochDomain::instance().unpin(); }
+                ReadGuard(const ReadGuard&) = delete;
+                ReadGuard& operator=(const ReadGuard&) = delete;
+                const DictType * get() const { return m_pDict; }
+                const DictType * operator->() const { return m_pDict; }
+                const DictType & operator*() const { return *m_pDict; }
+            private:
+                const DictType * m_pDict;
+        };
         /**
          * @brief HotSwitchDict 构造函数
          * @param fileName 词典的文件名
@@ -120,9 +127,12 @@ class HotSwitchDict {
                 uint32_t sleepTime = 1)
             : m_pCurDict(NULL), m_pSwitchDict(NULL), m_fileName(fileName),
             m_newFileName(""), m_flagFile(flagFile), m_sleepTime(sleepTime), 
-            m_stopMonitor(false), m_inited(false) {
+            m_stopMonitor(false), m_applyDeltaFunc(NULL), m_throttled(false),
+            m_replicateFunc(NULL), m_pReplicas(NULL), m_prefault(false),
+            m_lastWarmUpMs(0), m_registry(NULL), m_watchId(-1), m_inited(false) {
                 pthread_rwlock_init(&m_rwLock, NULL);
                 m_lastUpdateTime = 0;
+                m_lastUpdateNsec = 0;
                 if( sleepTime < 10 || sleepTime > 3600 ) {
                     m_sleepTime = 3600;
                 }
@@ -130,9 +140,12 @@ class HotSwitchDict {
         /**
          * @brief 初始化函数，用来初始化词典文件以及监控线程
          * @ndf 初始化词典的函数指针
+         * @registry 不为NULL时由registry统一监控flag文件, 不再单独创建监控线程,
+         *           registry没有启动时在这里启动, registry需要比词典活得更久
          * @return 如果初始化不成功，返回false 
          */
-        bool init(NewDictFunc ndf, const std::string& logName = "HotSwitch" )
+        bool init(NewDictFunc ndf, const std::string& logName = "HotSwitch",
+                HotDictRegistry * registry = NULL)
         {
             m_logName = logName;
             this->setNewDictFunc(ndf);
@@ -140,12 +153,78 @@ class HotSwitchDict {
             if( m_pCurDict == NULL ) {
                 return false;
             }
+            if( m_replicateFunc != NULL ) {
+                m_pReplicas = buildReplicas(m_pCurDict.load());
+            }
+            if( registry != NULL ) {
+                m_registry = registry;
+                m_watchId = registry->watch(m_flagFile, [this]() { checkAndSwitch(); });
+                m_inited = true;
+                return true;
+            }
             int err = pthread_create(&m_monitorThread, NULL, 
                     monitorThread<DictType>, (void*)this);
             if( err != 0 ) return false;
             m_inited = true;
             return true;
         }
+        /**
+         * @brief 开启增量更新, 需要在init之前调用
+         * 监控文件格式为 "新词典文件 [补丁文件 补丁对应的旧词典文件]",
+         * 补丁的旧词典与当前内存中的词典一致时, 在当前词典上应用补丁;
+         * 否则或补丁应用失败时, 全量加载新词典文件
+         */
+        void setApplyDeltaFunc(ApplyDeltaFunc adf) {
+            m_applyDeltaFunc = adf;
+        }
+        /**
+         * @brief 限制后台加载占用的CPU、读取速率和内存, 需要在init之前调用
+         * 只对init之后的重新加载生效, 每次加载的统计见getLastLoadStats
+         */
+        void setLoadThrottle(const LoadThrottleOptions & options) {
+            m_throttleOptions = options;
+            m_throttled = true;
+        }
+        /**
+         * @brief 最近一次重新加载的统计
+         */
+        LoadStats getLastLoadStats() {
+            std::lock_guard<std::mutex> locker(m_statsLock);
+            return m_lastLoadStats;
+        }
+        /**
+         * @brief 开启NUMA复制, 需要在init之前调用
+         * 每个版本加载后在其余每个NUMA节点上复制一份, 原始词典所在节点直接用原始词典,
+         * pin()返回读者所在节点的副本, 所有副本随版本一起切换. getCurDict()与读写锁接口仍然返回原始词典.
+         * 只有一个NUMA节点时不复制
+         * @param replicate 在当前线程上拷贝一份词典, 内存会分配在当前节点上
+         */
+        void setNumaReplication(typename NumaReplicaSet<DictType>::ReplicateFunc replicate
+                = &DefaultReplicateFunc<DictType>) {
+            m_replicateFunc = replicate;
+        }
+        /**
+         * @brief 当前版本各副本的内存与访问统计, 没有副本时返回空串
+         */
+        std::string getNumaReport() const {
+            EpochGuard guard;
+            NumaReplicaSet<DictType> * pReplicas = m_pReplicas.load(std::memory_order_seq_cst);
+            return pReplicas != NULL ? pReplicas->report() : std::string();
+        }
+        /**
+         * @brief 设置切换前的预热, 需要在init之前调用
+         * @param prefault 是否用prefaultDict预先触发新词典的缺页
+         * @param warmUpFunc 预热完成后再调用, 可以为空
+         * 预热结束后才切换指针, 耗时见getLastWarmUpMs
+         */
+        void setWarmUp(bool prefault, const WarmUpFunc & warmUpFunc = WarmUpFunc()) {
+            m_prefault = prefault;
+            m_warmUpFunc = warmUpFunc;
+        }
+        /**
+         * @brief 最近一次切换的预热耗时(毫秒)
+         */
+        int64_t getLastWarmUpMs() const { return m_lastWarmUpMs.load(std::memory_order_relaxed); }
         /**
          * @brief 销毁对象，等待监控线程结束，销毁dict指针和读写锁
          * todo 屏蔽继承
@@ -157,23 +236,58 @@ class HotSwitchDict {
                 // 取消线程，避免出现sleep时间过长，导致join需要大量时间
                 //pthread_cancel(m_monitorThread);
                 // 等待监控线程结束
-                if( m_inited )
+                if( m_inited && m_registry != NULL )
+                    m_registry->unwatch(m_watchId);
+                else if( m_inited )
                     pthread_join(m_monitorThread, NULL);
-                // 销毁对象
-                delete m_pCurDict;
+                // 当前版本也交给epoch回收, 副本先于原始词典
+                EpochDomain::instance().retire(m_pReplicas.exchange(NULL), this);
+                EpochDomain::instance().retire(m_pCurDict.exchange(NULL), this);
             }
             m_pCurDict = NULL;
-            if( m_pSwitchDict != NULL ) {
-                delete m_pSwitchDict;
-                m_pSwitchDict = NULL;
-            }
+            // 只等待本词典retire的版本, 不受其他词典影响; 当前线程pin着时不等待,
+            // 剩下的版本由之后的tryReclaim释放
+            EpochDomain::instance().synchronize(this);
             // 销毁锁
             pthread_rwlock_destroy(&m_rwLock);
         }
         /**
          * @brief 获取当前dict的指针
          */
-        DictType * getCurDict() { return m_pCurDict; }
+        DictType * getCurDict() { return m_pCurDict.load(std::memory_order_acquire); }
+        /**
+         * @brief 无锁读: pin住当前词典, 在返回值析构前一直有效
+         * 用法: auto dict = hotDict.pin(); dict->find(key);
+         * 同一线程可以嵌套pin, 但不要跨线程传递返回值
+         */
+        ReadGuard pin() const { return ReadGuard(*this); }
+        /**
+         * @brief 批量查找, 整批只pin一次
+         * 命中时把value拷贝到values[i]并把found[i]置为true, 需要DictType提供
+         * lookupBatch(const KeyType *keys, size_t n, const ValueType **out)
+         * @return 命中的个数
+         */
+        template<class KeyType, class ValueType>
+        size_t lookupBatch(const std::vector<KeyType> & keys, std::vector<ValueType> & values,
+                std::vector<bool> & found) const {
+            values.resize(keys.size());
+            found.assign(keys.size(), false);
+            const ValueType * out[LOOKUP_BATCH_BLOCK];
+            size_t hits = 0;
+            ReadGuard dict = pin();
+            for( size_t begin = 0; begin < keys.size(); begin += LOOKUP_BATCH_BLOCK ) {
+                size_t count = std::min<size_t>(LOOKUP_BATCH_BLOCK, keys.size() - begin);
+                dict->lookupBatch(keys.data() + begin, count, out);
+                for( size_t j = 0; j < count; ++j ) {
+                    if( out[j] != NULL ) {
+                        values[begin + j] = *out[j];
+                        found[begin + j] = true;
+                        ++hits;
+                    }
+                }
+            }
+            return hits;
+        }
         /**
          * @brief 加读锁
          */
@@ -194,6 +308,124 @@ class HotSwitchDict {
         DictType * newDictFunc(const std::string & fileName) {
             return m_newDictFunc(fileName.c_str());
         }
+        /**
+         * @brief 检查flag文件, 有新词典时加载并切换
+         * 由监控线程或HotDictRegistry的加载线程调用, 同一时刻只有一个调用
+         * @return 切换了新词典返回true
+         */
+        bool checkAndSwitch() {
+            // 释放已经没有读者的旧词典
+            EpochDomain::instance().tryReclaim();
+            // 检测新文件是否到来
+            if( !isNewDictArrived() ) {
+                return false;
+            }
+            // 构造新的DictType类型指针, 有补丁时优先增量更新
+            m_pSwitchDict = throttledLoadNewDict();
+            // 判断词典是否加载成功
+            if( m_pSwitchDict == NULL ) {
+                VLOG_APP(WARNING) << "[" << _getCurrentTime() << 
+                    "] Error when load new Dictionary!";
+                return false;
+            }
+            warmUp(*m_pSwitchDict);
+            NumaReplicaSet<DictType> * pNewReplicas = m_replicateFunc != NULL
+                ? buildReplicas(m_pSwitchDict) : NULL;
+            // 加写锁后发布新词典, 兼容仍在使用读写锁的调用方
+            pthread_rwlock_wrlock(&m_rwLock);
+            DictType * pDictTemp = m_pCurDict.exchange(m_pSwitchDict, std::memory_order_seq_cst);
+            pthread_rwlock_unlock(&m_rwLock);
+            // 所有副本通过一个指针整体切换
+            NumaReplicaSet<DictType> * pReplicasTemp = 
+                m_pReplicas.exchange(pNewReplicas, std::memory_order_seq_cst);
+            m_pSwitchDict = NULL;
+            // 旧词典等所有pin住它的读者离开后再释放, 旧副本先于旧词典
+            if( pReplicasTemp != NULL ) {
+                VLOG_APP(INFO) << m_logName << " retire numa replicas " << pReplicasTemp->report();
+                EpochDomain::instance().retire(pReplicasTemp, this);
+            }
+            EpochDomain::instance().retire(pDictTemp, this);
+            // 修改当前内存中的词典名字
+            switchFileName();
+            VLOG_APP(INFO) << "[" << _getCurrentTime() 
+                << "] New Dictionary Switched!";
+            return true;
+        }
+        /**
+         * @brief 在限流下加载新词典, 内存检查不通过时下次检查再重试
+         */
+        DictType * throttledLoadNewDict() {
+            if( !m_throttled ) {
+                return loadNewDict();
+            }
+            LoadThrottle throttle(m_throttleOptions);
+            DictType * pDict = NULL;
+            if( !throttle.admit(m_newFileName) ) {
+                VLOG_APP(WARNING) << m_logName << " refuse to load " << m_newFileName
+                    << ", not enough memory";
+                m_lastUpdateTime = 0;
+                m_lastUpdateNsec = 0;
+            } else {
+                LoadThrottle::Scope scope(&throttle);
+                pDict = loadNewDict();
+            }
+            LoadStats stats = throttle.stats();
+            VLOG_APP(INFO) << m_logName << " load " << m_newFileName << " cost " << stats.totalMs
+                << "ms, throttled " << stats.throttledMs << "ms, read " << stats.bytesRead << " bytes";
+            std::lock_guard<std::mutex> locker(m_statsLock);
+            m_lastLoadStats = stats;
+            return pDict;
+        }
+        /**
+         * @brief 在所有NUMA节点上复制pDict
+         */
+        NumaReplicaSet<DictType> * buildReplicas(const DictType * pDict) {
+            NumaReplicaSet<DictType> * pReplicas = 
+                NumaReplicaSet<DictType>::build(pDict, m_replicateFunc);
+            if( pReplicas != NULL ) {
+                VLOG_APP(INFO) << m_logName << " numa replicas " << pReplicas->report();
+            }
+            return pReplicas;
+        }
+        /**
+         * @brief 切换前预热新词典, 记录耗时
+         */
+        void warmUp(const DictType & dict) {
+            if( !m_prefault && !m_warmUpFunc ) {
+                return;
+            }
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            size_t touched = m_prefault ? prefaultDict(dict) : 0;
+            if( m_warmUpFunc ) {
+                m_warmUpFunc(dict);
+            }
+            int64_t costMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - begin).count();
+            m_lastWarmUpMs.store(costMs, std::memory_order_relaxed);
+            VLOG_APP(INFO) << m_logName << " warm up " << m_newFileName << " cost "
+                << costMs << "ms, prefaulted " << touched;
+        }
+        /**
+         * @brief 加载m_newFileName对应的新词典, 可以增量时先尝试增量
+         */
+        DictType * loadNewDict() {
+            if( m_applyDeltaFunc != NULL && !m_patchFileName.empty() ) {
+                if( m_patchBaseFileName == m_fileName ) {
+                    DictType * pDict = m_applyDeltaFunc(*m_pCurDict.load(), m_patchFileName);
+                    if( pDict != NULL ) {
+                        VLOG_APP(INFO) << m_logName << " apply patch " << m_patchFileName
+                            << " on " << m_fileName;
+                        return pDict;
+                    }
+                    VLOG_APP(WARNING) << m_logName << " failed to apply patch " 
+                        << m_patchFileName << ", fall back to full reload";
+                } else {
+                    VLOG_APP(WARNING) << m_logName << " patch base " << m_patchBaseFileName
+                        << " mismatch current " << m_fileName << ", fall back to full reload";
+                }
+            }
+            return newDictFunc(m_newFileName);
+        }
         /**
          * @brief 判断新词典文件是否存在
          */
@@ -208,8 +440,11 @@ class HotSwitchDict {
             if( stat(m_flagFile.c_str(), &buf) < 0 ) {
                 return false;
             }
-            time_t flagFileTime = buf.st_ctime;
-            if( flagFileTime <= m_lastUpdateTime ) {
+            // 用纳秒精度比较, 同一秒内的多次更新也能被发现
+            time_t flagFileTime = buf.st_ctim.tv_sec;
+            long flagFileNsec = buf.st_ctim.tv_nsec;
+            if( flagFileTime < m_lastUpdateTime || (flagFileTime == m_lastUpdateTime
+                        && flagFileNsec <= m_lastUpdateNsec) ) {
                 VLOG(1) << "HotSwitch: Time is smaller than m_lastUpdateTime" << m_flagFile;
                 return false;
             }
@@ -219,7 +454,9 @@ class HotSwitchDict {
                 return false;
             }
             std::string newfileName;
-            in >> newfileName;
+            std::string patchFileName;
+            std::string patchBaseFileName;
+            in >> newfileName >> patchFileName >> patchBaseFileName;
             in.close();
             // 判断新文件是否存在，使用绝对路径
             if( access(newfileName.c_str(), F_OK|R_OK) < 0 )
@@ -228,7 +465,14 @@ class HotSwitchDict {
                 return false;
             }
             m_newFileName = newfileName;
+            m_patchFileName = "";
+            m_patchBaseFileName = "";
+            if( !patchFileName.empty() && access(patchFileName.c_str(), F_OK|R_OK) == 0 ) {
+                m_patchFileName = patchFileName;
+                m_patchBaseFileName = patchBaseFileName;
+            }
             m_lastUpdateTime = flagFileTime;
+            m_lastUpdateNsec = flagFileNsec;
             VLOG(1) << "change to new dict." << m_newFileName;
             return true;
         }
@@ -252,7 +496,7 @@ class HotSwitchDict {
         }
     
     private:	
-        DictType * m_pCurDict;
+        std::atomic<DictType *> m_pCurDict;
         DictType * m_pSwitchDict;
         std::string m_fileName;
         std::string m_newFileName;
@@ -262,7 +506,22 @@ class HotSwitchDict {
         pthread_t m_monitorThread;
         bool m_stopMonitor;
         NewDictFunc m_newDictFunc;
+        ApplyDeltaFunc m_applyDeltaFunc;
+        bool m_throttled;
+        LoadThrottleOptions m_throttleOptions;
+        LoadStats m_lastLoadStats;
+        std::mutex m_statsLock;
+        typename NumaReplicaSet<DictType>::ReplicateFunc m_replicateFunc;
+        std::atomic<NumaReplicaSet<DictType> *> m_pReplicas;
+        bool m_prefault;
+        WarmUpFunc m_warmUpFunc;
+        std::atomic<int64_t> m_lastWarmUpMs;
+        std::string m_patchFileName;
+        std::string m_patchBaseFileName;
+        HotDictRegistry * m_registry;
+        int64_t m_watchId;
         time_t m_lastUpdateTime;
+        long   m_lastUpdateNsec;
         bool   m_inited;
         std::string m_logName;
 };
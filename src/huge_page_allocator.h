@@ -0,0 +1,336 @@
+/**
+ * @brief 大页内存上的词典存储
+ *
+ * 几十GB的常驻词典随机查找时大部分时间花在TLB miss上. HugePageArena按块(默认64MB,
+ * 2MB对齐)向内核申请内存, 依次尝试:
+ *   HUGE_PAGE_EXPLICIT:    MAP_HUGETLB, 需要预先配置vm.nr_hugepages
+ *   HUGE_PAGE_TRANSPARENT: 2MB对齐的匿名映射 + MADV_HUGEPAGE
+ *   普通页
+ * 前一种失败时自动退回后一种. 块内顺序分配, 释放时不回收, 整个arena随词典一起析构,
+ * 所以只适合加载后只读的词典. 加载过程中释放的内存(例如unordered_map rehash换下的桶数组)
+ * 也留在arena里直到词典析构, 哈希表应先reserve到最终大小再往arena里插入,
+ * 见Dict::buildHugePageHashMapDict.
+ * HugePageAllocator<T>是绑定到arena的STL allocator, 默认构造时使用当前线程上
+ * HugePageArena::Scope指定的arena, 没有时退回operator new.
+ */
+#ifndef HUGE_PAGE_ALLOCATOR_H
+#define HUGE_PAGE_ALLOCATOR_H
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "spinlock.h"
+
+namespace StemCell {
+
+#define HUGE_PAGE_SIZE (2UL << 20)
+#define HUGE_PAGE_ARENA_CHUNK_BYTES (64UL << 20)
+
+enum HugePageMode {
+    HUGE_PAGE_NONE = 0,
+    HUGE_PAGE_TRANSPARENT = 1,
+    HUGE_PAGE_EXPLICIT = 2
+};
+
+class HugePageArena {
+public:
+    struct Stats {
+        Stats() : reservedBytes(0), allocatedBytes(0), explicitBytes(0),
+                  transparentBytes(0), normalBytes(0), hugePageBytes(0) {}
+        size_t reservedBytes;       // 向内核申请的总字节数
+        size_t allocatedBytes;      // 分配出去的字节数
+        size_t explicitBytes;       // MAP_HUGETLB的块
+        size_t transparentBytes;    // MADV_HUGEPAGE的块
+        size_t normalBytes;         // 退回普通页的块
+        size_t hugePageBytes;       // 实际落在大页上的字节数, 透明大页按smaps的AnonHugePages统计
+    };
+
+    explicit HugePageArena(HugePageMode mode = defaultMode(),
+            size_t chunkBytes = HUGE_PAGE_ARENA_CHUNK_BYTES)
+        : _mode(mode), _chunkBytes(roundUp(chunkBytes == 0 ? HUGE_PAGE_SIZE : chunkBytes)),
+          _cur(nullptr), _remain(0), _allocated(0) {}
+
+    HugePageArena(const HugePageArena&) = delete;
+    HugePageArena& operator=(const HugePageArena&) = delete;
+
+    ~HugePageArena() {
+        for (size_t i = 0; i < _chunks.size(); ++i) {
+            munmap(_chunks[i].data, _chunks[i].size);
+        }
+    }
+
+    void *allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        std::lock_guard<Spinlock> locker(_lock);
+        size_t pad = (align - reinterpret_cast<uintptr_t>(_cur) % align) % align;
+        if (_cur == nullptr || size + pad > _remain) {
+            if (!newChunk(size + align)) {
+                throw std::bad_alloc();
+            }
+            pad = (align - reinterpret_cast<uintptr_t>(_cur) % align) % align;
+        }
+        char *p = _cur + pad;
+        _cur += pad + size;
+        _remain -= pad + size;
+        _allocated += size;
+        return p;
+    }
+
+    Stats stats() const {
+        Stats stats;
+        std::vector<Chunk> chunks;
+        {
+            std::lock_guard<Spinlock> locker(_lock);
+            chunks = _chunks;
+            stats.allocatedBytes = _allocated;
+        }
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            stats.reservedBytes += chunks[i].size;
+            if (chunks[i].mode == HUGE_PAGE_EXPLICIT) {
+                stats.explicitBytes += chunks[i].size;
+                stats.hugePageBytes += chunks[i].size;
+            } else if (chunks[i].mode == HUGE_PAGE_TRANSPARENT) {
+                stats.transparentBytes += chunks[i].size;
+            } else {
+                stats.normalBytes += chunks[i].size;
+            }
+        }
+        if (stats.transparentBytes > 0) {
+            stats.hugePageBytes += transparentHugeBytes(chunks);
+        }
+        return stats;
+    }
+
+    std::string report() const {
+        Stats s = stats();
+        std::ostringstream out;
+        out << "reserved:" << s.reservedBytes << " allocated:" << s.allocatedBytes
+            << " explicit:" << s.explicitBytes << " transparent:" << s.transparentBytes
+            << " normal:" << s.normalBytes << " on_huge_pages:" << s.hugePageBytes;
+        return out.str();
+    }
+
+    HugePageMode mode() const { return _mode; }
+
+    // 进程级别的默认模式, 对之后新建的arena生效
+    static void setDefaultMode(HugePageMode mode) { defaultModeRef().store(mode); }
+    static HugePageMode defaultMode() { return static_cast<HugePageMode>(defaultModeRef().load()); }
+
+    /**
+     * @brief 在当前线程上指定HugePageAllocator默认使用的arena
+     */
+    class Scope {
+    public:
+        explicit Scope(HugePageArena *arena) : _prev(current()) { current() = arena; }
+        ~Scope() { current() = _prev; }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        HugePageArena *_prev;
+    };
+
+    static HugePageArena *&current() {
+        static thread_local HugePageArena *arena = nullptr;
+        return arena;
+    }
+
+private:
+    struct Chunk {
+        char *data;
+        size_t size;
+        HugePageMode mode;
+    };
+
+    static size_t roundUp(size_t size) {
+        return (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    }
+
+    static std::atomic<int> &defaultModeRef() {
+        static std::atomic<int> mode(HUGE_PAGE_TRANSPARENT);
+        return mode;
+    }
+
+    // 调用方持有_lock
+    bool newChunk(size_t minSize) {
+        Chunk chunk;
+        chunk.size = std::max(_chunkBytes, roundUp(minSize));
+        chunk.data = nullptr;
+        chunk.mode = HUGE_PAGE_NONE;
+        if (_mode == HUGE_PAGE_EXPLICIT) {
+            void *addr = mmap(nullptr, chunk.size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (addr != MAP_FAILED) {
+                chunk.data = static_cast<char*>(addr);
+                chunk.mode = HUGE_PAGE_EXPLICIT;
+            }
+        }
+        if (chunk.data == nullptr) {
+            chunk.data = mapAligned(chunk.size);
+            if (chunk.data == nullptr) {
+                return false;
+            }
+#ifdef MADV_HUGEPAGE
+            if (_mode != HUGE_PAGE_NONE && madvise(chunk.data, chunk.size, MADV_HUGEPAGE) == 0) {
+                chunk.mode = HUGE_PAGE_TRANSPARENT;
+            }
+#endif
+        }
+        _chunks.push_back(chunk);
+        _cur = chunk.data;
+        _remain = chunk.size;
+        return true;
+    }
+
+    // 2MB对齐的匿名映射, 多映射一个大页再把两端裁掉
+    static char *mapAligned(size_t size) {
+        void *addr = mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            return nullptr;
+        }
+        uintptr_t begin = reinterpret_cast<uintptr_t>(addr);
+        uintptr_t aligned = (begin + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        if (aligned > begin) {
+            munmap(addr, aligned - begin);
+        }
+        size_t tail = begin + size + HUGE_PAGE_SIZE - (aligned + size);
+        if (tail > 0) {
+            munmap(reinterpret_cast<void*>(aligned + size), tail);
+        }
+        return reinterpret_cast<char*>(aligned);
+    }
+
+    // 统计与chunks重叠的映射在smaps里的AnonHugePages
+    static size_t transparentHugeBytes(const std::vector<Chunk> &chunks) {
+        std::ifstream in("/proc/self/smaps");
+        std::string line;
+        bool overlap = false;
+        size_t bytes = 0;
+        while (getline(in, line)) {
+            uintptr_t begin = 0;
+            uintptr_t end = 0;
+            char dash = 0;
+            std::istringstream header(line);
+            if (line.find(':') > line.find(' ')
+                    && (header >> std::hex >> begin >> dash >> end) && dash == '-') {
+                overlap = false;
+                for (size_t i = 0; i < chunks.size(); ++i) {
+                    uintptr_t data = reinterpret_cast<uintptr_t>(chunks[i].data);
+                    if (chunks[i].mode == HUGE_PAGE_TRANSPARENT
+                            && data < end && data + chunks[i].size > begin) {
+                        overlap = true;
+                        break;
+                    }
+                }
+                continue;
+            }
+            if (overlap && line.compare(0, 14, "AnonHugePages:") == 0) {
+                bytes += strtoull(line.c_str() + 14, nullptr, 10) << 10;
+            }
+        }
+        return bytes;
+    }
+
+    HugePageMode _mode;
+    size_t _chunkBytes;
+    mutable Spinlock _lock;
+    std::vector<Chunk> _chunks;
+    char *_cur;
+    size_t _remain;
+    size_t _allocated;
+};
+
+/**
+ * @brief 从HugePageArena分配的STL allocator
+ * 绑定arena时deallocate是空操作, 内存直到arena析构才归还;
+ * 拷贝构造容器时不沿用源容器的arena, 而是取当前线程HugePageArena::Scope指定的arena
+ */
+template<class T>
+class HugePageAllocator {
+public:
+    typedef T value_type;
+
+    HugePageAllocator() : _arena(HugePageArena::current()) {}
+    explicit HugePageAllocator(HugePageArena *arena) : _arena(arena) {}
+    template<class U>
+    HugePageAllocator(const HugePageAllocator<U> &other) : _arena(other.arena()) {}
+
+    T *allocate(size_t n) {
+        if (_arena == nullptr) {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, size_t) {
+        if (_arena == nullptr) {
+            ::operator delete(p);
+        }
+    }
+
+    HugePageArena *arena() const { return _arena; }
+
+    // 拷贝出来的容器可能在别的线程或NUMA节点上使用, 不能再往源容器的arena里分配
+    HugePageAllocator select_on_container_copy_construction() const {
+        return HugePageAllocator(HugePageArena::current());
+    }
+
+    template<class U>
+    bool operator==(const HugePageAllocator<U> &other) const { return _arena == other.arena(); }
+    template<class U>
+    bool operator!=(const HugePageAllocator<U> &other) const { return _arena != other.arena(); }
+
+private:
+    HugePageArena *_arena;
+};
+
+template<class K, class V>
+using HugePageMap = std::map<K, V, std::less<K>, HugePageAllocator<std::pair<const K, V> > >;
+
+template<class K, class V>
+using HugePageHashMap = std::unordered_map<K, V, std::hash<K>, std::equal_to<K>,
+      HugePageAllocator<std::pair<const K, V> > >;
+
+// 作为第一个基类, 保证arena在容器析构之后才释放
+struct HugePageArenaHolder {
+    explicit HugePageArenaHolder(const std::shared_ptr<HugePageArena> &arena) : _arena(arena) {}
+    std::shared_ptr<HugePageArena> _arena;
+};
+
+/**
+ * @brief 存储在HugePageArena上的词典, 持有arena, 析构时先析构容器再释放arena
+ * 拷贝时新建一个同模式的arena, 副本的节点分配在新arena上, 例如NUMA复制时落在副本所在节点
+ */
+template<class MapType>
+class HugePageDict : private HugePageArenaHolder, public MapType {
+public:
+    HugePageDict(MapType &&dict, const std::shared_ptr<HugePageArena> &arena)
+        : HugePageArenaHolder(arena), MapType(std::move(dict)) {}
+
+    HugePageDict(const HugePageDict &other)
+        : HugePageArenaHolder(std::make_shared<HugePageArena>(other._arena->mode())),
+          MapType(other, typename MapType::allocator_type(_arena.get())) {}
+
+    HugePageDict(HugePageDict &&other) = default;
+    // 赋值会让容器和arena分属不同的词典
+    HugePageDict& operator=(const HugePageDict&) = delete;
+
+    const std::shared_ptr<HugePageArena> &arena() const { return _arena; }
+    HugePageArena::Stats hugePageStats() const { return _arena->stats(); }
+};
+
+} // end namespace StemCell
+#endif
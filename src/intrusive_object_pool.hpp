@@ -0,0 +1,133 @@
+#ifndef INTRUSIVE_OBJECT_POOL_HPP
+#define INTRUSIVE_OBJECT_POOL_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+
+namespace StemCell {
+
+// 第k块有INTRUSIVE_POOL_FIRST_CHUNK << k个对象, 25块共约21亿个, 编号加一不超过32位
+#define INTRUSIVE_POOL_FIRST_CHUNK 64
+#define INTRUSIVE_POOL_MAX_CHUNKS 25
+
+/**
+ * @brief 任意线程都可以分配和回收的无锁对象池, 空闲链表的指针是对象自身的成员Next
+ *
+ * 对象按块分配, 每块是上一块的两倍, 在对象池析构之前不会释放, 每个对象记住自己的编号(成员Index).
+ * 空闲链表头是 版本号 << 32 | (编号 + 1), 分配和回收各是一次CAS, 每次都把版本号加一,
+ * 被别的线程取走又放回的链表头不会被误认为没有变过(ABA).
+ * 没有std::map查找, 只有链表为空时才加锁分配一整块对象.
+ * 回收的对象保持原样, 需要时由调用方重置.
+ */
+template<class T, std::atomic<uint32_t> T::*Next, uint32_t T::*Index>
+class IntrusiveObjectPool {
+public:
+    IntrusiveObjectPool() : _head(0), _chunk_count(0) {
+        for (size_t i = 0; i < INTRUSIVE_POOL_MAX_CHUNKS; ++i) {
+            _chunks[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    IntrusiveObjectPool(const IntrusiveObjectPool&) = delete;
+    IntrusiveObjectPool& operator=(const IntrusiveObjectPool&) = delete;
+
+    // 所有对象都随对象池释放, 包括没有回收的
+    ~IntrusiveObjectPool() {
+        uint32_t count = _chunk_count.load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < count; ++i) {
+            delete[] _chunks[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    T *create() {
+        T *object = pop();
+        return object != nullptr ? object : grow();
+    }
+
+    void recycle(T *object) {
+        push(object, object);
+    }
+
+    // 已经分配的对象个数, 包括空闲的
+    size_t capacity() const {
+        return chunkBase(_chunk_count.load(std::memory_order_relaxed));
+    }
+
+private:
+    static uint64_t nextVersion(uint64_t head) {
+        return ((head >> 32) + 1) << 32;
+    }
+
+    // 第chunk块第一个对象的编号, 也是前面所有块的对象总数
+    static uint32_t chunkBase(uint32_t chunk) {
+        return INTRUSIVE_POOL_FIRST_CHUNK * ((1U << chunk) - 1);
+    }
+
+    T *at(uint32_t index) const {
+        uint32_t chunk = 31 - __builtin_clz(index / INTRUSIVE_POOL_FIRST_CHUNK + 1);
+        return _chunks[chunk].load(std::memory_order_acquire) + (index - chunkBase(chunk));
+    }
+
+    // 链表为空时返回nullptr
+    T *pop() {
+        uint64_t head = _head.load(std::memory_order_acquire);
+        while (static_cast<uint32_t>(head) != 0) {
+            T *object = at(static_cast<uint32_t>(head) - 1);
+            // object may be taken and recycled meanwhile, the version makes the CAS fail then
+            uint64_t next = nextVersion(head) | (object->*Next).load(std::memory_order_relaxed);
+            if (_head.compare_exchange_weak(head, next,
+                        std::memory_order_acquire, std::memory_order_acquire)) {
+                return object;
+            }
+        }
+        return nullptr;
+    }
+
+    // first到last已经用Next串好, 整段放到链表头
+    void push(T *first, T *last) {
+        uint64_t head = _head.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            (last->*Next).store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+            next = nextVersion(head) | (first->*Index + 1);
+        } while (!_head.compare_exchange_weak(head, next,
+                    std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // 新分配一块, 返回第一个对象, 其余的放进空闲链表
+    T *grow() {
+        std::lock_guard<std::mutex> locker(_grow_lock);
+        // another thread may have grown the pool while this one was waiting
+        T *object = pop();
+        if (object != nullptr) {
+            return object;
+        }
+        uint32_t chunk = _chunk_count.load(std::memory_order_relaxed);
+        if (chunk >= INTRUSIVE_POOL_MAX_CHUNKS) {
+            throw std::runtime_error("IntrusiveObjectPool is full");
+        }
+        uint32_t size = INTRUSIVE_POOL_FIRST_CHUNK << chunk;
+        T *objects = new T[size];
+        uint32_t base = chunkBase(chunk);
+        for (uint32_t i = 0; i < size; ++i) {
+            objects[i].*Index = base + i;
+            (objects[i].*Next).store(base + i + 2, std::memory_order_relaxed);
+        }
+        _chunks[chunk].store(objects, std::memory_order_release);
+        _chunk_count.store(chunk + 1, std::memory_order_relaxed);
+        push(objects + 1, objects + size - 1);
+        return objects;
+    }
+
+    // version << 32 | (index + 1), 0 in the low half means empty
+    alignas(64) std::atomic<uint64_t> _head;
+    alignas(64) std::atomic<uint32_t> _chunk_count;
+    std::mutex _grow_lock;
+    std::atomic<T*> _chunks[INTRUSIVE_POOL_MAX_CHUNKS];
+};
+
+} // end namespace StemCell
+
+#endif
@@ -0,0 +1,259 @@
+/**
+ * @brief 后台加载词典时的限流
+ *
+ * 词典加载与在线请求抢CPU、磁盘和内存, 每次重新加载都会拉高尾延迟. LoadThrottle提供:
+ *   - 加载线程的调度优先级: SCHED_IDLE或nice值
+ *   - CPU份额: 每处理LOAD_THROTTLE_CHECK_BYTES字节检查一次本线程消耗的CPU时间,
+ *     按 busy * (1 - share) / share 主动sleep
+ *   - 读取速率上限: 所有加载线程共享一个字节预算, 超出时sleep
+ *   - 内存上限: 加载前按文件大小估算内存, 超过MemAvailable或设定的上限时拒绝加载
+ * 限流对Dict的所有build*Dict生效: 在加载线程上创建LoadThrottle::Scope即可,
+ * Dict逐行读取时调用LoadThrottle::onBytes, 没有Scope时只多一次线程局部变量的读取.
+ */
+#ifndef LOAD_THROTTLE_H
+#define LOAD_THROTTLE_H
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+namespace StemCell {
+
+#define LOAD_THROTTLE_CHECK_BYTES (256 << 10)
+
+struct LoadThrottleOptions {
+    LoadThrottleOptions()
+        : idlePriority(false), niceValue(0), cpuShare(1.0), readBytesPerSec(0),
+          memoryLimitBytes(0), memoryFactor(3.0) {}
+    bool idlePriority;          // 加载线程使用SCHED_IDLE
+    int niceValue;              // idlePriority为false时生效, 0表示不修改
+    double cpuShare;            // 加载线程可以占用的CPU比例, (0, 1], 1表示不限制
+    uint64_t readBytesPerSec;   // 读取速率上限, 0表示不限制
+    uint64_t memoryLimitBytes;  // 进程RSS加上新词典估算内存的上限, 0表示只检查MemAvailable
+    double memoryFactor;        // 词典内存与文件大小之比的估计值
+};
+
+struct LoadStats {
+    LoadStats() : totalMs(0), throttledMs(0), bytesRead(0), refused(false) {}
+    int64_t totalMs;        // 加载总耗时
+    int64_t throttledMs;    // 因CPU份额和读取速率主动sleep的时间, 多个加载线程时为总和
+    uint64_t bytesRead;
+    bool refused;           // 内存检查未通过, 没有加载
+};
+
+class LoadThrottle {
+public:
+    explicit LoadThrottle(const LoadThrottleOptions &options)
+        : _options(options), _bytes(0), _throttledUs(0),
+          _begin(std::chrono::steady_clock::now()), _refused(false) {
+        if (_options.cpuShare <= 0 || _options.cpuShare > 1) {
+            _options.cpuShare = 1.0;
+        }
+    }
+
+    LoadThrottle(const LoadThrottle&) = delete;
+    LoadThrottle& operator=(const LoadThrottle&) = delete;
+
+    /**
+     * @brief 加载前的内存检查
+     * @return 估算的内存超过限制时返回false, 调用方不应再加载
+     */
+    bool admit(const std::string &fileName) {
+        struct stat st;
+        if (stat(fileName.c_str(), &st) < 0) {
+            return true;    // the loader reports the missing file itself
+        }
+        uint64_t estimate = static_cast<uint64_t>(st.st_size * _options.memoryFactor);
+        uint64_t available = memAvailableBytes();
+        if (available != 0 && estimate > available) {
+            _refused = true;
+        }
+        if (_options.memoryLimitBytes != 0
+                && residentBytes() + estimate > _options.memoryLimitBytes) {
+            _refused = true;
+        }
+        return !_refused;
+    }
+
+    LoadStats stats() const {
+        LoadStats stats;
+        stats.totalMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - _begin).count();
+        stats.throttledMs = _throttledUs.load() / 1000;
+        stats.bytesRead = _bytes.load();
+        stats.refused = _refused;
+        return stats;
+    }
+
+    const LoadThrottleOptions &options() const { return _options; }
+
+    /**
+     * @brief 在当前线程上启用throttle, 析构时恢复线程优先级(尽力而为,
+     * 没有权限时nice值无法调回)
+     */
+    class Scope {
+    public:
+        explicit Scope(LoadThrottle *throttle)
+            : _throttle(throttle), _prev(current()), _pending(0), _cpuUs(threadCpuUs()),
+              _policy(-1), _nice(0), _niced(false) {
+            current() = this;
+            if (_throttle != nullptr) {
+                applyPriority();
+            }
+        }
+
+        ~Scope() {
+            if (_throttle != nullptr) {
+                restorePriority();
+            }
+            current() = _prev;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        LoadThrottle *throttle() const { return _throttle; }
+
+    private:
+        friend class LoadThrottle;
+
+        void consume(size_t bytes) {
+            _pending += bytes;
+            if (_pending < LOAD_THROTTLE_CHECK_BYTES) {
+                return;
+            }
+            _throttle->account(_pending, _cpuUs);
+            _pending = 0;
+        }
+
+        void applyPriority() {
+            const LoadThrottleOptions &options = _throttle->options();
+            if (options.idlePriority) {
+                struct sched_param param;
+                _policy = sched_getscheduler(0);
+                sched_getparam(0, &_param);
+                memset(&param, 0, sizeof(param));
+                if (sched_setscheduler(0, SCHED_IDLE, &param) < 0) {
+                    _policy = -1;
+                }
+            } else if (options.niceValue != 0) {
+                // with PRIO_PROCESS, a thread id only affects that thread on linux
+                id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+                errno = 0;
+                _nice = getpriority(PRIO_PROCESS, tid);
+                _niced = errno == 0 && setpriority(PRIO_PROCESS, tid, options.niceValue) == 0;
+            }
+        }
+
+        void restorePriority() {
+            if (_policy >= 0) {
+                sched_setscheduler(0, _policy, &_param);
+            }
+            if (_niced) {
+                setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), _nice);
+            }
+        }
+
+        LoadThrottle *_throttle;
+        Scope *_prev;
+        size_t _pending;
+        int64_t _cpuUs;
+        int _policy;
+        struct sched_param _param;
+        int _nice;
+        bool _niced;
+    };
+
+    /**
+     * @brief 加载线程每处理bytes字节调用一次, 没有启用throttle时直接返回
+     */
+    static void onBytes(size_t bytes) {
+        Scope *scope = current();
+        if (scope != nullptr && scope->_throttle != nullptr) {
+            scope->consume(bytes);
+        }
+    }
+
+    // 当前线程上的throttle, 用于把它传递给并行加载的子线程
+    static LoadThrottle *currentThrottle() {
+        Scope *scope = current();
+        return scope == nullptr ? nullptr : scope->_throttle;
+    }
+
+private:
+    static Scope *&current() {
+        static thread_local Scope *scope = nullptr;
+        return scope;
+    }
+
+    static int64_t threadCpuUs() {
+        struct timespec ts;
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0) {
+            return 0;
+        }
+        return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    // cpuUs是调用线程上一次检查时的CPU时间
+    void account(size_t bytes, int64_t &cpuUs) {
+        uint64_t total = _bytes.fetch_add(bytes) + bytes;
+        int64_t sleepUs = 0;
+        if (_options.cpuShare < 1.0) {
+            int64_t now = threadCpuUs();
+            sleepUs = static_cast<int64_t>((now - cpuUs) * (1 - _options.cpuShare) / _options.cpuShare);
+        }
+        if (_options.readBytesPerSec != 0) {
+            int64_t elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - _begin).count();
+            int64_t budgetUs = static_cast<int64_t>(total * 1000000.0 / _options.readBytesPerSec);
+            sleepUs = std::max(sleepUs, budgetUs - elapsedUs);
+        }
+        if (sleepUs > 0) {
+            usleep(static_cast<useconds_t>(sleepUs));
+            _throttledUs.fetch_add(sleepUs);
+        }
+        cpuUs = threadCpuUs();
+    }
+
+    static uint64_t memAvailableBytes() {
+        std::ifstream in("/proc/meminfo");
+        std::string name;
+        uint64_t kb = 0;
+        std::string unit;
+        while (in >> name >> kb >> unit) {
+            if (name == "MemAvailable:") {
+                return kb << 10;
+            }
+        }
+        return 0;
+    }
+
+    static uint64_t residentBytes() {
+        std::ifstream in("/proc/self/statm");
+        uint64_t pages = 0;
+        uint64_t resident = 0;
+        in >> pages >> resident;
+        return resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    LoadThrottleOptions _options;
+    std::atomic<uint64_t> _bytes;
+    std::atomic<int64_t> _throttledUs;
+    std::chrono::steady_clock::time_point _begin;
+    bool _refused;
+};
+
+} // end namespace StemCell
+#endif
@@ -0,0 +1,104 @@
+#ifndef MMAP_FILE_H
+#define MMAP_FILE_H
+
+#include <string>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace StemCell {
+
+/**
+ * @brief 预先触发一段内存的缺页: 先MADV_WILLNEED让内核异步读入, 再逐页读一个字节
+ * @return 触碰的页数
+ */
+inline size_t prefaultMemory(const void *data, size_t size) {
+    if (data == nullptr || size == 0) {
+        return 0;
+    }
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t begin = reinterpret_cast<uintptr_t>(data) & ~(pageSize - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(data) + size;
+    madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+    size_t pages = 0;
+    volatile char sink = 0;
+    // the first page may start before data, so touch data itself and then every page start
+    for (uintptr_t p = reinterpret_cast<uintptr_t>(data); p < end; p = (p & ~(pageSize - 1)) + pageSize) {
+        sink = sink + *reinterpret_cast<const volatile char*>(p);
+        ++pages;
+    }
+    (void)sink;
+    return pages;
+}
+
+/**
+ * @brief 只读方式映射整个文件, 析构时自动解除映射
+ */
+class MmapFile {
+public:
+    MmapFile() : _data(nullptr), _size(0) {}
+    ~MmapFile() { close(); }
+
+    MmapFile(const MmapFile&) = delete;
+    MmapFile& operator=(const MmapFile&) = delete;
+
+    /**
+     * @brief 映射文件, 空文件也算成功, 此时data()为nullptr
+     * @param extraFlags 额外的mmap flag, 例如MAP_POPULATE
+     */
+    bool open(const std::string& fileName, int extraFlags = 0) {
+        close();
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            ::close(fd);
+            return false;
+        }
+        _size = st.st_size;
+        if (_size > 0) {
+            void* addr = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE | extraFlags, fd, 0);
+            if (addr == MAP_FAILED) {
+                ::close(fd);
+                _size = 0;
+                return false;
+            }
+            _data = static_cast<const char*>(addr);
+        }
+        // the mapping keeps its own reference to the file
+        ::close(fd);
+        return true;
+    }
+
+    void close() {
+        if (_data != nullptr) {
+            munmap(const_cast<char*>(_data), _size);
+        }
+        _data = nullptr;
+        _size = 0;
+    }
+
+    // hint the kernel how the mapping is going to be read
+    int advise(int advice) {
+        if (_data == nullptr) return 0;
+        return madvise(const_cast<char*>(_data), _size, advice);
+    }
+
+    // 把整个映射读入page cache并建立页表, 返回触碰的页数
+    size_t prefault() const { return prefaultMemory(_data, _size); }
+
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+private:
+    const char* _data;
+    size_t _size;
+};
+
+} // end namespace StemCell
+#endif
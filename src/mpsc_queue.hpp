@@ -0,0 +1,60 @@
+#ifndef MPSC_QUEUE_HPP
+#define MPSC_QUEUE_HPP
+
+#include <atomic>
+
+namespace StemCell {
+
+/**
+ * @brief 多生产者单消费者的无锁侵入式队列, 链表指针是元素自身的成员Next
+ *
+ * 生产者用CAS把元素压到链表头, 消费者用一次exchange取走整个链表再反转成先进先出的顺序.
+ * 消费者总是一次取空, 不存在ABA问题; 入队不分配内存.
+ * push()返回队列在入队前是否为空, 生产者只在这时通知消费者, 一批元素只需要一次唤醒.
+ * 同一个生产者入队的元素按入队顺序出队.
+ */
+template<class T, T* T::*Next>
+class IntrusiveMpscQueue {
+public:
+    IntrusiveMpscQueue() : _head(nullptr) {}
+
+    IntrusiveMpscQueue(const IntrusiveMpscQueue&) = delete;
+    IntrusiveMpscQueue& operator=(const IntrusiveMpscQueue&) = delete;
+
+    // 入队前队列为空时返回true
+    bool push(T *item) {
+        T *head = _head.load(std::memory_order_relaxed);
+        do {
+            item->*Next = head;
+        } while (!_head.compare_exchange_weak(head, item,
+                    std::memory_order_release, std::memory_order_relaxed));
+        return head == nullptr;
+    }
+
+    /**
+     * @brief 只能在消费者线程调用, 取走当前所有元素
+     * @return 按入队顺序用Next串起来的链表, 队列为空时返回nullptr
+     */
+    T *popAll() {
+        T *head = _head.exchange(nullptr, std::memory_order_acquire);
+        T *list = nullptr;
+        while (head != nullptr) {
+            T *next = head->*Next;
+            head->*Next = list;
+            list = head;
+            head = next;
+        }
+        return list;
+    }
+
+    bool empty() const { return _head.load(std::memory_order_relaxed) == nullptr; }
+
+private:
+    // keep the contended head away from whatever the owner places next to the queue
+    alignas(64) std::atomic<T*> _head;
+    char _padding[64 - sizeof(std::atomic<T*>)];
+};
+
+} // end namespace StemCell
+
+#endif
@@ -0,0 +1,346 @@
+/**
+ * @brief NUMA节点上的词典副本
+ *
+ * 词典只加载一次, 加载出来的原始词典就是它所在节点的副本, 其余每个NUMA节点上各拷贝一份:
+ * 拷贝线程绑定到该节点的CPU, 并用set_mempolicy(MPOL_BIND)把内存分配限制在该节点上.
+ * 读者按sched_getcpu()所在的节点取本地副本. 所有副本放在一个NumaReplicaSet里, 换词典时整体替换.
+ * 不依赖libnuma, 拓扑从/sys/devices/system/node读取, 只有一个节点时不做复制.
+ */
+#ifndef NUMA_REPLICA_H
+#define NUMA_REPLICA_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace StemCell {
+
+#define NUMA_MPOL_DEFAULT 0
+#define NUMA_MPOL_BIND 2
+#define NUMA_MPOL_F_NODE 1
+#define NUMA_MPOL_F_ADDR 2
+#define NUMA_MAX_NODES 64
+// 读计数每NUMA_READ_SAMPLE次才写一次共享计数器
+#define NUMA_READ_SAMPLE 64
+
+/**
+ * @brief 从sysfs读取的NUMA拓扑
+ */
+class NumaTopology {
+public:
+    explicit NumaTopology(const std::string &nodeDir = "/sys/devices/system/node") {
+        DIR *dir = opendir(nodeDir.c_str());
+        if (dir == nullptr) {
+            return;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            int node = 0;
+            if (sscanf(entry->d_name, "node%d", &node) != 1 || node < 0 || node >= NUMA_MAX_NODES) {
+                continue;
+            }
+            std::vector<int> cpus = parseCpuList(nodeDir + "/" + entry->d_name + "/cpulist");
+            if (cpus.empty()) {
+                continue;   // memory-only node, nobody reads from it
+            }
+            _nodes.push_back(node);
+            for (size_t i = 0; i < cpus.size(); ++i) {
+                if (static_cast<size_t>(cpus[i]) >= _cpuNode.size()) {
+                    _cpuNode.resize(cpus[i] + 1, -1);
+                }
+                _cpuNode[cpus[i]] = node;
+            }
+            _nodeCpus.push_back(cpus);
+        }
+        closedir(dir);
+        // keep _nodes and _nodeCpus sorted by node id
+        for (size_t i = 1; i < _nodes.size(); ++i) {
+            for (size_t j = i; j > 0 && _nodes[j - 1] > _nodes[j]; --j) {
+                std::swap(_nodes[j - 1], _nodes[j]);
+                std::swap(_nodeCpus[j - 1], _nodeCpus[j]);
+            }
+        }
+    }
+
+    static const NumaTopology &instance() {
+        static NumaTopology topology;
+        return topology;
+    }
+
+    size_t nodeCount() const { return _nodes.size(); }
+    // 第index个有CPU的节点的id
+    int nodeId(size_t index) const { return _nodes[index]; }
+    const std::vector<int> &nodeCpus(size_t index) const { return _nodeCpus[index]; }
+
+    // cpu所在节点在nodeId中的下标, 未知时返回0
+    size_t nodeIndexOfCpu(int cpu) const {
+        if (cpu < 0 || static_cast<size_t>(cpu) >= _cpuNode.size() || _cpuNode[cpu] < 0) {
+            return 0;
+        }
+        for (size_t i = 0; i < _nodes.size(); ++i) {
+            if (_nodes[i] == _cpuNode[cpu]) {
+                return i;
+            }
+        }
+        return 0;
+    }
+
+    size_t currentNodeIndex() const { return nodeIndexOfCpu(sched_getcpu()); }
+
+    /**
+     * @brief 把调用线程绑定到第index个节点的CPU上, 并只从该节点分配内存
+     */
+    bool bindCurrentThread(size_t index) const {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (size_t i = 0; i < _nodeCpus[index].size(); ++i) {
+            CPU_SET(_nodeCpus[index][i], &set);
+        }
+        bool ok = sched_setaffinity(0, sizeof(set), &set) == 0;
+        unsigned long mask = 1UL << _nodes[index];
+        ok = syscall(SYS_set_mempolicy, NUMA_MPOL_BIND, &mask, NUMA_MAX_NODES + 1) == 0 && ok;
+        return ok;
+    }
+
+    static void resetMemPolicy() {
+        syscall(SYS_set_mempolicy, NUMA_MPOL_DEFAULT, nullptr, 0);
+    }
+
+    /**
+     * @brief addr所在页的节点在nodeId中的下标, 查询失败时返回fallback
+     * 只看这一页, 对象内部指向的内存可能在别的节点上
+     */
+    size_t nodeIndexOfAddress(const void *addr, size_t fallback) const {
+        int node = -1;
+        if (syscall(SYS_get_mempolicy, &node, nullptr, 0, addr,
+                NUMA_MPOL_F_NODE | NUMA_MPOL_F_ADDR) != 0) {
+            return fallback;
+        }
+        for (size_t i = 0; i < _nodes.size(); ++i) {
+            if (_nodes[i] == node) {
+                return i;
+            }
+        }
+        return fallback;
+    }
+
+    // 节点上已使用的内存, 用于估算副本大小
+    static uint64_t nodeMemUsed(int node, const std::string &nodeDir = "/sys/devices/system/node") {
+        std::ostringstream path;
+        path << nodeDir << "/node" << node << "/meminfo";
+        std::ifstream in(path.str().c_str());
+        std::string line;
+        while (getline(in, line)) {
+            size_t pos = line.find("MemUsed:");
+            if (pos != std::string::npos) {
+                return strtoull(line.c_str() + pos + 8, nullptr, 10) << 10;
+            }
+        }
+        return 0;
+    }
+
+private:
+    // "0-3,8-11"
+    static std::vector<int> parseCpuList(const std::string &fileName) {
+        std::vector<int> cpus;
+        std::ifstream in(fileName.c_str());
+        std::string list;
+        if (!(in >> list)) {
+            return cpus;
+        }
+        std::istringstream ranges(list);
+        std::string range;
+        while (getline(ranges, range, ',')) {
+            int first = 0;
+            int last = 0;
+            int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+            if (n == 1) {
+                last = first;
+            } else if (n != 2) {
+                continue;
+            }
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    std::vector<int> _nodes;
+    std::vector<std::vector<int> > _nodeCpus;
+    std::vector<int> _cpuNode;
+};
+
+template<class T, class = void>
+struct HasMemoryBytes : std::false_type {};
+
+template<class T>
+struct HasMemoryBytes<T, decltype(std::declval<const T&>().memoryBytes(), void())> : std::true_type {};
+
+// 默认的副本构造函数, 需要DictType可拷贝构造
+template<class DictType>
+inline DictType *DefaultReplicateFunc(const DictType &source) {
+    return new DictType(source);
+}
+
+/**
+ * @brief 一个词典版本在所有NUMA节点上的副本
+ * primary所在节点直接用primary, 不再拷贝, 内存里共N份而不是N+1份.
+ * 某个节点复制失败时该节点的读者退回primary.
+ * 读者所在节点与它拿到的副本所在节点不同时计入跨节点访问
+ */
+template<class DictType>
+class NumaReplicaSet {
+public:
+    typedef DictType *(*ReplicateFunc)(const DictType &source);
+
+    /**
+     * @brief 在primary所在节点之外的每个节点上并行复制primary, primary的所有权不转移,
+     * 需要比返回的副本集活得更久
+     * @return 只有一个节点时返回nullptr
+     */
+    static NumaReplicaSet *build(const DictType *primary, ReplicateFunc replicate,
+            const NumaTopology &topology = NumaTopology::instance()) {
+        if (topology.nodeCount() <= 1) {
+            return nullptr;
+        }
+        NumaReplicaSet *set = new NumaReplicaSet(primary, topology);
+        size_t home = set->_primaryIndex;
+        set->_replicas[home] = primary;
+        set->_bound[home] = true;
+        set->_bytes[home] = primaryBytes(*primary, HasMemoryBytes<DictType>());
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < topology.nodeCount(); ++i) {
+            if (i == home) {
+                continue;
+            }
+            workers.emplace_back([set, primary, replicate, &topology, i]() {
+                bool bound = topology.bindCurrentThread(i);
+                uint64_t usedBefore = NumaTopology::nodeMemUsed(topology.nodeId(i));
+                DictType *replica = nullptr;
+                try {
+                    replica = replicate(*primary);
+                } catch (...) {
+                    replica = nullptr;
+                }
+                NumaTopology::resetMemPolicy();
+                if (replica == nullptr) {
+                    return;
+                }
+                set->_replicas[i] = replica;
+                set->_bound[i] = bound;
+                set->_homes[i] = topology.nodeIndexOfAddress(replica, bound ? i : set->_primaryIndex);
+                set->_bytes[i] = replicaBytes(*replica, usedBefore, topology.nodeId(i),
+                        HasMemoryBytes<DictType>());
+            });
+        }
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+        return set;
+    }
+
+    ~NumaReplicaSet() {
+        for (size_t i = 0; i < _replicas.size(); ++i) {
+            if (_replicas[i] != _primary) {
+                delete _replicas[i];
+            }
+        }
+        delete [] _counters;
+    }
+
+    NumaReplicaSet(const NumaReplicaSet&) = delete;
+    NumaReplicaSet& operator=(const NumaReplicaSet&) = delete;
+
+    // 调用线程所在节点的副本
+    const DictType *local() const {
+        size_t index = _topology.currentNodeIndex();
+        const DictType *replica = _replicas[index];
+        static thread_local uint32_t reads = 0;
+        if (++reads >= NUMA_READ_SAMPLE) {
+            reads = 0;
+            _counters[index].reads.fetch_add(NUMA_READ_SAMPLE, std::memory_order_relaxed);
+            if (_homes[index] != index) {
+                _counters[index].remoteReads.fetch_add(NUMA_READ_SAMPLE, std::memory_order_relaxed);
+            }
+        }
+        return replica != nullptr ? replica : _primary;
+    }
+
+    size_t nodeCount() const { return _replicas.size(); }
+    // 第index个节点的读者拿到的词典, 复制失败的节点为nullptr
+    const DictType *replica(size_t index) const { return _replicas[index]; }
+    // primary所在节点的下标, 该节点的副本就是primary
+    size_t primaryIndex() const { return _primaryIndex; }
+    // 第index个节点的读者拿到的词典实际所在节点的下标, 与index不同说明该节点的读是跨节点的
+    size_t homeIndex(size_t index) const { return _homes[index]; }
+    // 副本占用的内存; DictType没有memoryBytes()时为复制前后节点MemUsed之差, 只是估计值
+    uint64_t replicaBytes(size_t index) const { return _bytes[index]; }
+    // 抽样计数, 误差在NUMA_READ_SAMPLE以内; remoteReads为读者节点与homeIndex不同的读
+    uint64_t reads(size_t index) const { return _counters[index].reads.load(); }
+    uint64_t remoteReads(size_t index) const { return _counters[index].remoteReads.load(); }
+
+    std::string report() const {
+        std::ostringstream out;
+        for (size_t i = 0; i < _replicas.size(); ++i) {
+            out << "node" << _topology.nodeId(i) << "[replica:" << (_replicas[i] != nullptr)
+                << " primary:" << (i == _primaryIndex) << " home:node" << _topology.nodeId(_homes[i])
+                << " bound:" << (_bound[i] != 0) << " bytes:" << _bytes[i]
+                << " reads:" << reads(i) << " remote_reads:" << remoteReads(i) << "] ";
+        }
+        return out.str();
+    }
+
+private:
+    struct alignas(64) Counter {
+        Counter() : reads(0), remoteReads(0) {}
+        std::atomic<uint64_t> reads;
+        std::atomic<uint64_t> remoteReads;
+    };
+
+    // primary在哪个节点上按它的地址查, 查不到时取加载线程当前所在的节点
+    NumaReplicaSet(const DictType *primary, const NumaTopology &topology)
+        : _primary(primary), _topology(topology),
+          _primaryIndex(topology.nodeIndexOfAddress(primary, topology.currentNodeIndex())),
+          _replicas(topology.nodeCount(), nullptr), _homes(topology.nodeCount(), _primaryIndex),
+          _bytes(topology.nodeCount(), 0), _bound(topology.nodeCount(), false),
+          _counters(new Counter[topology.nodeCount()]) {}
+
+    // primary不是在这里分配的, 没有memoryBytes()时无从估计, 记为0
+    static uint64_t primaryBytes(const DictType &primary, std::true_type) { return primary.memoryBytes(); }
+    static uint64_t primaryBytes(const DictType &, std::false_type) { return 0; }
+
+    static uint64_t replicaBytes(const DictType &replica, uint64_t, int, std::true_type) {
+        return replica.memoryBytes();
+    }
+
+    static uint64_t replicaBytes(const DictType &, uint64_t usedBefore, int node, std::false_type) {
+        uint64_t usedAfter = NumaTopology::nodeMemUsed(node);
+        return usedAfter > usedBefore ? usedAfter - usedBefore : 0;
+    }
+
+    const DictType *_primary;
+    const NumaTopology &_topology;
+    size_t _primaryIndex;
+    // _replicas[_primaryIndex] == _primary, not owned
+    std::vector<const DictType*> _replicas;
+    std::vector<size_t> _homes;
+    std::vector<uint64_t> _bytes;
+    std::vector<char> _bound;
+    Counter *_counters;
+};
+
+} // end namespace StemCell
+#endif
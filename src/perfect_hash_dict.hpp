@@ -0,0 +1,410 @@
+/**
+ * @brief 基于最小完美hash的只读字符串词典
+ *
+ * 构建方式与PTHash相同: key先按hash分到约n/PHF_BUCKET_SIZE个bucket,
+ * 从大到小为每个bucket搜索一个pilot, 使bucket内所有key落在表中互不冲突的空位上.
+ * 表大小为n/PHF_ALPHA, 落在[n, m)的位置再通过remap数组映射回[0, n)的空位,
+ * 所以最终n个key正好占满n个slot. 索引只有每个bucket一个uint16_t的pilot加上很小的remap表,
+ * 查找时只算一次位置, 再比较该slot上的key(或指纹)确认是否命中.
+ * 每个slot是一条记录, 确认用的数据(指纹、key长度、短key本身或长key的偏移)和value放在一起,
+ * pilot表很小, 通常在cache里, 查找只有读slot记录这一次随机访存;
+ * 记录占满一个cache line, 放不下的长key在32位tag相同时才去读_keyBytes.
+ */
+#ifndef PERFECT_HASH_DICT_HPP
+#define PERFECT_HASH_DICT_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include "dict.h"
+#include "batch_lookup.h"
+
+namespace StemCell {
+
+#define PHF_BUCKET_SIZE 5       // 每个bucket平均的key个数
+#define PHF_ALPHA 0.98          // 构建时的装载率
+#define PHF_MAX_PILOT 0xFFFF
+#define PHF_MAX_SEEDS 16
+#define PHF_SLOT_BYTES 64        // VERIFY_KEY时一条slot记录的大小, 正好一个cache line
+
+template<class V>
+class PerfectHashDict {
+public:
+    typedef std::string key_type;
+    typedef V mapped_type;
+
+    /**
+     * @brief 命中确认方式
+     * VERIFY_KEY: 保存完整key, 结果精确
+     * VERIFY_FINGERPRINT: 只保存16位指纹, 不存在的key约有1/65536的概率被误判为命中
+     */
+    enum VerifyMode {
+        VERIFY_KEY = 0,
+        VERIFY_FINGERPRINT = 1
+    };
+
+    /**
+     * @brief 从 key \t value 格式的TSV文件构建, 失败时抛出int,
+     * 可以直接作为HotSwitchDict的DictType使用
+     */
+    explicit PerfectHashDict(const char *fileName, VerifyMode mode = VERIFY_KEY) {
+        std::vector<std::pair<std::string, V> > *entries =
+            Dict::buildVectorDict<std::string, V>(fileName);
+        if (entries == nullptr) {
+            throw -1;
+        }
+        bool ok = build(std::move(*entries), mode);
+        delete entries;
+        if (!ok) {
+            throw -1;
+        }
+    }
+
+    // 重复的key以后出现的为准; 构建失败时抛出int
+    explicit PerfectHashDict(std::vector<std::pair<std::string, V> > &&entries,
+            VerifyMode mode = VERIFY_KEY) {
+        if (!build(std::move(entries), mode)) {
+            throw -1;
+        }
+    }
+
+    // key -> 行号, 替代Dict::buildLineNoHashMapDict<std::string>
+    static PerfectHashDict *buildLineNoDict(const std::string &fileName) {
+        std::unordered_map<std::string, int32_t> *lineNo =
+            Dict::buildLineNoHashMapDict<std::string>(fileName);
+        if (lineNo == nullptr) {
+            return nullptr;
+        }
+        std::vector<std::pair<std::string, V> > entries;
+        entries.reserve(lineNo->size());
+        for (auto it = lineNo->begin(); it != lineNo->end(); ++it) {
+            entries.emplace_back(it->first, static_cast<V>(it->second));
+        }
+        delete lineNo;
+        try {
+            return new PerfectHashDict(std::move(entries));
+        } catch (int e) {
+            return nullptr;
+        }
+    }
+
+    // 不存在时返回nullptr
+    const V *find(std::string_view key) const {
+        if (_size == 0) {
+            return nullptr;
+        }
+        uint64_t hash = hashKey(key, _seed);
+        return lookup(slotOf(hash), key, hash);
+    }
+
+    size_t count(std::string_view key) const { return find(key) != nullptr ? 1 : 0; }
+
+    /**
+     * @brief 批量查找, out[i]为keys[i]对应的value, 不存在时为nullptr
+     * 分三趟: 算hash并预取pilot; 算slot并预取确认数据和value; 最后确认
+     */
+    template<class KeyType>
+    void lookupBatch(const KeyType *keys, size_t n, const V **out) const {
+        if (_size == 0) {
+            for (size_t i = 0; i < n; ++i) {
+                out[i] = nullptr;
+            }
+            return;
+        }
+        uint64_t hashes[LOOKUP_BATCH_BLOCK];
+        size_t slots[LOOKUP_BATCH_BLOCK];
+        for (size_t begin = 0; begin < n; begin += LOOKUP_BATCH_BLOCK) {
+            size_t count = std::min<size_t>(LOOKUP_BATCH_BLOCK, n - begin);
+            for (size_t j = 0; j < count; ++j) {
+                hashes[j] = hashKey(keys[begin + j], _seed);
+                prefetchRead(&_pilots[bucketOf(hashes[j])]);
+            }
+            for (size_t j = 0; j < count; ++j) {
+                slots[j] = slotOf(hashes[j]);
+                if (_mode == VERIFY_KEY) {
+                    prefetchRead(&_keySlots[slots[j]]);
+                } else {
+                    prefetchRead(&_fingerprintSlots[slots[j]]);
+                }
+            }
+            for (size_t j = 0; j < count; ++j) {
+                out[begin + j] = lookup(slots[j], std::string_view(keys[begin + j]), hashes[j]);
+            }
+        }
+    }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    // 完美hash索引本身(pilot + remap)的字节数
+    size_t indexBytes() const {
+        return _pilots.capacity() * sizeof(uint16_t) + _remap.capacity() * sizeof(uint32_t);
+    }
+
+    // 索引、slot记录与长key的总字节数
+    size_t memoryBytes() const {
+        return indexBytes() + _keyBytes.capacity() + _keySlots.capacity() * sizeof(KeySlot)
+            + _fingerprintSlots.capacity() * sizeof(FingerprintSlot);
+    }
+
+    // 切换前预热, 返回触碰的页数
+    size_t prefault() const {
+        return prefaultMemory(_pilots.data(), _pilots.size() * sizeof(uint16_t))
+            + prefaultMemory(_remap.data(), _remap.size() * sizeof(uint32_t))
+            + prefaultMemory(_keyBytes.data(), _keyBytes.size())
+            + prefaultMemory(_keySlots.data(), _keySlots.size() * sizeof(KeySlot))
+            + prefaultMemory(_fingerprintSlots.data(), _fingerprintSlots.size() * sizeof(FingerprintSlot));
+    }
+
+    double indexBitsPerKey() const { return empty() ? 0 : indexBytes() * 8.0 / size(); }
+    double bytesPerKey() const { return empty() ? 0 : static_cast<double>(memoryBytes()) / size(); }
+
+private:
+    // 记录里除了tag、长度和value, 剩下的空间都用来存key
+    static const size_t INLINE_KEY_BYTES = sizeof(V) + 16 <= PHF_SLOT_BYTES
+        ? PHF_SLOT_BYTES - 8 - sizeof(V) : 8;
+
+    // VERIFY_KEY的slot记录, 按cache line对齐
+    struct alignas(PHF_SLOT_BYTES) KeySlot {
+        uint32_t tag;           // hash的低32位, 不同时不用再比较key
+        uint32_t length;
+        // the key itself, or its uint64_t offset in _keyBytes when length > INLINE_KEY_BYTES
+        char key[INLINE_KEY_BYTES];
+        V value;
+    };
+    static_assert(sizeof(V) + 16 > PHF_SLOT_BYTES || sizeof(KeySlot) == PHF_SLOT_BYTES,
+            "a slot record should fill exactly one cache line");
+
+    struct FingerprintSlot {
+        uint16_t fingerprint;
+        V value;
+    };
+
+    static uint64_t mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static uint64_t hashKey(std::string_view key, uint64_t seed) {
+        uint64_t h = seed ^ (key.size() * 0x9e3779b97f4a7c15ULL);
+        const char *p = key.data();
+        size_t len = key.size();
+        while (len >= 8) {
+            uint64_t word;
+            memcpy(&word, p, 8);
+            h = mix(h ^ word) * 0x9e3779b97f4a7c15ULL;
+            p += 8;
+            len -= 8;
+        }
+        uint64_t tail = 0;
+        memcpy(&tail, p, len);
+        return mix(h ^ tail);
+    }
+
+    static uint16_t fingerprint(uint64_t hash) { return static_cast<uint16_t>(hash >> 48); }
+    // bucketOf uses the high bits, take the tag from the low ones
+    static uint32_t tagOf(uint64_t hash) { return static_cast<uint32_t>(hash); }
+
+    size_t bucketOf(uint64_t hash) const {
+        return static_cast<size_t>(((hash >> 32) * _bucketCount) >> 32);
+    }
+
+    size_t positionOf(uint64_t hash, uint64_t pilot) const {
+        return mix(hash ^ (pilot * 0x9e3779b97f4a7c15ULL + 1)) % _tableSize;
+    }
+
+    size_t slotOf(uint64_t hash) const {
+        size_t pos = positionOf(hash, _pilots[bucketOf(hash)]);
+        return pos < _size ? pos : _remap[pos - _size];
+    }
+
+    // slot上的记录确认为key时返回value
+    const V *lookup(size_t slot, std::string_view key, uint64_t hash) const {
+        if (_mode == VERIFY_FINGERPRINT) {
+            const FingerprintSlot &record = _fingerprintSlots[slot];
+            return record.fingerprint == fingerprint(hash) ? &record.value : nullptr;
+        }
+        const KeySlot &record = _keySlots[slot];
+        if (record.tag != tagOf(hash) || record.length != key.size()) {
+            return nullptr;
+        }
+        const char *stored = record.key;
+        if (key.size() > INLINE_KEY_BYTES) {
+            uint64_t offset;
+            memcpy(&offset, record.key, sizeof(offset));
+            stored = _keyBytes.data() + offset;
+        }
+        return memcmp(stored, key.data(), key.size()) == 0 ? &record.value : nullptr;
+    }
+
+    bool build(std::vector<std::pair<std::string, V> > &&entries, VerifyMode mode) {
+        _mode = mode;
+        // dedupe, the last value of a duplicated key wins
+        std::stable_sort(entries.begin(), entries.end(),
+                [](const std::pair<std::string, V> &a, const std::pair<std::string, V> &b) {
+                    return a.first < b.first;
+                });
+        size_t n = 0;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (i + 1 < entries.size() && entries[i].first == entries[i + 1].first) {
+                continue;
+            }
+            if (n != i) {
+                entries[n] = std::move(entries[i]);
+            }
+            ++n;
+        }
+        entries.resize(n);
+
+        std::vector<size_t> slots;
+        for (uint64_t attempt = 0; attempt < PHF_MAX_SEEDS; ++attempt) {
+            _seed = mix(attempt + 0x5354454d43454c4cULL);
+            if (searchPilots(entries, slots)) {
+                fill(entries, slots);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool searchPilots(const std::vector<std::pair<std::string, V> > &entries,
+            std::vector<size_t> &slots) {
+        const size_t n = entries.size();
+        _bucketCount = n / PHF_BUCKET_SIZE + 1;
+        _tableSize = static_cast<size_t>(n / PHF_ALPHA) + 1;
+        _pilots.assign(_bucketCount, 0);
+
+        std::vector<uint64_t> hashes(n);
+        std::vector<std::pair<size_t, size_t> > order(n);    // (bucket, key index)
+        for (size_t i = 0; i < n; ++i) {
+            hashes[i] = hashKey(entries[i].first, _seed);
+            order[i] = std::make_pair(bucketOf(hashes[i]), i);
+        }
+        std::sort(order.begin(), order.end());
+        // bucket ranges in order, largest buckets are placed first
+        std::vector<std::pair<size_t, size_t> > buckets;     // (begin, end) in order
+        for (size_t i = 0; i < n; ) {
+            size_t j = i;
+            while (j < n && order[j].first == order[i].first) ++j;
+            buckets.push_back(std::make_pair(i, j));
+            i = j;
+        }
+        std::stable_sort(buckets.begin(), buckets.end(),
+                [](const std::pair<size_t, size_t> &a, const std::pair<size_t, size_t> &b) {
+                    return a.second - a.first > b.second - b.first;
+                });
+
+        std::vector<bool> taken(_tableSize, false);
+        std::vector<size_t> positions;
+        slots.assign(n, 0);
+        for (size_t b = 0; b < buckets.size(); ++b) {
+            size_t begin = buckets[b].first;
+            size_t end = buckets[b].second;
+            bool placed = false;
+            for (uint64_t pilot = 0; pilot <= PHF_MAX_PILOT && !placed; ++pilot) {
+                positions.clear();
+                placed = true;
+                for (size_t k = begin; k < end; ++k) {
+                    size_t pos = positionOf(hashes[order[k].second], pilot);
+                    if (taken[pos] || std::find(positions.begin(), positions.end(), pos)
+                            != positions.end()) {
+                        placed = false;
+                        break;
+                    }
+                    positions.push_back(pos);
+                }
+                if (placed) {
+                    _pilots[order[begin].first] = static_cast<uint16_t>(pilot);
+                }
+            }
+            if (!placed) {
+                return false;
+            }
+            for (size_t k = begin; k < end; ++k) {
+                taken[positions[k - begin]] = true;
+                slots[order[k].second] = positions[k - begin];
+            }
+        }
+
+        // positions beyond n are remapped onto the holes left below n
+        _remap.assign(_tableSize - n, 0);
+        size_t hole = 0;
+        for (size_t pos = n; pos < _tableSize; ++pos) {
+            if (!taken[pos]) {
+                continue;
+            }
+            while (taken[hole]) ++hole;
+            _remap[pos - n] = static_cast<uint32_t>(hole++);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            if (slots[i] >= n) {
+                slots[i] = _remap[slots[i] - n];
+            }
+        }
+        return true;
+    }
+
+    void fill(std::vector<std::pair<std::string, V> > &entries, const std::vector<size_t> &slots) {
+        const size_t n = entries.size();
+        std::vector<size_t> keyOf(n);
+        for (size_t i = 0; i < n; ++i) {
+            keyOf[slots[i]] = i;
+        }
+        _size = n;
+        _keyBytes.clear();
+        _keySlots.clear();
+        _fingerprintSlots.clear();
+        if (_mode == VERIFY_KEY) {
+            _keySlots.resize(n);
+        } else {
+            _fingerprintSlots.resize(n);
+        }
+        for (size_t slot = 0; slot < n; ++slot) {
+            std::pair<std::string, V> &entry = entries[keyOf[slot]];
+            uint64_t hash = hashKey(entry.first, _seed);
+            if (_mode == VERIFY_FINGERPRINT) {
+                _fingerprintSlots[slot].fingerprint = fingerprint(hash);
+                _fingerprintSlots[slot].value = std::move(entry.second);
+                continue;
+            }
+            KeySlot &record = _keySlots[slot];
+            record.tag = tagOf(hash);
+            record.length = static_cast<uint32_t>(entry.first.size());
+            if (entry.first.size() <= INLINE_KEY_BYTES) {
+                memcpy(record.key, entry.first.data(), entry.first.size());
+            } else {
+                uint64_t offset = _keyBytes.size();
+                memcpy(record.key, &offset, sizeof(offset));
+                _keyBytes.append(entry.first);
+            }
+            record.value = std::move(entry.second);
+        }
+        _keyBytes.shrink_to_fit();
+        entries.clear();
+        entries.shrink_to_fit();
+    }
+
+    VerifyMode _mode;
+    uint64_t _seed;
+    size_t _bucketCount;
+    size_t _tableSize;
+    size_t _size;
+    std::vector<uint16_t> _pilots;
+    std::vector<uint32_t> _remap;
+    std::string _keyBytes;          // keys longer than INLINE_KEY_BYTES
+    std::vector<KeySlot> _keySlots;
+    std::vector<FingerprintSlot> _fingerprintSlots;
+};
+
+// SIMapDict的完美hash版本
+typedef PerfectHashDict<int32_t> SIPerfectHashDict;
+
+} // end namespace StemCell
+#endif
@@ -0,0 +1,236 @@
+/**
+ * @brief 流水线加载词典文件用到的组件
+ *
+ * LOAD_MODE_PIPELINE下一个文件的加载分成三级:
+ *   读取: 一个线程按块顺序read(), 每块在行边界截断, 并提前对下一块发起readahead
+ *   解析: 若干线程把每块解析成一个小词典
+ *   插入: 调用线程按块的顺序把小词典合并进最终的词典
+ * 各级之间用有界队列连接, 在途的块数有上限, 内存占用与文件大小无关.
+ * 慢盘或网络盘上读取与解析、插入完全重叠, 每级的耗时和等待时间记录在PipelineLoadStats里.
+ */
+#ifndef PIPELINE_LOADER_H
+#define PIPELINE_LOADER_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <sstream>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <utility>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace StemCell {
+
+#define PIPELINE_LOAD_BLOCK_BYTES (4 << 20)
+#define PIPELINE_LOAD_QUEUE_DEPTH 4
+
+/**
+ * @brief 有界阻塞队列, close()之后push失败, pop取完剩余元素后失败
+ */
+template<class T>
+class BoundedBlockingQueue {
+public:
+    explicit BoundedBlockingQueue(size_t capacity) : _capacity(std::max<size_t>(capacity, 1)), _closed(false) {}
+
+    BoundedBlockingQueue(const BoundedBlockingQueue&) = delete;
+    BoundedBlockingQueue& operator=(const BoundedBlockingQueue&) = delete;
+
+    bool push(T &&item) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notFull.wait(lock, [this]() { return _closed || _items.size() < _capacity; });
+        if (_closed) {
+            return false;
+        }
+        _items.push_back(std::move(item));
+        _notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notEmpty.wait(lock, [this]() { return _closed || !_items.empty(); });
+        if (_items.empty()) {
+            return false;
+        }
+        item = std::move(_items.front());
+        _items.pop_front();
+        _notFull.notify_one();
+        return true;
+    }
+
+    // 队列为空时立即返回false
+    bool tryPop(T &item) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_items.empty()) {
+            return false;
+        }
+        item = std::move(_items.front());
+        _items.pop_front();
+        _notFull.notify_one();
+        return true;
+    }
+
+    // 队列已满时立即返回false
+    bool tryPush(T &&item) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_closed || _items.size() >= _capacity) {
+            return false;
+        }
+        _items.push_back(std::move(item));
+        _notEmpty.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _notFull.notify_all();
+        _notEmpty.notify_all();
+    }
+
+private:
+    const size_t _capacity;
+    std::mutex _mutex;
+    std::condition_variable _notFull;
+    std::condition_variable _notEmpty;
+    std::deque<T> _items;
+    bool _closed;
+};
+
+/**
+ * @brief 一次流水线加载的统计, 耗时单位为毫秒
+ * xxxMs为该级实际干活的时间(解析为所有解析线程之和), xxxStallMs为等待上下游的时间
+ */
+struct PipelineLoadStats {
+    PipelineLoadStats() : blocks(0), bytes(0), lines(0), parsers(0), totalMs(0),
+        readMs(0), readStallMs(0), parseMs(0), parseStallMs(0), insertMs(0), insertStallMs(0) {}
+
+    size_t blocks;
+    uint64_t bytes;
+    int64_t lines;
+    size_t parsers;
+    int64_t totalMs;
+    int64_t readMs;
+    int64_t readStallMs;
+    int64_t parseMs;
+    int64_t parseStallMs;
+    int64_t insertMs;
+    int64_t insertStallMs;
+
+    // 每级按自身干活时间计算的吞吐, MB/s
+    static double throughput(uint64_t bytes, int64_t ms) {
+        return ms <= 0 ? 0 : bytes / 1048576.0 * 1000 / ms;
+    }
+
+    std::string report() const {
+        std::ostringstream out;
+        out << "blocks:" << blocks << " bytes:" << bytes << " lines:" << lines << " total_ms:" << totalMs
+            << " read[ms:" << readMs << " stall_ms:" << readStallMs
+            << " MB/s:" << throughput(bytes, readMs) << "]"
+            << " parse[threads:" << parsers << " ms:" << parseMs << " stall_ms:" << parseStallMs
+            << " MB/s:" << throughput(bytes * parsers, parseMs) << "]"
+            << " insert[ms:" << insertMs << " stall_ms:" << insertStallMs
+            << " MB/s:" << throughput(bytes, insertMs) << "]";
+        return out.str();
+    }
+};
+
+/**
+ * @brief 按块顺序读取文件, 每块以完整的行结束
+ * 每读完一块就对下一块发起POSIX_FADV_WILLNEED, 让内核在解析当前块时异步读盘
+ */
+class BlockReader {
+public:
+    explicit BlockReader(size_t blockBytes = PIPELINE_LOAD_BLOCK_BYTES)
+        : _fd(-1), _blockBytes(std::max<size_t>(blockBytes, 4096)), _offset(0), _eof(false), _failed(false) {}
+
+    ~BlockReader() {
+        if (_fd >= 0) {
+            close(_fd);
+        }
+    }
+
+    BlockReader(const BlockReader&) = delete;
+    BlockReader& operator=(const BlockReader&) = delete;
+
+    bool open(const std::string &fileName) {
+        _fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+        if (_fd < 0) {
+            return false;
+        }
+        posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        posix_fadvise(_fd, 0, _blockBytes, POSIX_FADV_WILLNEED);
+        return true;
+    }
+
+    /**
+     * @brief 读取下一块到buffer[0, size), buffer按需扩容
+     * 除文件的最后一块外, 每块都以'\n'结束; 一行比块还长时整行放在同一块里
+     * @return 没有更多数据或读取出错时返回false, 出错时failed()为true
+     */
+    bool next(std::vector<char> &buffer, size_t &size) {
+        size = _carry.size();
+        if (buffer.size() < size + _blockBytes) {
+            buffer.resize(size + _blockBytes);
+        }
+        if (!_carry.empty()) {
+            memcpy(buffer.data(), _carry.data(), _carry.size());
+            _carry.clear();
+        }
+        while (true) {
+            while (!_eof && size < buffer.size()) {
+                ssize_t n = read(_fd, buffer.data() + size, buffer.size() - size);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n < 0) {
+                    _failed = true;
+                    return false;
+                }
+                if (n == 0) {
+                    _eof = true;
+                    break;
+                }
+                size += n;
+                _offset += n;
+            }
+            if (!_eof) {
+                posix_fadvise(_fd, _offset, _blockBytes, POSIX_FADV_WILLNEED);
+            }
+            if (size == 0) {
+                return false;
+            }
+            if (_eof) {
+                return true;
+            }
+            const char *newline = static_cast<const char*>(memrchr(buffer.data(), '\n', size));
+            if (newline != nullptr) {
+                size_t lineEnd = newline - buffer.data() + 1;
+                _carry.assign(buffer.data() + lineEnd, buffer.data() + size);
+                size = lineEnd;
+                return true;
+            }
+            // a single line longer than the buffer
+            buffer.resize(buffer.size() * 2);
+        }
+    }
+
+    bool failed() const { return _failed; }
+
+private:
+    int _fd;
+    size_t _blockBytes;
+    uint64_t _offset;
+    bool _eof;
+    bool _failed;
+    std::vector<char> _carry;
+};
+
+} // end namespace StemCell
+#endif
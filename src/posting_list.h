@@ -0,0 +1,517 @@
+/**
+ * @brief 压缩存储的整数列表(posting list)词典, 对应std::map<K, std::vector<T> >
+ *
+ * 每个列表先写一个varint头(元素个数 << 1 | 是否zigzag), 再按varint写第一个元素,
+ * 之后是与前一个元素的差值: 单调不减的列表差值直接存, 其他列表的差值先做zigzag变换.
+ * 差值每POSTING_LIST_BLOCK个一块按位打包: 块头一个字节是块内最大差值的位数, 后面是紧密排列的差值,
+ * 位数超过POSTING_LIST_MAX_PACKED_WIDTH时按64位存. 有序的id列表差值很小, 一般每个id不到一个字节.
+ * 解码每个差值是一次8字节读、移位和掩码, 没有逐字节的分支; 按小端序存放.
+ * 满块按位数特化展开, 尾块走通用循环. posting_list_benchmark里decode + scan比遍历std::vector
+ * 慢约15%(逐字节varint时慢约80%); 数据都在cache里时仍慢约2倍, 只有几个元素的短列表与varint持平.
+ * 原地迭代每个元素多一次块内位置计算, 比decode慢, 需要遍历整个列表时优先用decode.
+ * 所有列表连续存放在一块内存里, key有序存放在另一个数组里, 没有每个列表一个vector的分配开销.
+ * 查找得到PostingListRef, 可以解码到调用方提供的缓冲区, 也可以原地迭代.
+ * 加载时用PostingListBuilder逐行编码, 不需要先建出未压缩的std::map<K, std::vector<T> >.
+ */
+#ifndef POSTING_LIST_H
+#define POSTING_LIST_H
+
+#include <vector>
+#include <map>
+#include <iterator>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+#include "mmap_file.h"
+
+namespace StemCell {
+
+#define VARINT_MAX_BYTES 10
+#define POSTING_LIST_BLOCK 32
+// 一次8字节读能取出的最大位数(起始位偏移最多为7)
+#define POSTING_LIST_MAX_PACKED_WIDTH 57
+// 解码会读到列表末尾之后最多8个字节, 存放列表的内存末尾要留出这么多可读字节
+#define POSTING_LIST_PADDING 8
+
+inline size_t encodeVarint(uint64_t value, uint8_t *out) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = static_cast<uint8_t>(value);
+    return n;
+}
+
+inline const uint8_t *decodeVarint(const uint8_t *p, uint64_t &value) {
+    // most deltas of a sorted id list fit in one byte
+    if (*p < 0x80) {
+        value = *p;
+        return p + 1;
+    }
+    uint64_t result = *p++ & 0x7f;
+    int shift = 7;
+    while (*p >= 0x80) {
+        result |= static_cast<uint64_t>(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    value = result | static_cast<uint64_t>(*p++) << shift;
+    return p;
+}
+
+inline uint64_t zigzagEncode(uint64_t delta) {
+    return (delta << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(delta) >> 63);
+}
+
+inline uint64_t zigzagDecode(uint64_t value) {
+    return (value >> 1) ^ (0 - (value & 1));
+}
+
+// count个width位的值打包后占用的字节数
+inline size_t packedBytes(size_t count, unsigned width) {
+    return (count * width + 7) / 8;
+}
+
+// 打包位数: 不超过POSTING_LIST_MAX_PACKED_WIDTH时为最大值的有效位数, 否则为64
+inline unsigned packedWidth(uint64_t bits) {
+    unsigned width = bits == 0 ? 0 : 64 - __builtin_clzll(bits);
+    return width > POSTING_LIST_MAX_PACKED_WIDTH ? 64 : width;
+}
+
+inline uint64_t loadPacked(const uint8_t *p) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+inline uint64_t packedMask(unsigned width) {
+    return width == 64 ? ~0ULL : (1ULL << width) - 1;
+}
+
+/**
+ * @brief 把count(不超过POSTING_LIST_BLOCK)个值按width位打包写到out, 返回写入的字节数
+ * out需要留出packedBytes(count, width) + 8字节
+ */
+inline size_t packBlock(const uint64_t *values, size_t count, unsigned width, uint8_t *out) {
+    size_t bytes = packedBytes(count, width);
+    memset(out, 0, bytes + sizeof(uint64_t));
+    for (size_t i = 0; i < count; ++i) {
+        size_t bit = i * width;
+        uint64_t word = loadPacked(out + bit / 8) | values[i] << (bit % 8);
+        memcpy(out + bit / 8, &word, sizeof(word));
+    }
+    return bytes;
+}
+
+/**
+ * @brief 解码一个满块, 位数是编译期常量, 每个差值的偏移和移位都是常量
+ * @return 块内最后一个元素的值
+ */
+template<class T, bool ZigZag, unsigned Width>
+uint64_t unpackFullBlock(const uint8_t *p, uint64_t value, T *out) {
+#pragma GCC unroll 32
+    for (size_t j = 0; j < POSTING_LIST_BLOCK; ++j) {
+        uint64_t delta = loadPacked(p + j * Width / 8) >> (j * Width % 8) & packedMask(Width);
+        value += ZigZag ? zigzagDecode(delta) : delta;
+        out[j] = static_cast<T>(value);
+    }
+    return value;
+}
+
+template<class T, bool ZigZag>
+struct UnpackTable {
+    typedef uint64_t (*UnpackFunc)(const uint8_t *p, uint64_t value, T *out);
+
+    template<size_t... Widths>
+    static const UnpackFunc *make(std::index_sequence<Widths...>) {
+        static const UnpackFunc table[] = { &unpackFullBlock<T, ZigZag, Widths>... };
+        return table;
+    }
+
+    // 下标为位数, 0到64
+    static const UnpackFunc *get() {
+        static const UnpackFunc *table = make(std::make_index_sequence<65>());
+        return table;
+    }
+};
+
+/**
+ * @brief 一个压缩列表的只读视图, 只在所属词典存活期间有效
+ */
+template<class T>
+class PostingListRef {
+public:
+    static_assert(std::is_integral<T>::value, "posting list values must be integers");
+
+    class const_iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const T* pointer;
+        typedef const T& reference;
+
+        const_iterator()
+            : _p(nullptr), _block(nullptr), _bit(0), _width(0), _mask(0), _left(0),
+              _remain(0), _zigzag(false), _value(0) {}
+        const_iterator(const uint8_t *p, size_t remain, bool zigzag)
+            : _p(p), _block(nullptr), _bit(0), _width(0), _mask(0), _left(0),
+              _remain(remain), _zigzag(zigzag), _value(0) {
+            if (_remain > 0) {
+                uint64_t first;
+                _p = decodeVarint(_p, first);
+                _value = static_cast<T>(_zigzag ? zigzagDecode(first) : first);
+            }
+        }
+
+        const T &operator*() const { return _value; }
+        const T *operator->() const { return &_value; }
+        const_iterator &operator++() {
+            if (--_remain > 0) {
+                next();
+            }
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator old = *this;
+            ++*this;
+            return old;
+        }
+        bool operator==(const const_iterator &other) const { return _remain == other._remain; }
+        bool operator!=(const const_iterator &other) const { return _remain != other._remain; }
+
+    private:
+        void next() {
+            if (_left == 0) {
+                // _remain values are left, all of them in the following blocks
+                _left = std::min<size_t>(_remain, POSTING_LIST_BLOCK);
+                _width = *_p++;
+                _mask = packedMask(_width);
+                _block = _p;
+                _bit = 0;
+                _p += packedBytes(_left, _width);
+            }
+            --_left;
+            uint64_t delta = loadPacked(_block + _bit / 8) >> (_bit % 8) & _mask;
+            _bit += _width;
+            _value = static_cast<T>(static_cast<uint64_t>(_value) + (_zigzag ? zigzagDecode(delta) : delta));
+        }
+
+        const uint8_t *_p;          // next block header
+        const uint8_t *_block;      // packed deltas of the current block
+        size_t _bit;
+        unsigned _width;
+        uint64_t _mask;
+        size_t _left;               // values left in the current block
+        size_t _remain;
+        bool _zigzag;
+        T _value;
+    };
+
+    PostingListRef() : _data(nullptr), _size(0), _zigzag(false) {}
+
+    // data指向列表头, 列表之后至少要有POSTING_LIST_PADDING个可读字节, CompressedVecMapDict保证这一点
+    explicit PostingListRef(const uint8_t *data) {
+        uint64_t header;
+        _data = decodeVarint(data, header);
+        _size = static_cast<size_t>(header >> 1);
+        _zigzag = (header & 1) != 0;
+    }
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    const_iterator begin() const { return const_iterator(_data, _size, _zigzag); }
+    const_iterator end() const { return const_iterator(); }
+
+    /**
+     * @brief 解码到out, out至少要有size()个元素的空间
+     * @return 元素个数
+     */
+    size_t decode(T *out) const {
+        return _zigzag ? decode(out, std::true_type()) : decode(out, std::false_type());
+    }
+
+    void decode(std::vector<T> &out) const {
+        out.resize(_size);
+        decode(out.data());
+    }
+
+    // 压缩后占用的字节数, 不含列表头
+    size_t encodedBytes() const {
+        if (_size == 0) {
+            return 0;
+        }
+        uint64_t first;
+        const uint8_t *p = decodeVarint(_data, first);
+        for (size_t remain = _size - 1; remain > 0; ) {
+            size_t count = std::min<size_t>(remain, POSTING_LIST_BLOCK);
+            p += 1 + packedBytes(count, *p);
+            remain -= count;
+        }
+        return p - _data;
+    }
+
+    /**
+     * @brief 把values编码追加到out的末尾, 不含POSTING_LIST_PADDING
+     */
+    static void encode(const T *values, size_t n, std::vector<uint8_t> &out) {
+        bool sorted = true;
+        for (size_t i = 1; i < n && sorted; ++i) {
+            sorted = !(values[i] < values[i - 1]);
+        }
+        size_t begin = out.size();
+        // 每块最多一个字节的块头加8字节的差值
+        out.resize(begin + VARINT_MAX_BYTES * 2 + (n + n / POSTING_LIST_BLOCK + 1) * sizeof(uint64_t));
+        uint8_t *p = out.data() + begin;
+        p += encodeVarint(static_cast<uint64_t>(n) << 1 | (sorted ? 0 : 1), p);
+        if (n == 0) {
+            out.resize(p - out.data());
+            return;
+        }
+        uint64_t first = static_cast<uint64_t>(values[0]);
+        p += encodeVarint(sorted ? first : zigzagEncode(first), p);
+        uint64_t deltas[POSTING_LIST_BLOCK];
+        for (size_t i = 1; i < n; i += POSTING_LIST_BLOCK) {
+            size_t count = std::min<size_t>(n - i, POSTING_LIST_BLOCK);
+            uint64_t bits = 0;
+            for (size_t j = 0; j < count; ++j) {
+                uint64_t delta = static_cast<uint64_t>(values[i + j]) - static_cast<uint64_t>(values[i + j - 1]);
+                deltas[j] = sorted ? delta : zigzagEncode(delta);
+                bits |= deltas[j];
+            }
+            unsigned width = packedWidth(bits);
+            *p++ = static_cast<uint8_t>(width);
+            p += packBlock(deltas, count, width, p);
+        }
+        out.resize(p - out.data());
+    }
+
+private:
+    template<class ZigZag>
+    size_t decode(T *out, ZigZag) const {
+        if (_size == 0) {
+            return 0;
+        }
+        uint64_t value;
+        const uint8_t *p = decodeVarint(_data, value);
+        value = ZigZag::value ? zigzagDecode(value) : value;
+        out[0] = static_cast<T>(value);
+        const typename UnpackTable<T, ZigZag::value>::UnpackFunc *unpack =
+            UnpackTable<T, ZigZag::value>::get();
+        size_t i = 1;
+        for (; i + POSTING_LIST_BLOCK <= _size; i += POSTING_LIST_BLOCK) {
+            unsigned width = *p++;
+            value = unpack[width](p, value, out + i);
+            p += packedBytes(POSTING_LIST_BLOCK, width);
+        }
+        if (i < _size) {
+            size_t count = _size - i;
+            unsigned width = *p++;
+            uint64_t mask = packedMask(width);
+            T *dest = out + i;
+            for (size_t j = 0; j < count; ++j) {
+                size_t bit = j * width;
+                uint64_t delta = loadPacked(p + bit / 8) >> (bit % 8) & mask;
+                value += ZigZag::value ? zigzagDecode(delta) : delta;
+                dest[j] = static_cast<T>(value);
+            }
+        }
+        return _size;
+    }
+
+    const uint8_t *_data;
+    size_t _size;
+    bool _zigzag;
+};
+
+/**
+ * @brief 加载时的中间结果: 每行的列表解析后马上编码, 按文件中的顺序追加在一块内存里
+ * key可以无序、重复, 由CompressedVecMapDict(PostingListBuilder&&)排序去重
+ */
+template<class K, class T>
+class PostingListBuilder {
+public:
+    PostingListBuilder() {}
+
+    void append(const K &key, const T *values, size_t n) {
+        _keys.push_back(key);
+        _offsets.push_back(_bytes.size());
+        PostingListRef<T>::encode(values, n, _bytes);
+    }
+
+    // 把later整体追加到末尾, 并行加载时按文件顺序合并相邻的两段
+    void append(PostingListBuilder &&later) {
+        uint64_t base = _bytes.size();
+        _keys.insert(_keys.end(), std::make_move_iterator(later._keys.begin()),
+                std::make_move_iterator(later._keys.end()));
+        for (size_t i = 0; i < later._offsets.size(); ++i) {
+            _offsets.push_back(base + later._offsets[i]);
+        }
+        _bytes.insert(_bytes.end(), later._bytes.begin(), later._bytes.end());
+        later = PostingListBuilder();
+    }
+
+    size_t size() const { return _keys.size(); }
+    const K &key(size_t i) const { return _keys[i]; }
+    // 第i个列表(含列表头)在bytes()中的范围
+    uint64_t begin(size_t i) const { return _offsets[i]; }
+    uint64_t end(size_t i) const { return i + 1 < _offsets.size() ? _offsets[i + 1] : _bytes.size(); }
+
+private:
+    template<class, class, class> friend class CompressedVecMapDict;
+
+    std::vector<K> _keys;
+    std::vector<uint64_t> _offsets;
+    std::vector<uint8_t> _bytes;
+};
+
+/**
+ * @brief key -> 压缩整数列表的只读词典
+ * key有序存放, 查找为二分查找; 列表按key的顺序连续存放在_bytes中
+ */
+template<class K, class T, class Compare = std::less<K> >
+class CompressedVecMapDict {
+public:
+    typedef K key_type;
+    typedef PostingListRef<T> mapped_type;
+
+    CompressedVecMapDict() : _entryCount(0) {}
+
+    explicit CompressedVecMapDict(const std::map<K, std::vector<T>, Compare> &source) : _entryCount(0) {
+        _keys.reserve(source.size());
+        _offsets.reserve(source.size());
+        for (auto it = source.begin(); it != source.end(); ++it) {
+            append(it->first, it->second);
+        }
+        shrink();
+    }
+
+    // 从任意顺序的entries构建, 重复的key以后出现的为准
+    explicit CompressedVecMapDict(std::vector<std::pair<K, std::vector<T> > > &&entries)
+        : _entryCount(0) {
+        Compare comp;
+        std::stable_sort(entries.begin(), entries.end(),
+                [&comp](const std::pair<K, std::vector<T> > &a, const std::pair<K, std::vector<T> > &b) {
+                    return comp(a.first, b.first);
+                });
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (i + 1 < entries.size() && !comp(entries[i].first, entries[i + 1].first)) {
+                continue;
+            }
+            append(entries[i].first, entries[i].second);
+            std::vector<T>().swap(entries[i].second);
+        }
+        entries.clear();
+        entries.shrink_to_fit();
+        shrink();
+    }
+
+    // 从加载时已经编码好的列表构建, 重复的key以后出现的为准; key已经严格有序时直接接管内存
+    explicit CompressedVecMapDict(PostingListBuilder<K, T> &&builder) : _entryCount(0) {
+        Compare comp;
+        size_t n = builder.size();
+        bool sorted = true;
+        for (size_t i = 1; i < n && sorted; ++i) {
+            sorted = comp(builder._keys[i - 1], builder._keys[i]);
+        }
+        if (sorted) {
+            _keys.swap(builder._keys);
+            _offsets.swap(builder._offsets);
+            _bytes.swap(builder._bytes);
+            for (size_t i = 0; i < n; ++i) {
+                _entryCount += list(i).size();
+            }
+            shrink();
+            return;
+        }
+        std::vector<size_t> order(n);
+        for (size_t i = 0; i < n; ++i) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&builder, &comp](size_t a, size_t b) {
+            return comp(builder._keys[a], builder._keys[b]);
+        });
+        _keys.reserve(n);
+        _offsets.reserve(n);
+        _bytes.reserve(builder._bytes.size());
+        for (size_t i = 0; i < n; ++i) {
+            size_t index = order[i];
+            if (i + 1 < n && !comp(builder._keys[index], builder._keys[order[i + 1]])) {
+                continue;
+            }
+            _keys.push_back(builder._keys[index]);
+            _offsets.push_back(_bytes.size());
+            _bytes.insert(_bytes.end(), builder._bytes.begin() + builder.begin(index),
+                    builder._bytes.begin() + builder.end(index));
+            _entryCount += list(_keys.size() - 1).size();
+        }
+        builder = PostingListBuilder<K, T>();
+        shrink();
+    }
+
+    // 不存在时返回false
+    bool find(const K &key, PostingListRef<T> &list) const {
+        Compare comp;
+        auto it = std::lower_bound(_keys.begin(), _keys.end(), key, comp);
+        if (it == _keys.end() || comp(key, *it)) {
+            return false;
+        }
+        list = this->list(it - _keys.begin());
+        return true;
+    }
+
+    size_t count(const K &key) const {
+        return std::binary_search(_keys.begin(), _keys.end(), key, Compare()) ? 1 : 0;
+    }
+
+    size_t size() const { return _keys.size(); }
+    bool empty() const { return _keys.empty(); }
+    // 所有列表的元素总数
+    size_t entryCount() const { return _entryCount; }
+    const K &key(size_t i) const { return _keys[i]; }
+    PostingListRef<T> list(size_t i) const { return PostingListRef<T>(_bytes.data() + _offsets[i]); }
+
+    // 容器自身占用的字节数, 不含key内部再分配的内存
+    size_t memoryBytes() const {
+        return _keys.capacity() * sizeof(K) + _offsets.capacity() * sizeof(uint64_t)
+            + _bytes.capacity();
+    }
+
+    // 列表部分平均每个元素占用的字节数
+    double bytesPerEntry() const {
+        return _entryCount == 0 ? 0 : static_cast<double>(_bytes.size() - POSTING_LIST_PADDING) / _entryCount;
+    }
+
+    // 切换前预热, 返回触碰的页数
+    size_t prefault() const {
+        return prefaultMemory(_keys.data(), _keys.size() * sizeof(K))
+            + prefaultMemory(_offsets.data(), _offsets.size() * sizeof(uint64_t))
+            + prefaultMemory(_bytes.data(), _bytes.size());
+    }
+
+private:
+    void append(const K &key, const std::vector<T> &values) {
+        _keys.push_back(key);
+        _offsets.push_back(_bytes.size());
+        PostingListRef<T>::encode(values.data(), values.size(), _bytes);
+        _entryCount += values.size();
+    }
+
+    void shrink() {
+        _bytes.resize(_bytes.size() + POSTING_LIST_PADDING);
+        _keys.shrink_to_fit();
+        _offsets.shrink_to_fit();
+        _bytes.shrink_to_fit();
+    }
+
+    std::vector<K> _keys;
+    std::vector<uint64_t> _offsets;     // 每个列表头在_bytes中的位置
+    std::vector<uint8_t> _bytes;
+    size_t _entryCount;
+};
+
+} // end namespace StemCell
+#endif
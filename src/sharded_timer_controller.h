@@ -0,0 +1,177 @@
+/**
+ * @brief 分片的定时器, 每个分片是一个独立的TimerController, 有自己的定时器线程
+ *
+ * 单个TimerController只有一个定时器线程, 到期处理最多用满一个核.
+ * ShardedTimerController默认分片数等于硬件线程数, 有两种把提交分到分片的方式:
+ * ROUTE_BY_THREAD(默认): 按线程而不是按核分片. 调用线程第一次提交时按轮转分到一个分片,
+ *     之后该线程的提交都进这个分片, 定时器线程不绑核, 由系统调度, 分片与核没有对应关系.
+ * ROUTE_BY_CPU: 第i个分片的定时器线程绑定到进程可用的第i个CPU上, 每次提交按调用线程当前
+ *     所在的CPU(sched_getcpu)选分片, 提交和到期处理尽量留在同一个核上; 调用线程迁移后换分片.
+ * 两种方式下不同分片的提交都互不竞争同一个提交队列.
+ * 返回的TimerHandle属于提交时的分片, 可以在任意线程上cancel/reschedule.
+ */
+#ifndef SHARDED_TIMER_CONTROLLER_H
+#define SHARDED_TIMER_CONTROLLER_H
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <sched.h>
+#include "timer_controller.h"
+
+namespace StemCell {
+
+class ShardedTimerController {
+public:
+    enum ShardRouting {
+        ROUTE_BY_THREAD = 0,
+        ROUTE_BY_CPU = 1
+    };
+
+    /**
+     * @param shards 分片数, 为0时取硬件线程数, ROUTE_BY_CPU时取进程可用的CPU数
+     */
+    explicit ShardedTimerController(size_t shards = 0,
+            TimerController::TimerBackend backend = TimerController::TIMER_BACKEND_HEAP,
+            uint32_t wheel_tick_us = 1000, ShardRouting routing = ROUTE_BY_THREAD)
+        : _routing(routing) {
+        std::vector<int> cpus;
+        if (_routing == ROUTE_BY_CPU) {
+            cpus = allowedCpus();
+            if (cpus.empty()) {
+                _routing = ROUTE_BY_THREAD;
+            }
+        }
+        if (shards == 0) {
+            shards = !cpus.empty() ? cpus.size() : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        }
+        for (size_t i = 0; i < shards; ++i) {
+            _shards.emplace_back(new TimerController(backend, wheel_tick_us));
+        }
+        // the i-th allowed cpu submits to shard i % shards, whose loop thread runs on cpu i % cpus
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            if (static_cast<size_t>(cpus[i]) >= _cpuShards.size()) {
+                _cpuShards.resize(cpus[i] + 1, i % shards);
+            }
+            _cpuShards[cpus[i]] = i % shards;
+        }
+        for (size_t i = 0; i < shards && !cpus.empty(); ++i) {
+            _shards[i]->setLoopThreadCpu(cpus[i % cpus.size()]);
+        }
+    }
+
+    ShardedTimerController(const ShardedTimerController&) = delete;
+    ShardedTimerController& operator=(const ShardedTimerController&) = delete;
+
+    bool init() {
+        for (size_t i = 0; i < _shards.size(); ++i) {
+            if (!_shards[i]->init()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void stop() {
+        for (size_t i = 0; i < _shards.size(); ++i) {
+            _shards[i]->stop();
+        }
+    }
+
+    // 所有分片共用一个执行器, 只能在init()之前设置
+    void setExecutor(TimerController::TimerExecutor executor) {
+        for (size_t i = 0; i < _shards.size(); ++i) {
+            _shards[i]->setExecutor(executor);
+        }
+    }
+
+    void setExecutor(ThreadPool *pool) {
+        for (size_t i = 0; i < _shards.size(); ++i) {
+            _shards[i]->setExecutor(pool);
+        }
+    }
+
+    // 时长为毫秒数或std::chrono时长, 同TimerController
+    template<class Duration, class F, class... Args>
+    TimerHandle delayProcess(Duration delay_time, F&& f, Args&&... args) {
+        return localShard().delayProcess(delay_time, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template<class Duration, class F, class... Args>
+    TimerHandle cycleProcess(Duration interval, F&& f, Args&&... args) {
+        return localShard().cycleProcess(interval, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    size_t shardCount() const { return _shards.size(); }
+    TimerController &shard(size_t i) { return *_shards[i]; }
+
+    ShardRouting routing() const { return _routing; }
+
+    // 调用线程的提交进入的分片
+    size_t localShardIndex() const {
+        if (_routing == ROUTE_BY_CPU) {
+            int cpu = sched_getcpu();
+            if (cpu >= 0 && static_cast<size_t>(cpu) < _cpuShards.size()) {
+                return _cpuShards[cpu];
+            }
+        }
+        return threadIndex() % _shards.size();
+    }
+    TimerController &localShard() { return *_shards[localShardIndex()]; }
+
+    // 所有分片合计的到期延迟
+    TimerLatenessStats latenessStats() const {
+        TimerLatenessStats total;
+        for (size_t i = 0; i < _shards.size(); ++i) {
+            TimerLatenessStats stats = _shards[i]->latenessStats();
+            total.fired += stats.fired;
+            total.total_ns += stats.total_ns;
+            total.max_ns = std::max(total.max_ns, stats.max_ns);
+        }
+        return total;
+    }
+
+    // 每个分片一行的到期延迟
+    std::string report() const {
+        std::ostringstream out;
+        for (size_t i = 0; i < _shards.size(); ++i) {
+            out << "shard:" << i << " " << _shards[i]->latenessStats().report() << "\n";
+        }
+        return out.str();
+    }
+
+private:
+    // threads are numbered in the order they first submit, so consecutive threads land on different shards
+    static size_t threadIndex() {
+        static std::atomic<size_t> next(0);
+        thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+
+    // 进程可用的CPU编号, 从小到大
+    static std::vector<int> allowedCpus() {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+            return cpus;
+        }
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    ShardRouting _routing;
+    std::vector<std::unique_ptr<TimerController> > _shards;
+    std::vector<size_t> _cpuShards;     // cpu id -> shard, only for ROUTE_BY_CPU
+};
+
+} // end namespace StemCell
+#endif
@@ -0,0 +1,174 @@
+/**
+ * @brief 向量化的分隔符扫描
+ *
+ * 每次比较32(AVX2)或16(SSE2)个字节, 用movemask得到命中位图, 再逐位取出分隔符位置;
+ * 多个候选分隔符时用SSE4.2的pcmpestrm. 没有对应指令集时退化为逐字节扫描.
+ * 所有接口都写入调用方提供的容器, 容器复用时扫描过程不分配内存,
+ * 字段以std::string_view的形式指向原始内存.
+ */
+#ifndef SIMD_TOKENIZER_H
+#define SIMD_TOKENIZER_H
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#if defined(__AVX2__) || defined(__SSE2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+
+namespace StemCell {
+
+class SimdTokenizer {
+public:
+    /**
+     * @brief 按delimiter切分source, 规则与Dict::split(char, ...)相同
+     * @param reqSize 不为0时, 切出reqSize个字段后停止
+     */
+    static void split(std::string_view source, char delimiter,
+            std::vector<std::string_view> &fields, int32_t reqSize = 0) {
+        fields.clear();
+        if (source.empty()) {
+            return;
+        }
+        const char *data = source.data();
+        size_t size = source.size();
+        size_t prev = 0;
+        int32_t index = 0;
+        size_t pos = 0;
+        uint32_t mask = 0;
+        while (nextBlock(data, size, delimiter, delimiter, pos, mask)) {
+            for (; mask != 0; mask &= mask - 1) {
+                size_t hit = pos + __builtin_ctz(mask);
+                fields.push_back(std::string_view(data + prev, hit - prev));
+                prev = hit + 1;
+                if (reqSize != 0 && ++index >= reqSize) {
+                    return;
+                }
+            }
+            pos += blockSize(pos, size);
+        }
+        fields.push_back(std::string_view(data + prev, size - prev));
+    }
+
+    /**
+     * @brief 按delimiters中的任意一个字符切分source, 规则与Dict::split(const std::string&, ...)相同
+     * 有SSE4.2且分隔符不超过16个时用pcmpestrm一次比较16个字节, 否则查256项的表
+     */
+    static void splitAny(std::string_view source, std::string_view delimiters,
+            std::vector<std::string_view> &fields) {
+        fields.clear();
+        if (source.empty()) {
+            return;
+        }
+        const char *data = source.data();
+        size_t size = source.size();
+        size_t prev = 0;
+        size_t pos = 0;
+#if defined(__SSE4_2__)
+        if (delimiters.size() <= 16) {
+            char set[16] = {0};
+            memcpy(set, delimiters.data(), delimiters.size());
+            __m128i needles = _mm_loadu_si128(reinterpret_cast<const __m128i*>(set));
+            const int setSize = static_cast<int>(delimiters.size());
+            for (; pos + 16 <= size; pos += 16) {
+                __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+                __m128i hit = _mm_cmpestrm(needles, setSize, chunk, 16,
+                        _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+                for (uint32_t mask = static_cast<uint32_t>(_mm_cvtsi128_si32(hit));
+                        mask != 0; mask &= mask - 1) {
+                    size_t at = pos + __builtin_ctz(mask);
+                    fields.push_back(std::string_view(data + prev, at - prev));
+                    prev = at + 1;
+                }
+            }
+        }
+#endif
+        bool table[256] = {false};
+        for (size_t i = 0; i < delimiters.size(); ++i) {
+            table[static_cast<unsigned char>(delimiters[i])] = true;
+        }
+        for (; pos < size; ++pos) {
+            if (table[static_cast<unsigned char>(data[pos])]) {
+                fields.push_back(std::string_view(data + prev, pos - prev));
+                prev = pos + 1;
+            }
+        }
+        fields.push_back(std::string_view(data + prev, size - prev));
+    }
+
+    /**
+     * @brief 一次扫描整个buffer, 按顺序输出每个delimiter和'\n'的偏移
+     * 偏移为uint32_t, 超过4GB的数据需要由调用方分块扫描
+     * @return 偏移的个数
+     */
+    static size_t scan(const char *data, size_t size, char delimiter, std::vector<uint32_t> &offsets) {
+        offsets.clear();
+        size_t pos = 0;
+        uint32_t mask = 0;
+        while (nextBlock(data, size, delimiter, '\n', pos, mask)) {
+            for (; mask != 0; mask &= mask - 1) {
+                offsets.push_back(static_cast<uint32_t>(pos + __builtin_ctz(mask)));
+            }
+            pos += blockSize(pos, size);
+        }
+        return offsets.size();
+    }
+
+    // 当前编译使用的指令集, 用于benchmark和日志
+    static const char *isa() {
+#if defined(__AVX2__)
+        return "avx2";
+#elif defined(__SSE2__)
+        return "sse2";
+#else
+        return "scalar";
+#endif
+    }
+
+private:
+#if defined(__AVX2__)
+    enum { BLOCK = 32 };
+#elif defined(__SSE2__)
+    enum { BLOCK = 16 };
+#else
+    enum { BLOCK = 32 };
+#endif
+
+    static size_t blockSize(size_t pos, size_t size) {
+        return size - pos >= BLOCK ? static_cast<size_t>(BLOCK) : size - pos;
+    }
+
+    // 计算从pos开始的一个block里等于c1或c2的字节位图, 没有剩余数据时返回false
+    static bool nextBlock(const char *data, size_t size, char c1, char c2,
+            size_t pos, uint32_t &mask) {
+        if (pos >= size) {
+            return false;
+        }
+        if (size - pos >= BLOCK) {
+#if defined(__AVX2__)
+            __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+            __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(c1)),
+                    _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(c2)));
+            mask = static_cast<uint32_t>(_mm256_movemask_epi8(hit));
+            return true;
+#elif defined(__SSE2__)
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+            __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(c1)),
+                    _mm_cmpeq_epi8(chunk, _mm_set1_epi8(c2)));
+            mask = static_cast<uint32_t>(_mm_movemask_epi8(hit));
+            return true;
+#endif
+        }
+        // tail shorter than a block, or no SIMD available
+        mask = 0;
+        size_t end = pos + blockSize(pos, size);
+        for (size_t i = pos; i < end; ++i) {
+            mask |= static_cast<uint32_t>(data[i] == c1 || data[i] == c2) << (i - pos);
+        }
+        return true;
+    }
+};
+
+} // end namespace StemCell
+#endif
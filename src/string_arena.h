@@ -0,0 +1,178 @@
+#ifndef STRING_ARENA_H
+#define STRING_ARENA_H
+
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+#include "spinlock.h"
+
+namespace StemCell {
+
+/**
+ * @brief 只增不减的字符串内存池, 字符串连续存放在大块内存里, 析构时按块整体释放
+ * firstBlockSize不为0时第一块只有这么大, 之后每块翻倍直到blockSize, 存的字符串很少时不会占满一整块
+ */
+class StringArena {
+public:
+    explicit StringArena(size_t blockSize = 1 << 20, size_t firstBlockSize = 0)
+        : _blockSize(blockSize),
+          _nextBlockSize(firstBlockSize != 0 ? std::min(firstBlockSize, blockSize) : blockSize),
+          _cur(nullptr), _remain(0), _bytes(0) {}
+
+    StringArena(const StringArena&) = delete;
+    StringArena& operator=(const StringArena&) = delete;
+
+    // 拷贝一份source, 返回的view在arena析构前一直有效
+    std::string_view store(std::string_view source) {
+        if (source.size() > _remain) {
+            if (source.size() > _blockSize / 4) {
+                // big strings get a block of their own so the current block is not wasted
+                char *block = newBlock(source.size());
+                memcpy(block, source.data(), source.size());
+                return std::string_view(block, source.size());
+            }
+            _remain = std::max(_nextBlockSize, source.size());
+            _cur = newBlock(_remain);
+            _nextBlockSize = std::min(_nextBlockSize * 2, _blockSize);
+        }
+        char *dest = _cur;
+        memcpy(dest, source.data(), source.size());
+        _cur += source.size();
+        _remain -= source.size();
+        return std::string_view(dest, source.size());
+    }
+
+    size_t memoryBytes() const { return _bytes; }
+    size_t blockCount() const { return _blocks.size(); }
+
+private:
+    char *newBlock(size_t size) {
+        _blocks.emplace_back(new char[size]);
+        _bytes += size;
+        return _blocks.back().get();
+    }
+
+    size_t _blockSize;
+    size_t _nextBlockSize;
+    char *_cur;
+    size_t _remain;
+    size_t _bytes;
+    std::vector<std::unique_ptr<char[]> > _blocks;
+};
+
+#define STRING_INTERN_POOL_SHARD_BITS 6
+#define STRING_INTERN_POOL_SHARDS (1 << STRING_INTERN_POOL_SHARD_BITS)
+
+/**
+ * @brief 字符串驻留池: 相同内容的字符串只在arena里保存一份
+ * 多个词典可以共享同一个池, 池随最后一个引用它的词典一起释放. 线程安全.
+ * 按hash的高位分成STRING_INTERN_POOL_SHARDS个分片, 每个分片有自己的锁、arena和索引,
+ * 并行加载和流水线加载的多个解析线程同时intern时很少落在同一个分片上.
+ * 分片的arena从512字节的块开始逐块翻倍, 索引从16个slot开始, 只有几百个key的池只占几十KB.
+ * 池只增不减: 共享一个池的词典里最早加载的那个被释放后, 只有它用到的字符串也不会被释放.
+ * 所以只在同一批加载的词典之间共享池, 不要在HotSwitchDict的多次重新加载之间沿用同一个池,
+ * 否则每个被替换掉的版本里的key都会一直留在池里.
+ */
+class StringInternPool {
+public:
+    StringInternPool() {}
+
+    StringInternPool(const StringInternPool&) = delete;
+    StringInternPool& operator=(const StringInternPool&) = delete;
+
+    std::string_view intern(std::string_view source) {
+        if (source.empty()) {
+            return std::string_view("", 0);
+        }
+        size_t hash = std::hash<std::string_view>()(source);
+        Shard &shard = _shards[hash >> (sizeof(size_t) * 8 - STRING_INTERN_POOL_SHARD_BITS)];
+        std::lock_guard<Spinlock> locker(shard.lock);
+        size_t mask = shard.slots.size() - 1;
+        size_t index = hash & mask;
+        // empty slots have a null data pointer, linear probing
+        while (shard.slots[index].data() != nullptr) {
+            if (shard.slots[index] == source) {
+                return shard.slots[index];
+            }
+            index = (index + 1) & mask;
+        }
+        std::string_view stored = shard.arena.store(source);
+        shard.slots[index] = stored;
+        if (++shard.size * 2 > shard.slots.size()) {
+            shard.grow();
+        }
+        return stored;
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (size_t i = 0; i < STRING_INTERN_POOL_SHARDS; ++i) {
+            std::lock_guard<Spinlock> locker(_shards[i].lock);
+            total += _shards[i].size;
+        }
+        return total;
+    }
+
+    // arena与索引一共占用的字节数
+    size_t memoryBytes() const {
+        size_t total = 0;
+        for (size_t i = 0; i < STRING_INTERN_POOL_SHARDS; ++i) {
+            std::lock_guard<Spinlock> locker(_shards[i].lock);
+            total += _shards[i].arena.memoryBytes()
+                + _shards[i].slots.capacity() * sizeof(std::string_view);
+        }
+        return total;
+    }
+
+private:
+    struct alignas(64) Shard {
+        // start small, most shards of a small pool hold only a few strings
+        Shard() : arena(1 << 16, 512), slots(16), size(0) {}
+
+        void grow() {
+            std::vector<std::string_view> bigger(slots.size() * 2);
+            size_t mask = bigger.size() - 1;
+            for (size_t i = 0; i < slots.size(); ++i) {
+                if (slots[i].data() == nullptr) {
+                    continue;
+                }
+                size_t index = std::hash<std::string_view>()(slots[i]) & mask;
+                while (bigger[index].data() != nullptr) {
+                    index = (index + 1) & mask;
+                }
+                bigger[index] = slots[i];
+            }
+            slots.swap(bigger);
+        }
+
+        mutable Spinlock lock;
+        StringArena arena;
+        std::vector<std::string_view> slots;
+        size_t size;
+    };
+
+    Shard _shards[STRING_INTERN_POOL_SHARDS];
+};
+
+/**
+ * @brief key为std::string_view的词典, 同时持有key所在的驻留池
+ * 词典析构时只释放容器本身和池的内存块, 不需要逐个释放key
+ */
+template<class MapType>
+class InternedDict : public MapType {
+public:
+    InternedDict(MapType &&dict, const std::shared_ptr<StringInternPool> &pool)
+        : MapType(std::move(dict)), _pool(pool) {}
+
+    const std::shared_ptr<StringInternPool> &pool() const { return _pool; }
+
+private:
+    std::shared_ptr<StringInternPool> _pool;
+};
+
+} // end namespace StemCell
+#endif
@@ -7,18 +7,25 @@
 #include <cstring>
 #include <time.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 
 using namespace StemCell;
 using namespace std;
 
+// wall clock jumps must neither fire nor stall timers
+#define TIMER_CLOCK CLOCK_MONOTONIC
+
 static bool TimerTaskComp(TimerTaskPtr a, TimerTaskPtr b) {
     return (a->expect_time.tv_sec == b->expect_time.tv_sec ? 
             a->expect_time.tv_nsec > b->expect_time.tv_nsec :
             a->expect_time.tv_sec > b->expect_time.tv_sec);
 }
 
-static bool TimerTaskEarlierComp(TimerTaskPtr a, TimerTaskPtr b) {
-    return !TimerTaskComp(a, b);
+static bool TimerTaskDue(TimerTaskPtr task, const struct timespec &now) {
+    return (task->expect_time.tv_sec == now.tv_sec ?
+            task->expect_time.tv_nsec <= now.tv_nsec :
+            task->expect_time.tv_sec < now.tv_sec);
 }
 
 bool TimerController::init() {
@@ -35,24 +42,14 @@ bool TimerController::init() {
     }
 
     // init _timerfd
-    _timerfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK);
+    // stays disarmed until the first task arrives
+    _timerfd = timerfd_create(TIMER_CLOCK, TFD_NONBLOCK);
     if (_timerfd < 0) {
         throw std::runtime_error("failed to create timerfd");
     }
-
-    struct itimerspec new_itimer;
-    new_itimer.it_value.tv_sec = 1;
-    new_itimer.it_value.tv_nsec = 0;
-    // it_interval cannot be zero, in case of _timerfd being closed
-    // new_itimer.it_interval.tv_sec = 0xFFFFFFFF; // 136 years? haha!
-    new_itimer.it_interval.tv_sec = 0;
-    new_itimer.it_interval.tv_nsec = 1000000;
-
-    if (timerfd_settime(_timerfd, 0, &new_itimer, NULL) < 0) {
-        stringstream msg;
-        msg << "failed to timerfd_settime when init.  errno: " << errno 
-           << " err:" << strerror(errno);
-        throw std::runtime_error(msg.str());
+    if (_backend == TIMER_BACKEND_WHEEL
+            && clock_gettime(TIMER_CLOCK, &_wheel_base) < 0) {
+        throw std::runtime_error("failed to clock_gettime");
     }
 
     // init _epollfd
@@ -85,6 +82,14 @@ bool TimerController::init() {
     // init loop thread
     TimerController *tc = this;
     _loop_thread = thread([tc]() mutable { tc->loop(); });
+    if (_loop_cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(_loop_cpu, &cpus);
+        if (pthread_setaffinity_np(_loop_thread.native_handle(), sizeof(cpus), &cpus) != 0) {
+            throw std::runtime_error("failed to pin the timer loop thread");
+        }
+    }
     
     _initialized = true;
     return true;
@@ -115,6 +120,11 @@ void TimerController::loop() {
                 }
             }
             if (e->data.fd == _timerfd) {
+                // consume the expiration, otherwise the timerfd stays readable
+                uint64_t expirations;
+                if (read(_timerfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+                    throw std::runtime_error("failed to read timerfd");
+                }
                 execEarliestTimerTask();
             }
         }
@@ -126,113 +136,290 @@ void TimerController::addTimerTask(TimerTaskPtr timer_task) {
     struct timespec& create_time = timer_task->create_time;
     struct timespec& expect_time = timer_task->expect_time;
     if (0 == create_time.tv_sec && 0 == create_time.tv_nsec) {
-        if (clock_gettime(CLOCK_REALTIME, &base_time) < 0) {
+        if (clock_gettime(TIMER_CLOCK, &base_time) < 0) {
             throw std::runtime_error("failed to clock_gettime");
         }
-        create_time.tv_sec = base_time.tv_nsec;
-        create_time.tv_nsec = base_time.tv_nsec;
+        create_time = base_time;
     } else {
         base_time = expect_time;
     }
-    int64_t delay_time = timer_task->interval;
-    int64_t second = delay_time / 1000;
-    int64_t narosecond = (delay_time % 1000) * 1000000;
-    int64_t delta = (narosecond + base_time.tv_nsec) / 1000000000;
-    expect_time.tv_sec = base_time.tv_sec + second + delta;
-    expect_time.tv_nsec = (narosecond + base_time.tv_nsec) % 1000000000;
-    {
-        std::lock_guard<Spinlock> locker(_lock);
-        _timer_task_queue.push(timer_task);
+    int64_t nanosecond = timer_task->interval_ns % 1000000000 + base_time.tv_nsec;
+    expect_time.tv_sec = base_time.tv_sec + timer_task->interval_ns / 1000000000
+        + nanosecond / 1000000000;
+    expect_time.tv_nsec = nanosecond % 1000000000;
+    // the loop thread drains the whole queue per wakeup, only the first task of a batch notifies
+    if (!_timer_task_queue.push(timer_task)) {
+        return;
     }
+    _wakeup_count.fetch_add(1, std::memory_order_relaxed);
     eventfd_t wdata = EVENT_ADD_TASK;
     if(eventfd_write(_eventfd, wdata) < 0) {
         throw std::runtime_error("failed to writer eventfd");
     }
 }
 
+// arm the timerfd for the task's deadline, one-shot; a deadline in the past fires at once
 void TimerController::refreshTimer(TimerTaskPtr task) {
-    struct timespec now;
-    struct timespec& expect_time = task->expect_time;
-    struct itimerspec new_itimer;
-    if (clock_gettime(CLOCK_REALTIME, &now) < 0) {
-        throw std::runtime_error("failed to clock_gettime");
+    armTimer(task->expect_time);
+}
+
+void TimerController::armTimer(const struct timespec &deadline) {
+    struct itimerspec new_itimer = {{0, 0}, deadline};
+    if (timerfd_settime(_timerfd, TFD_TIMER_ABSTIME, &new_itimer, NULL) < 0) {
+        stringstream msg;
+        msg << "failed to timerfd_settime when refresh.  errno: " << errno 
+           << " err:" << strerror(errno);
+        throw std::runtime_error(msg.str());
     }
-    // if task has been timeout , exec it immediately!
-    if (expect_time.tv_sec < now.tv_sec || 
-            (expect_time.tv_sec == now.tv_sec 
-             && expect_time.tv_nsec <= now.tv_nsec)) {
-        new_itimer.it_value.tv_sec = 0;
-        new_itimer.it_value.tv_nsec = 1;
-    } else {
-        int64_t sec = expect_time.tv_sec - now.tv_sec;
-        int64_t nsec = expect_time.tv_nsec - now.tv_nsec;
-        if (nsec < 0) {
-            --sec;
-            nsec = 1000000000 + nsec;
-        }
-        
-        int64_t delay_time = task->interval;
-        int64_t second = delay_time / 1000;
-        int64_t narosecond = (delay_time % 1000) * 1000000;
-        new_itimer.it_value.tv_sec = sec;
-        new_itimer.it_value.tv_nsec = nsec;
-    }
-    // it_interval cannot be zero, in case of _timerfd being closed
-    // new_itimer.it_interval.tv_sec = 0xFFFFFFFF; // 136 years? haha!
-    new_itimer.it_interval.tv_sec = 0;
-    new_itimer.it_interval.tv_nsec = 1000000;
-    if (timerfd_settime(_timerfd, 0, &new_itimer, NULL) < 0) {
-        throw std::runtime_error("failed to timerfd_settime when refresh");
+}
+
+// arm the timerfd for the next tick the wheel has work at, disarm it when the wheel is empty
+void TimerController::refreshWheelTimer() {
+    uint64_t next = _timer_wheel.nextTick();
+    if (next == _wheel_armed_tick) {
+        return;
     }
-    
-    epoll_event evnt = {0};
-    evnt.data.fd = _timerfd;
-    evnt.events = EPOLLIN | EPOLLET;
-    if (epoll_ctl(_epollfd, EPOLL_CTL_MOD, _timerfd, &evnt) < 0) {
-        throw std::runtime_error("failed to epoll_ctl EPOLL_CTL_ADD");
+    _wheel_armed_tick = next;
+    if (next == UINT64_MAX) {
+        struct itimerspec new_itimer = {{0, 0}, {0, 0}};
+        if (timerfd_settime(_timerfd, 0, &new_itimer, NULL) < 0) {
+            throw std::runtime_error("failed to timerfd_settime when disarm");
+        }
+        return;
     }
+    int64_t ns = _wheel_base.tv_nsec + static_cast<int64_t>(next) * _wheel_tick_ns;
+    struct timespec deadline = {static_cast<time_t>(_wheel_base.tv_sec + ns / 1000000000),
+        static_cast<long>(ns % 1000000000)};
+    armTimer(deadline);
 }
 
 void TimerController::custTimerTask() {
-    for(;;) {
-        TimerTaskPtr task;
-        {
-            std::lock_guard<Spinlock> locker(_lock);
-            if (_timer_task_queue.empty()) {
-                return;
-            }
-            task = _timer_task_queue.front();
-            _timer_task_queue.pop();
+    // tasks pushed after popAll() find the queue empty and wake the loop again
+    TimerTaskPtr task = _timer_task_queue.popAll();
+    while (task != nullptr) {
+        TimerTaskPtr next = task->submit_next;
+        task->submit_next = nullptr;
+        if (task->moved_from != nullptr) {
+            takeOverTimerTask(task);
         }
-        if (!_timer_task_heap.empty()) {
-            TimerTaskPtr earliestTimerTask = _timer_task_heap.front();
-            if (TimerTaskEarlierComp(task, earliestTimerTask)) {
-                refreshTimer(task);           
-            } 
+        _submitted_tasks.push_back(task);
+        task = next;
+    }
+    insertTimerTasks(_submitted_tasks);
+    _submitted_tasks.clear();
+}
+
+// insert a drained batch, the heap is fixed up and the timer re-armed at most once
+void TimerController::insertTimerTasks(std::vector<TimerTaskPtr> &tasks) {
+    TimerTaskPtr earliestTimerTask = _timer_task_heap.empty() ? nullptr : _timer_task_heap.front();
+    size_t heapSize = _timer_task_heap.size();
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        TimerTaskPtr task = tasks[i];
+        // cancelled before it reached the heap or the wheel
+        if (task->cancelled()) {
+            dropCancelledTimerTask(task);
+        } else if (_backend == TIMER_BACKEND_WHEEL) {
+            _timer_wheel.insert(task, wheelTickOf(task->expect_time, true));
         } else {
-            refreshTimer(task);           
+            _timer_task_heap.push_back(task);
         }
-        _timer_task_heap.emplace_back(task);
-        push_heap(_timer_task_heap.begin(), _timer_task_heap.end(), TimerTaskComp);
+    }
+    if (_backend == TIMER_BACKEND_WHEEL) {
+        refreshWheelTimer();
+        return;
+    }
+    if (_timer_task_heap.size() == heapSize) {
+        return;
+    }
+    if (_timer_task_heap.size() - heapSize > heapSize) {
+        make_heap(_timer_task_heap.begin(), _timer_task_heap.end(), TimerTaskComp);
+    } else {
+        for (size_t i = heapSize + 1; i <= _timer_task_heap.size(); ++i) {
+            push_heap(_timer_task_heap.begin(), _timer_task_heap.begin() + i, TimerTaskComp);
+        }
+    }
+    if (_timer_task_heap.front() != earliestTimerTask) {
+        refreshTimer(_timer_task_heap.front());
     }
 }
 
 void TimerController::execEarliestTimerTask() {
-    if (_timer_task_heap.empty()) {
+    if (_backend == TIMER_BACKEND_WHEEL) {
+        execExpiredWheelTasks();
         return;
     }
-    TimerTaskPtr earliestTimerTask = _timer_task_heap.front();
-    pop_heap(_timer_task_heap.begin(), _timer_task_heap.end(), TimerTaskComp);
-    _timer_task_heap.pop_back();
-    earliestTimerTask->fun();
-    if (earliestTimerTask->is_cycle) {
-        addTimerTask(earliestTimerTask);
-    } else {
-        earliestTimerTask->reset();
-        _timer_task_pool.recycle(earliestTimerTask);
+    struct timespec now;
+    if (clock_gettime(TIMER_CLOCK, &now) < 0) {
+        throw std::runtime_error("failed to clock_gettime");
+    }
+    // run every due task and drop cancelled ones at the front, so the timer is armed for a live one
+    while (!_timer_task_heap.empty()) {
+        TimerTaskPtr earliestTimerTask = _timer_task_heap.front();
+        if (!earliestTimerTask->cancelled() && !TimerTaskDue(earliestTimerTask, now)) {
+            break;
+        }
+        pop_heap(_timer_task_heap.begin(), _timer_task_heap.end(), TimerTaskComp);
+        _timer_task_heap.pop_back();
+        runTimerTask(earliestTimerTask);
     }
     
+    // a fired one-shot timerfd is disarmed, an empty heap needs nothing
     if (!_timer_task_heap.empty()) { 
         refreshTimer(_timer_task_heap.front());
     }
 }
+
+void TimerController::execExpiredWheelTasks() {
+    struct timespec now;
+    if (clock_gettime(TIMER_CLOCK, &now) < 0) {
+        throw std::runtime_error("failed to clock_gettime");
+    }
+    // the one-shot timerfd has fired and is disarmed now
+    _wheel_armed_tick = UINT64_MAX;
+    // collect first, a callback may add tasks while the wheel is being advanced
+    _timer_wheel.advance(wheelTickOf(now, false), [this](TimerWheelNode *node) {
+        _expired_tasks.push_back(static_cast<TimerTaskPtr>(node));
+    });
+    for (size_t i = 0; i < _expired_tasks.size(); ++i) {
+        runTimerTask(_expired_tasks[i]);
+    }
+    _expired_tasks.clear();
+    refreshWheelTimer();
+}
+
+void TimerController::runTimerTask(TimerTaskPtr task) {
+    // a one-shot task gives up its id before running, later cancel() and reschedule() calls fail
+    bool cancelled = task->cancelled();
+    if (!cancelled && !task->is_cycle) {
+        uint64_t state = task->state.load(std::memory_order_acquire);
+        while (!(state & (TimerTask::STATE_CANCELLED | TimerTask::STATE_MOVED))
+                && !task->state.compare_exchange_weak(state, 0, std::memory_order_acq_rel)) {}
+        cancelled = state & (TimerTask::STATE_CANCELLED | TimerTask::STATE_MOVED);
+    }
+    if (cancelled) {
+        dropCancelledTimerTask(task);
+        return;
+    }
+    if (!_executor) {
+        recordLateness(task->expect_time);
+        task->fun();
+    } else {
+        // the task may be recycled or re-added before the executor gets to it
+        struct timespec expect_time = task->expect_time;
+        std::function<void()> fun = task->is_cycle ? task->fun : std::move(task->fun);
+        _executor([this, expect_time, fun]() {
+            recordLateness(expect_time);
+            fun();
+        });
+    }
+    if (task->is_cycle) {
+        addTimerTask(task);
+    } else {
+        recycleTimerTask(task);
+    }
+}
+
+void TimerController::recordLateness(const struct timespec &expect_time) {
+    struct timespec now;
+    if (clock_gettime(TIMER_CLOCK, &now) < 0) {
+        throw std::runtime_error("failed to clock_gettime");
+    }
+    int64_t late = (now.tv_sec - expect_time.tv_sec) * 1000000000LL + (now.tv_nsec - expect_time.tv_nsec);
+    _fired_count.fetch_add(1, std::memory_order_relaxed);
+    _lateness_total_ns.fetch_add(late, std::memory_order_relaxed);
+    int64_t max = _lateness_max_ns.load(std::memory_order_relaxed);
+    while (late > max && !_lateness_max_ns.compare_exchange_weak(max, late, std::memory_order_relaxed)) {}
+}
+
+TimerHandle TimerController::submitTimerTask(TimerTaskPtr task) {
+    uint64_t id = _next_timer_id.fetch_add(1, std::memory_order_relaxed);
+    task->state.store(id << TimerTask::STATE_SHIFT, std::memory_order_release);
+    addTimerTask(task);
+    return TimerHandle(this, task, id);
+}
+
+// runs on the loop thread, reschedule() already claimed task->moved_from
+void TimerController::takeOverTimerTask(TimerTaskPtr task) {
+    TimerTaskPtr source = task->moved_from;
+    task->is_cycle = source->is_cycle;
+    if (task->is_cycle && task->interval_ns <= 0) {
+        task->interval_ns = 1000000;
+    }
+    task->fun = std::move(source->fun);
+    // from now on the old entry is an ordinary cancelled one
+    source->state.store(task->moved_from_id << TimerTask::STATE_SHIFT | TimerTask::STATE_CANCELLED,
+            std::memory_order_release);
+    task->moved_from = nullptr;
+    task->moved_from_id = 0;
+    // only the wheel can unlink in O(1), the heap drops the old entry when it reaches the front
+    if (source->linked()) {
+        _timer_wheel.remove(source);
+        dropCancelledTimerTask(source);
+    } else if (source->detached) {
+        dropCancelledTimerTask(source);
+    }
+}
+
+void TimerController::recycleTimerTask(TimerTaskPtr task) {
+    task->reset();
+    _timer_task_pool.recycle(task);
+}
+
+void TimerController::dropCancelledTimerTask(TimerTaskPtr task) {
+    // the replacement still has to take fun over, it recycles this task afterwards
+    if (task->state.load(std::memory_order_acquire) & TimerTask::STATE_MOVED) {
+        task->detached = true;
+        return;
+    }
+    _avoided_fire_count.fetch_add(1, std::memory_order_relaxed);
+    recycleTimerTask(task);
+}
+
+// ticks since init(), deadlines are rounded up so that a task never fires early
+uint64_t TimerController::wheelTickOf(const struct timespec &time, bool round_up) const {
+    int64_t ns = (time.tv_sec - _wheel_base.tv_sec) * 1000000000LL
+        + (time.tv_nsec - _wheel_base.tv_nsec);
+    if (ns <= 0) {
+        return 0;
+    }
+    return round_up ? (ns + _wheel_tick_ns - 1) / _wheel_tick_ns : ns / _wheel_tick_ns;
+}
+
+bool TimerHandle::cancel() {
+    if (_task == nullptr) {
+        return false;
+    }
+    uint64_t live = _id << TimerTask::STATE_SHIFT;
+    if (!_task->state.compare_exchange_strong(live, live | TimerTask::STATE_CANCELLED,
+                std::memory_order_acq_rel)) {
+        return false;
+    }
+    _controller->_cancelled_count.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool TimerHandle::rescheduleNs(int64_t delay_ns) {
+    if (_task == nullptr || _controller->_stop) {
+        return false;
+    }
+    // claim the old task here, once this succeeds it can no longer fire and the loop thread
+    // always moves its callback over to the new task
+    uint64_t live = _id << TimerTask::STATE_SHIFT;
+    if (!_task->state.compare_exchange_strong(live, live | TimerTask::STATE_MOVED,
+                std::memory_order_acq_rel)) {
+        return false;
+    }
+    TimerTaskPtr task = _controller->createTimerTask();
+    task->interval_ns = std::max<int64_t>(delay_ns, 0);
+    task->create_time = timespec();
+    task->moved_from = _task;
+    task->moved_from_id = _id;
+    *this = _controller->submitTimerTask(task);
+    _controller->_rescheduled_count.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool TimerHandle::pending() const {
+    return _task != nullptr
+        && _task->state.load(std::memory_order_acquire) == (_id << TimerTask::STATE_SHIFT);
+}
@@ -9,42 +9,169 @@
 #include <functional>
 #include <thread>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 
 #include <sys/timerfd.h>
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <unistd.h>
-#include "spinlock.h"
-#include "object_pool.hpp"
+#include "intrusive_object_pool.hpp"
+#include "timing_wheel.h"
+#include "mpsc_queue.hpp"
+#include "ThreadPool.h"
 
 namespace StemCell {
 
-struct TimerTask {
+struct TimerTask : public TimerWheelNode {
+    /*
+     * state = id << STATE_SHIFT | flags, 0 once a one-shot task has fired or the task is recycled.
+     * STATE_MOVED: reschedule() claimed the task, it must neither run nor be recycled
+     * until the loop thread has moved fun over to the replacement
+     */
+    enum { STATE_CANCELLED = 1, STATE_MOVED = 2, STATE_SHIFT = 2 };
+
     bool is_cycle;
-    long interval;
+    // 延迟或周期, 纳秒
+    int64_t interval_ns;
     struct timespec create_time;
     struct timespec expect_time;
     std::function<void()> fun;
+    std::atomic<uint64_t> state;
+    // set on a task created by reschedule(), the loop thread moves fun over from it
+    TimerTask *moved_from;
+    uint64_t moved_from_id;
+    // link in the submission queue
+    TimerTask *submit_next;
+    // loop thread only: a moved task left the heap or the wheel before its replacement took over
+    bool detached;
+    // free list link and slot number in the TimerController's task pool, kept across reset()
+    std::atomic<uint32_t> pool_next;
+    uint32_t pool_index;
     
     TimerTask() : 
         is_cycle(false), 
-        interval(0), 
+        interval_ns(0), 
         create_time({0}), 
-        expect_time({0}) {}
+        expect_time({0}),
+        state(0),
+        moved_from(nullptr),
+        moved_from_id(0),
+        submit_next(nullptr),
+        detached(false),
+        pool_next(0),
+        pool_index(0) {}
 
     void reset() {
+        *static_cast<TimerWheelNode*>(this) = TimerWheelNode();
         is_cycle = false;
-        interval = 0;
+        interval_ns = 0;
         create_time = {0};
         expect_time = {0};
+        state.store(0, std::memory_order_release);
+        moved_from = nullptr;
+        moved_from_id = 0;
+        submit_next = nullptr;
+        detached = false;
+    }
+
+    // cancelled or moved, either way it must not run
+    bool cancelled() const {
+        return state.load(std::memory_order_acquire) & (STATE_CANCELLED | STATE_MOVED);
     }
 };
 
 typedef TimerTask* TimerTaskPtr;
 
+class TimerController;
+
+/**
+ * @brief 到期延迟统计: 回调实际开始执行的时间减去期望的到期时间
+ * 使用执行器时包含回调在执行器队列里等待的时间
+ */
+struct TimerLatenessStats {
+    TimerLatenessStats() : fired(0), total_ns(0), max_ns(0) {}
+
+    uint64_t fired;
+    int64_t total_ns;
+    int64_t max_ns;
+
+    double averageUs() const { return fired == 0 ? 0 : total_ns / 1000.0 / fired; }
+
+    std::string report() const {
+        std::ostringstream out;
+        out << "fired:" << fired << " avg_late_us:" << averageUs() << " max_late_us:" << max_ns / 1000.0;
+        return out.str();
+    }
+};
+
+/**
+ * @brief delayProcess/cycleProcess返回的定时器句柄, 可以随意拷贝
+ * cancel()和reschedule()可以在任意线程调用, 定时器到期、被取消或TimerTask被复用后
+ * 句柄自动失效, 调用返回false. 同一个句柄对象不要在多个线程上同时reschedule.
+ * 句柄不能比它所属的TimerController活得久.
+ */
+class TimerHandle {
+public:
+    TimerHandle() : _controller(nullptr), _task(nullptr), _id(0) {}
+
+    /**
+     * @brief 取消定时器, 任务不再执行; 堆或时间轮里的节点不立即删除, 到期时直接回收
+     * @return 定时器还没有执行(周期任务: 还没有被取消)时返回true
+     */
+    bool cancel();
+
+    /**
+     * @brief 取消当前的到期时间, 改为从现在起delay_time毫秒后执行
+     * 周期任务的周期也改为delay_time(为0时按1毫秒). 成功后句柄指向新的定时器,
+     * 原来的到期时间不会再触发
+     * @return 定时器已经执行过、正在执行(一次性任务)或被取消时返回false, 定时器不受影响
+     */
+    bool reschedule(uint32_t delay_time) { return rescheduleNs(delay_time * 1000000LL); }
+
+    // 亚毫秒精度的版本
+    template<class Rep, class Period>
+    bool reschedule(std::chrono::duration<Rep, Period> delay) {
+        return rescheduleNs(std::chrono::ceil<std::chrono::nanoseconds>(delay).count());
+    }
+
+    // 定时器还没有执行也没有被取消
+    bool pending() const;
+    uint64_t id() const { return _id; }
+
+private:
+    friend class TimerController;
+
+    TimerHandle(TimerController *controller, TimerTaskPtr task, uint64_t id)
+        : _controller(controller), _task(task), _id(id) {}
+
+    bool rescheduleNs(int64_t delay_ns);
+
+    TimerController *_controller;
+    TimerTaskPtr _task;
+    uint64_t _id;
+};
+
 class TimerController {
 public:
-    typedef ObjectPool<TimerTask> TimerTaskPool;
+    // 任意线程都可以无锁地分配TimerTask, 只有定时器线程回收
+    typedef IntrusiveObjectPool<TimerTask, &TimerTask::pool_next, &TimerTask::pool_index> TimerTaskPool;
+    // 执行到期回调的执行器, 参数为要执行的回调
+    typedef std::function<void(std::function<void()>)> TimerExecutor;
+
+    /**
+     * TIMER_BACKEND_HEAP: 二叉堆, 插入和到期O(log n), 每个新的最早任务都要重设timerfd
+     * TIMER_BACKEND_WHEEL: 分层时间轮, 插入和到期O(1), 到期时间按tick向上取整, 即最多晚一个tick
+     * 两种方式下timerfd都只为下一个到期时间设置一次, 没有任务时不会唤醒定时器线程.
+     * 时间基于CLOCK_MONOTONIC, 不受系统时间调整的影响
+     */
+    enum TimerBackend {
+        TIMER_BACKEND_HEAP = 0,
+        TIMER_BACKEND_WHEEL = 1
+    };
     
     enum EventType { 
         // 0 is an invalid val in eventfd 
@@ -52,12 +179,29 @@ public:
         EVENT_STOP = 0x100000000 
     }; 
 
-    TimerController() 
+    /**
+     * @param wheel_tick_us 时间轮的tick长度(微秒), 只对TIMER_BACKEND_WHEEL生效
+     */
+    explicit TimerController(TimerBackend backend = TIMER_BACKEND_HEAP,
+            uint32_t wheel_tick_us = 1000) 
         : _epollfd(0), 
         _eventfd(0), 
         _timerfd(0), 
         _stop(true), 
-        _initialized(false) {}
+        _initialized(false),
+        _backend(backend),
+        _wheel_tick_ns(std::max<uint32_t>(wheel_tick_us, 1) * 1000LL),
+        _wheel_base(),
+        _wheel_armed_tick(UINT64_MAX),
+        _next_timer_id(1),
+        _cancelled_count(0),
+        _rescheduled_count(0),
+        _avoided_fire_count(0),
+        _wakeup_count(0),
+        _fired_count(0),
+        _lateness_total_ns(0),
+        _lateness_max_ns(0),
+        _loop_cpu(-1) {}
 
     ~TimerController() { 
         stop();
@@ -66,6 +210,31 @@ public:
     }
 
     bool init(); 
+
+    /**
+     * @brief 到期的回调交给executor执行, 定时器线程只维护到期时间, 慢回调不会推迟其他定时器
+     * 只能在init()之前设置; 执行器里排队的回调不能比TimerController活得久.
+     * 不设置时回调在定时器线程上执行. 周期任务的各次执行可能在执行器里并发
+     */
+    void setExecutor(TimerExecutor executor) {
+        if (_initialized) {
+            throw std::runtime_error("setExecutor after TimerController::init");
+        }
+        _executor = std::move(executor);
+    }
+
+    // pool的生命周期由调用方管理, 需要比TimerController长
+    void setExecutor(ThreadPool *pool) {
+        setExecutor([pool](std::function<void()> fun) { pool->enqueue(std::move(fun)); });
+    }
+
+    // 把定时器线程绑定到cpu上, 只能在init()之前设置, 绑定失败时init()抛异常
+    void setLoopThreadCpu(int cpu) {
+        if (_initialized) {
+            throw std::runtime_error("setLoopThreadCpu after TimerController::init");
+        }
+        _loop_cpu = cpu;
+    }
     void stop() { 
         if (_stop) return;
         _stop = true; 
@@ -76,18 +245,60 @@ public:
         if (_loop_thread.joinable()) _loop_thread.join();
     }
 
+    // delay_time和interval的单位为毫秒
     template<class F, class... Args>
-    void delayProcess(uint32_t delay_time, F&& f, Args&&... args);
+    TimerHandle delayProcess(uint32_t delay_time, F&& f, Args&&... args) {
+        return delayProcess(std::chrono::milliseconds(delay_time),
+                std::forward<F>(f), std::forward<Args>(args)...);
+    }
     template<class F, class... Args>
-    void  cycleProcess(uint32_t interval, F&& f, Args&&... args);
+    TimerHandle cycleProcess(uint32_t interval, F&& f, Args&&... args) {
+        return cycleProcess(std::chrono::milliseconds(interval),
+                std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    // 任意std::chrono时长, 可以低于1毫秒; 时间轮方式下精度受tick长度限制
+    template<class Rep, class Period, class F, class... Args>
+    TimerHandle delayProcess(std::chrono::duration<Rep, Period> delay_time, F&& f, Args&&... args);
+    template<class Rep, class Period, class F, class... Args>
+    TimerHandle cycleProcess(std::chrono::duration<Rep, Period> interval, F&& f, Args&&... args);
+
+    // 成功的cancel()次数
+    uint64_t cancelledCount() const { return _cancelled_count.load(std::memory_order_relaxed); }
+    // 成功的reschedule()次数
+    uint64_t rescheduledCount() const { return _rescheduled_count.load(std::memory_order_relaxed); }
+    // 因为取消或重新调度而没有执行, 直接回收的TimerTask个数
+    uint64_t avoidedFireCount() const { return _avoided_fire_count.load(std::memory_order_relaxed); }
+    // 提交任务时写eventfd唤醒定时器线程的次数, 只有提交队列由空变为非空时才写
+    uint64_t wakeupCount() const { return _wakeup_count.load(std::memory_order_relaxed); }
+
+    TimerLatenessStats latenessStats() const {
+        TimerLatenessStats stats;
+        stats.fired = _fired_count.load(std::memory_order_relaxed);
+        stats.total_ns = _lateness_total_ns.load(std::memory_order_relaxed);
+        stats.max_ns = _lateness_max_ns.load(std::memory_order_relaxed);
+        return stats;
+    }
 
 private:
+    friend class TimerHandle;
     
     void loop(); 
     void custTimerTask();   
     void addTimerTask(TimerTaskPtr task);
+    void insertTimerTasks(std::vector<TimerTaskPtr> &tasks);
     void refreshTimer(TimerTaskPtr task);
+    void armTimer(const struct timespec &deadline);
+    void refreshWheelTimer();
     void execEarliestTimerTask();
+    void execExpiredWheelTasks();
+    void runTimerTask(TimerTaskPtr task);
+    void recordLateness(const struct timespec &expect_time);
+    TimerHandle submitTimerTask(TimerTaskPtr task);
+    void takeOverTimerTask(TimerTaskPtr task);
+    void recycleTimerTask(TimerTaskPtr task);
+    void dropCancelledTimerTask(TimerTaskPtr task);
+    uint64_t wheelTickOf(const struct timespec &time, bool round_up) const;
     
     void close() {
         if (!_initialized) return;
@@ -102,7 +313,7 @@ private:
     }
 
     TimerTaskPtr createTimerTask() { 
-        return &(_timer_task_pool.createInstance());
+        return _timer_task_pool.create();
     }
     
     int32_t _epollfd;
@@ -110,16 +321,33 @@ private:
     int32_t _timerfd;
     volatile bool _stop;
     bool _initialized;
-    Spinlock _lock;
-    std::queue<TimerTaskPtr> _timer_task_queue;
+    IntrusiveMpscQueue<TimerTask, &TimerTask::submit_next> _timer_task_queue;
+    std::vector<TimerTaskPtr> _submitted_tasks;
     std::vector<TimerTaskPtr> _timer_task_heap;
+    TimerBackend _backend;
+    int64_t _wheel_tick_ns;
+    struct timespec _wheel_base;
+    uint64_t _wheel_armed_tick;     // UINT64_MAX when the timerfd is not armed
+    TimingWheel _timer_wheel;
+    std::vector<TimerTaskPtr> _expired_tasks;
+    std::atomic<uint64_t> _next_timer_id;
+    std::atomic<uint64_t> _cancelled_count;
+    std::atomic<uint64_t> _rescheduled_count;
+    std::atomic<uint64_t> _avoided_fire_count;
+    std::atomic<uint64_t> _wakeup_count;
+    TimerExecutor _executor;
+    std::atomic<uint64_t> _fired_count;
+    std::atomic<int64_t> _lateness_total_ns;
+    std::atomic<int64_t> _lateness_max_ns;
     TimerTaskPool _timer_task_pool;
+    int _loop_cpu;      // -1 means not pinned
     std::thread _loop_thread;
 };
 
 // add new work item to the timer heap
-template<class F, class... Args>
-void TimerController::delayProcess(uint32_t delay_time, F&& f, Args&&... args) {
+template<class Rep, class Period, class F, class... Args>
+TimerHandle TimerController::delayProcess(std::chrono::duration<Rep, Period> delay_time,
+        F&& f, Args&&... args) {
     if(_stop) { 
         throw std::runtime_error("TimerController is stoped!");
     }
@@ -128,18 +356,21 @@ void TimerController::delayProcess(uint32_t delay_time, F&& f, Args&&... args) {
         std::bind(std::forward<F>(f), std::forward<Args>(args)...);
     TimerTaskPtr timer_task = createTimerTask();
     timer_task->is_cycle = false;
-    timer_task->interval = delay_time;
+    timer_task->interval_ns = std::max<int64_t>(
+            std::chrono::ceil<std::chrono::nanoseconds>(delay_time).count(), 0);
     timer_task->create_time = {0};
     timer_task->fun = [task](){ task(); };
-    addTimerTask(timer_task);
+    return submitTimerTask(timer_task);
 }
 
-template<class F, class... Args>
-void TimerController::cycleProcess(uint32_t interval, F&& f, Args&&... args) {
+template<class Rep, class Period, class F, class... Args>
+TimerHandle TimerController::cycleProcess(std::chrono::duration<Rep, Period> interval,
+        F&& f, Args&&... args) {
     if(_stop) { 
         throw std::runtime_error("TimerController is stoped!");
     }
-    if (interval <= 0) {
+    int64_t interval_ns = std::chrono::ceil<std::chrono::nanoseconds>(interval).count();
+    if (interval_ns <= 0) {
         throw std::runtime_error("interval is below or equal to zero!");
     }
     using return_type = typename std::result_of<F(Args...)>::type;
@@ -147,10 +378,10 @@ void TimerController::cycleProcess(uint32_t interval, F&& f, Args&&... args) {
         std::bind(std::forward<F>(f), std::forward<Args>(args)...);
     TimerTaskPtr timer_task = createTimerTask();
     timer_task->is_cycle = true;
-    timer_task->interval = interval;
+    timer_task->interval_ns = interval_ns;
     timer_task->create_time = {0};
     timer_task->fun = [task](){ task(); };
-    addTimerTask(timer_task);
+    return submitTimerTask(timer_task);
 }
 
 } // end namespace StemCell
@@ -0,0 +1,258 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace StemCell {
+
+/**
+ * @brief 挂在TimingWheel上的侵入式链表节点, 定时任务继承它
+ */
+struct TimerWheelNode {
+    TimerWheelNode() : prev(nullptr), next(nullptr), expire_tick(0), slot(-1) {}
+
+    bool linked() const { return slot >= 0; }
+
+    TimerWheelNode *prev;
+    TimerWheelNode *next;
+    uint64_t expire_tick;
+    int32_t slot;
+};
+
+/**
+ * @brief 分层hash时间轮, 插入、删除O(1), 到期处理均摊O(1)
+ *
+ * 第0层256个slot, 每个slot对应一个tick; 第1到4层各64个slot, 每个slot覆盖
+ * 下一层转一圈的时间, 一共覆盖2^32个tick. 第0层转完一圈时把第1层当前slot里的节点
+ * 重新插入(下沉到更低的层), 第1层转完一圈时再下沉第2层, 依此类推.
+ * 超出范围的节点先放在最高层的最后一个位置, 下沉时按真实的到期tick重新计算.
+ * 每层维护非空slot的位图, advance()跳过没有节点的tick, 长时间空闲后推进的代价与跳过的tick数无关.
+ * 不是线程安全的, 只在定时器线程上使用.
+ */
+class TimingWheel {
+public:
+    enum {
+        LEVEL0_BITS = 8,
+        LEVEL_BITS = 6,
+        LEVELS = 5,
+        LEVEL0_SLOTS = 1 << LEVEL0_BITS,
+        LEVEL_SLOTS = 1 << LEVEL_BITS,
+        SLOT_COUNT = LEVEL0_SLOTS + (LEVELS - 1) * LEVEL_SLOTS
+    };
+
+    explicit TimingWheel(uint64_t start_tick = 0) : _current(start_tick), _size(0) {
+        for (int i = 0; i < SLOT_COUNT; ++i) {
+            _slots[i].prev = &_slots[i];
+            _slots[i].next = &_slots[i];
+        }
+        for (int i = 0; i < LEVEL0_SLOTS / 64; ++i) {
+            _level0_bits[i] = 0;
+        }
+        for (int i = 0; i < LEVELS; ++i) {
+            _level_bits[i] = 0;
+        }
+    }
+
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    // 到期tick不晚于当前tick的节点在下一个tick到期
+    void insert(TimerWheelNode *node, uint64_t expire_tick) {
+        node->expire_tick = expire_tick > _current ? expire_tick : _current + 1;
+        place(node);
+        ++_size;
+    }
+
+    // node必须在本时间轮上
+    void remove(TimerWheelNode *node) {
+        unlink(node);
+        --_size;
+    }
+
+    /**
+     * @brief 推进到now_tick, 按到期顺序对每个到期节点调用on_expire(TimerWheelNode*)
+     * 回调时节点已经摘下, 回调里可以再插入
+     */
+    template<class F>
+    void advance(uint64_t now_tick, F &&on_expire) {
+        while (true) {
+            // jump straight to the next occupied level 0 slot or the next non-empty cascade
+            uint64_t next = nextTick();
+            if (next > now_tick) {
+                _current = now_tick;
+                return;
+            }
+            _current = next;
+            if ((_current & (LEVEL0_SLOTS - 1)) == 0) {
+                cascade();
+            }
+            expireSlot(_current & (LEVEL0_SLOTS - 1), on_expire);
+        }
+    }
+
+    /**
+     * @brief advance()下一次有事可做的tick: 第0层最近的非空slot, 或者上层最近一次非空slot的下沉.
+     * 不会晚于最早的到期tick, 空时返回UINT64_MAX
+     */
+    uint64_t nextTick() const {
+        if (_size == 0) {
+            return UINT64_MAX;
+        }
+        uint64_t next = _current + 1;
+        uint64_t best = UINT64_MAX;
+        uint64_t base = next & ~static_cast<uint64_t>(LEVEL0_SLOTS - 1);
+        int from = static_cast<int>(next & (LEVEL0_SLOTS - 1));
+        int index = nextLevel0Slot(from);
+        if (index >= 0) {
+            best = base + index;
+        } else if ((index = nextLevel0Slot(0)) >= 0) {
+            best = base + LEVEL0_SLOTS + index;
+        }
+        // level l cascades its slot (t >> shift) & 63 at every tick t that is a multiple of 1 << shift
+        for (int level = 1; level < LEVELS; ++level) {
+            uint64_t bits = _level_bits[level];
+            if (bits == 0) {
+                continue;
+            }
+            int shift = LEVEL0_BITS + LEVEL_BITS * (level - 1);
+            uint64_t block = (_current >> shift) + 1;
+            int start = static_cast<int>(block & (LEVEL_SLOTS - 1));
+            uint64_t rotated = start == 0 ? bits : (bits >> start) | (bits << (LEVEL_SLOTS - start));
+            uint64_t tick = (block + __builtin_ctzll(rotated)) << shift;
+            if (tick < best) {
+                best = tick;
+            }
+        }
+        return best;
+    }
+
+    uint64_t currentTick() const { return _current; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+private:
+    // 按node->expire_tick与_current的距离选择层, 不修改_size
+    void place(TimerWheelNode *node) {
+        uint64_t expire = node->expire_tick;
+        uint64_t delta = expire - _current;
+        int slot;
+        if (delta < LEVEL0_SLOTS) {
+            slot = static_cast<int>(expire & (LEVEL0_SLOTS - 1));
+            _level0_bits[slot / 64] |= 1ULL << (slot % 64);
+        } else {
+            int level = 1;
+            while (level < LEVELS && delta >= (1ULL << (LEVEL0_BITS + LEVEL_BITS * level))) {
+                ++level;
+            }
+            if (level == LEVELS) {
+                // out of range, park it where the top level is cascaded last
+                level = LEVELS - 1;
+                expire = _current + (1ULL << (LEVEL0_BITS + LEVEL_BITS * level)) - 1;
+            }
+            int index = static_cast<int>((expire >> (LEVEL0_BITS + LEVEL_BITS * (level - 1)))
+                    & (LEVEL_SLOTS - 1));
+            slot = LEVEL0_SLOTS + (level - 1) * LEVEL_SLOTS + index;
+            _level_bits[level] |= 1ULL << index;
+        }
+        TimerWheelNode *head = &_slots[slot];
+        node->slot = slot;
+        node->prev = head->prev;
+        node->next = head;
+        head->prev->next = node;
+        head->prev = node;
+    }
+
+    void unlink(TimerWheelNode *node) {
+        int slot = node->slot;
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        node->prev = nullptr;
+        node->next = nullptr;
+        node->slot = -1;
+        if (_slots[slot].next == &_slots[slot]) {
+            clearBit(slot);
+        }
+    }
+
+    void clearBit(int slot) {
+        if (slot < LEVEL0_SLOTS) {
+            _level0_bits[slot / 64] &= ~(1ULL << (slot % 64));
+        } else {
+            int level = (slot - LEVEL0_SLOTS) / LEVEL_SLOTS + 1;
+            _level_bits[level] &= ~(1ULL << ((slot - LEVEL0_SLOTS) % LEVEL_SLOTS));
+        }
+    }
+
+    // 第0层从from开始的第一个非空slot, 没有时返回-1
+    int nextLevel0Slot(int from) const {
+        for (int word = from / 64; word < LEVEL0_SLOTS / 64; ++word) {
+            uint64_t bits = _level0_bits[word];
+            if (word == from / 64) {
+                bits &= ~0ULL << (from % 64);
+            }
+            if (bits != 0) {
+                return word * 64 + __builtin_ctzll(bits);
+            }
+        }
+        return -1;
+    }
+
+    // 第0层转完一圈, 把上层当前slot的节点重新放到更低的层
+    void cascade() {
+        for (int level = 1; level < LEVELS; ++level) {
+            int index = static_cast<int>((_current >> (LEVEL0_BITS + LEVEL_BITS * (level - 1)))
+                    & (LEVEL_SLOTS - 1));
+            int slot = LEVEL0_SLOTS + (level - 1) * LEVEL_SLOTS + index;
+            if (_level_bits[level] & (1ULL << index)) {
+                TimerWheelNode list;
+                takeSlot(slot, list);
+                while (list.next != &list) {
+                    TimerWheelNode *node = list.next;
+                    list.next = node->next;
+                    place(node);
+                }
+            }
+            if (index != 0) {
+                break;
+            }
+        }
+    }
+
+    template<class F>
+    void expireSlot(int slot, F &on_expire) {
+        if ((_level0_bits[slot / 64] & (1ULL << (slot % 64))) == 0) {
+            return;
+        }
+        TimerWheelNode list;
+        takeSlot(slot, list);
+        while (list.next != &list) {
+            TimerWheelNode *node = list.next;
+            list.next = node->next;
+            node->prev = nullptr;
+            node->next = nullptr;
+            node->slot = -1;
+            --_size;
+            on_expire(node);
+        }
+    }
+
+    // 把整个slot摘到list上(只用list.next单向遍历), slot变为空
+    void takeSlot(int slot, TimerWheelNode &list) {
+        TimerWheelNode *head = &_slots[slot];
+        list.next = head->next;
+        head->prev->next = &list;
+        head->prev = head;
+        head->next = head;
+        clearBit(slot);
+    }
+
+    uint64_t _current;
+    size_t _size;
+    TimerWheelNode _slots[SLOT_COUNT];
+    uint64_t _level0_bits[LEVEL0_SLOTS / 64];
+    uint64_t _level_bits[LEVELS];   // 下标0不用
+};
+
+} // end namespace StemCell
+#endif
@@ -0,0 +1,271 @@
+/**
+ * @brief 按列类型列表加载多列TSV文件, 存储为按列存放的表
+ *
+ *   typedef TsvTable<Schema<int64_t, std::string_view, double, float>, 0> AdTable;
+ *   HotSwitchDict<AdTable> dict(file, flag);
+ *   dict.init(&AdTable::load);
+ *   const double *bid = dict.pin()->find<2>(adId);
+ *
+ * 每一列的解析函数在编译期按列类型选定: 数值用std::from_chars, std::string拷贝整个字段,
+ * std::string_view存放在表自带的StringArena里, 没有虚函数也没有stringstream.
+ * 每列是一个独立的vector, 只扫描一两列时不会把其他列读进cache.
+ * KeyColumn不为TSV_NO_KEY时加载后在该列上建FlatHashMap索引, 重复的key以后出现的行为准.
+ * 加载走Dict::buildDict, 所有加载方式(含并行和流水线)都适用.
+ */
+#ifndef TSV_SCHEMA_H
+#define TSV_SCHEMA_H
+
+#include <vector>
+#include <tuple>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <utility>
+#include <type_traits>
+#include <cstdint>
+#include "dict.h"
+#include "flat_hash_map.hpp"
+#include "string_arena.h"
+#include "mmap_file.h"
+
+namespace StemCell {
+
+#define TSV_NO_KEY (-1)
+#define TSV_NPOS (static_cast<size_t>(-1))
+
+template<class... Columns>
+struct Schema {
+    enum { COLUMN_COUNT = sizeof...(Columns) };
+    typedef std::tuple<Columns...> row_type;
+    template<size_t I>
+    using column_type = typename std::tuple_element<I, row_type>::type;
+};
+
+template<int KeyColumn, class RowType, bool = (KeyColumn >= 0)>
+struct TsvKeyType {
+    typedef typename std::tuple_element<KeyColumn, RowType>::type type;
+};
+
+template<int KeyColumn, class RowType>
+struct TsvKeyType<KeyColumn, RowType, false> {
+    typedef std::nullptr_t type;
+};
+
+template<class SchemaType, int KeyColumn = TSV_NO_KEY>
+class TsvTable;
+
+/**
+ * @brief 按列存放的只读表, 列类型由Schema给出
+ * 以制表符分隔, 字段数少于列数的行被跳过, 多出的字段被忽略.
+ * 行首尾的空白在切分前被去掉, 所以最后一列不能为空.
+ * 1字节的整数列按数字解析; 不支持bool列(std::vector<bool>不是连续存储), 用int8_t代替.
+ */
+template<int KeyColumn, class... Columns>
+class TsvTable<Schema<Columns...>, KeyColumn> {
+public:
+    typedef Schema<Columns...> schema_type;
+    typedef typename schema_type::row_type row_type;
+    template<size_t I>
+    using column_type = typename schema_type::template column_type<I>;
+    typedef typename TsvKeyType<KeyColumn, row_type>::type key_type;
+
+    enum { COLUMN_COUNT = schema_type::COLUMN_COUNT };
+    static constexpr bool HAS_KEY = KeyColumn >= 0;
+    static_assert(COLUMN_COUNT > 0, "schema needs at least one column");
+    static_assert(!std::disjunction<std::is_same<Columns, bool>...>::value,
+            "use int8_t instead of bool columns");
+    static_assert(KeyColumn < COLUMN_COUNT, "key column out of range");
+
+    TsvTable() {}
+
+    // 供DefaultNewDictFunc使用, 文件打开失败时抛出int
+    explicit TsvTable(const std::string &fileName) {
+        TsvTable *table = load(fileName);
+        if (table == nullptr) {
+            throw -1;
+        }
+        *this = std::move(*table);
+        delete table;
+    }
+
+    // 文件打开失败返回nullptr
+    static TsvTable *load(const std::string &fileName) {
+        TsvTable *table = Dict::buildDict<TsvTable>(fileName,
+                [](TsvTable &table, std::string_view line, Dict::LineContext &ctx) {
+            Dict::splitView(MAP_DICT_SEP, line, ctx.fields);
+            if (ctx.fields.size() < COLUMN_COUNT) {
+                return;
+            }
+            table.appendRow(ctx.fields, std::index_sequence_for<Columns...>());
+        }, &TsvTable::merge);
+        if (table == nullptr) {
+            return nullptr;
+        }
+        table->shrink(std::index_sequence_for<Columns...>());
+        table->buildIndex();
+        LOG(INFO) << "new_dict_ rows:" << table->size() << " bytes:" << table->memoryBytes();
+        return table;
+    }
+
+    size_t size() const { return std::get<0>(_columns).size(); }
+    bool empty() const { return size() == 0; }
+
+    template<size_t I>
+    const std::vector<column_type<I> > &column() const { return std::get<I>(_columns); }
+
+    template<size_t I>
+    const column_type<I> &get(size_t row) const { return std::get<I>(_columns)[row]; }
+
+    row_type row(size_t index) const { return row(index, std::index_sequence_for<Columns...>()); }
+
+    // 按key列查找行号, 不存在时返回TSV_NPOS
+    size_t findRow(const key_type &key) const {
+        static_assert(HAS_KEY, "TsvTable has no key column");
+        auto it = _index.find(key);
+        return it == _index.end() ? TSV_NPOS : it->second;
+    }
+
+    // key所在行第I列的值, 不存在时返回nullptr
+    template<size_t I>
+    const column_type<I> *find(const key_type &key) const {
+        size_t row = findRow(key);
+        return row == TSV_NPOS ? nullptr : &std::get<I>(_columns)[row];
+    }
+
+    size_t count(const key_type &key) const { return findRow(key) == TSV_NPOS ? 0 : 1; }
+
+    // 各列、字符串arena与索引占用的字节数, 不含std::string列内部再分配的内存
+    size_t memoryBytes() const {
+        size_t bytes = columnBytes(std::index_sequence_for<Columns...>()) + indexBytes();
+        for (size_t i = 0; i < _arenas.size(); ++i) {
+            bytes += _arenas[i]->memoryBytes();
+        }
+        return bytes;
+    }
+
+    // 切换前预热, 返回触碰的页数
+    size_t prefault() const {
+        return prefaultColumns(std::index_sequence_for<Columns...>()) + prefaultIndex();
+    }
+
+    // 后面一段的行追加到前面一段, 字符串arena一起转移
+    static void merge(TsvTable &result, TsvTable &later, int32_t) {
+        result.append(later, std::index_sequence_for<Columns...>());
+        result._arenas.insert(result._arenas.end(), later._arenas.begin(), later._arenas.end());
+        later._arenas.clear();
+    }
+
+private:
+    typedef typename std::conditional<HAS_KEY, FlatHashMap<key_type, uint32_t>, char>::type IndexType;
+
+    template<size_t... I>
+    void appendRow(const std::vector<std::string_view> &fields, std::index_sequence<I...>) {
+        (appendField<I>(fields[I]), ...);
+    }
+
+    template<size_t I>
+    void appendField(std::string_view field) {
+        std::vector<column_type<I> > &column = std::get<I>(_columns);
+        column.emplace_back();
+        parseColumn(field, column.back());
+    }
+
+    template<class T>
+    static typename std::enable_if<IsCharconvType<T>::value>::type
+    parseColumn(std::string_view field, T &value) {
+        Dict::parseField(field, value);
+    }
+
+    template<class T>
+    static typename std::enable_if<std::is_integral<T>::value && sizeof(T) == 1
+        && !std::is_same<T, bool>::value>::type
+    parseColumn(std::string_view field, T &value) {
+        int32_t number = 0;
+        if (Dict::parseField(field, number)) {
+            value = static_cast<T>(number);
+        }
+    }
+
+    static void parseColumn(std::string_view field, std::string &value) {
+        field = Dict::stripView(field);
+        value.assign(field.data(), field.size());
+    }
+
+    void parseColumn(std::string_view field, std::string_view &value) {
+        if (_arenas.empty()) {
+            _arenas.push_back(std::make_shared<StringArena>());
+        }
+        value = _arenas.front()->store(Dict::stripView(field));
+    }
+
+    template<size_t... I>
+    void append(TsvTable &later, std::index_sequence<I...>) {
+        (appendColumn(std::get<I>(_columns), std::get<I>(later._columns)), ...);
+    }
+
+    template<class T>
+    static void appendColumn(std::vector<T> &result, std::vector<T> &later) {
+        if (result.empty()) {
+            result.swap(later);
+            return;
+        }
+        result.insert(result.end(), std::make_move_iterator(later.begin()),
+                std::make_move_iterator(later.end()));
+        std::vector<T>().swap(later);
+    }
+
+    template<size_t... I>
+    void shrink(std::index_sequence<I...>) {
+        (std::get<I>(_columns).shrink_to_fit(), ...);
+    }
+
+    template<size_t... I>
+    row_type row(size_t index, std::index_sequence<I...>) const {
+        return row_type(std::get<I>(_columns)[index]...);
+    }
+
+    template<size_t... I>
+    size_t columnBytes(std::index_sequence<I...>) const {
+        return ((std::get<I>(_columns).capacity() * sizeof(column_type<I>)) + ... + 0);
+    }
+
+    template<size_t... I>
+    size_t prefaultColumns(std::index_sequence<I...>) const {
+        return (prefaultMemory(std::get<I>(_columns).data(),
+                    std::get<I>(_columns).size() * sizeof(column_type<I>)) + ... + 0);
+    }
+
+    void buildIndex() {
+        if constexpr (HAS_KEY) {
+            const std::vector<key_type> &keys = std::get<KeyColumn>(_columns);
+            std::vector<std::pair<key_type, uint32_t> > entries;
+            entries.reserve(keys.size());
+            for (size_t i = 0; i < keys.size(); ++i) {
+                entries.emplace_back(keys[i], static_cast<uint32_t>(i));
+            }
+            _index.build(std::move(entries));
+        }
+    }
+
+    size_t indexBytes() const {
+        if constexpr (HAS_KEY) {
+            return _index.memoryBytes();
+        }
+        return 0;
+    }
+
+    size_t prefaultIndex() const {
+        if constexpr (HAS_KEY) {
+            return _index.prefault();
+        }
+        return 0;
+    }
+
+    std::tuple<std::vector<Columns>...> _columns;
+    // std::string_view列的内容, 拷贝出的表与原表共享
+    std::vector<std::shared_ptr<StringArena> > _arenas;
+    IndexType _index;
+};
+
+} // end namespace StemCell
+#endif
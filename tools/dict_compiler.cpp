@@ -0,0 +1,31 @@
+#include <iostream>
+#include <string>
+#include "binary_dict.h"
+using namespace std;
+using namespace StemCell;
+
+// 把TSV词典离线编译成二进制镜像, 在线用BinarySIMapDict等类型直接映射加载
+int main(int argc, char *argv[]) {
+    if (argc != 4) {
+        cerr << "usage: " << argv[0] << " <si|li|livec> <input.tsv> <output.bin>" << endl;
+        return 1;
+    }
+    string shape = argv[1];
+    bool ok = false;
+    Dict::setLoadMode(Dict::LOAD_MODE_MMAP);
+    if (shape == "si") {
+        ok = BinaryDictCompiler::compileSIMapDict(argv[2], argv[3]);
+    } else if (shape == "li") {
+        ok = BinaryDictCompiler::compileLIMapDict(argv[2], argv[3]);
+    } else if (shape == "livec") {
+        ok = BinaryDictCompiler::compileLIVecMapDict(argv[2], argv[3]);
+    } else {
+        cerr << "unknown dict shape: " << shape << endl;
+        return 1;
+    }
+    if (!ok) {
+        cerr << "failed to compile " << argv[2] << " to " << argv[3] << endl;
+        return 1;
+    }
+    return 0;
+}